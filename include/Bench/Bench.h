@@ -0,0 +1,24 @@
+#if !defined(__BENCH_H__)
+#define __BENCH_H__
+
+#include "CommonDefinitions.h"
+
+// Measures wall time of a callable repeated given number of times, in seconds.
+template <typename Callable>
+double MeasureSeconds(size_t iterations, Callable&& callable)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i)
+        callable();
+    auto finish = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(finish - start).count();
+}
+
+// Frame integrity cost on 64 B - 1 MB frames.
+void RunChecksumBench();
+
+// Connection manager under each lock policy, from a single thread to
+// twice as many as there are cores.
+void RunLockBench();
+
+#endif // __BENCH_H__
@@ -3,11 +3,12 @@
 
 #include "AppLogic.h"
 #include "System/WinSockIniter.h"
+#include "Framing.h"
 
 class AsioClient final : public AppLogic<AsioClient, false>
 {
 public:
-    AsioClient(const char* addr, uint16_t port);
+    AsioClient(const char* addr, uint16_t port, const FramingPolicy& framing);
     ~AsioClient() { Stop(); }
 
     void OnRun();
@@ -19,6 +20,10 @@ private:
     boost::asio::ip::tcp::socket m_sock;
     boost::asio::ip::tcp::endpoint m_endpoint;
     boost::array<char, BUF_SIZE> m_data;
+    FramingPolicy m_policy;
+    FrameFilter m_framing;
+    // Received frames not decoded yet as they haven't come whole.
+    std::string m_framedInput;
 };
 
 template <typename T> struct DescrDeleter
@@ -91,10 +96,16 @@ class SystemClient : public AppLogic
     Descriptor m_sock;
     addrinfo* m_addrInfo;
     boost::array<char, BUF_SIZE> m_data;
+    FramingPolicy m_policy;
+    FrameFilter m_framing;
+    // Received frames not decoded yet as they haven't come whole.
+    std::string m_framedInput;
 
 public:
-    SystemClient(const char* addr, uint16_t port)
+    SystemClient(const char* addr, uint16_t port, const FramingPolicy& framing)
     : m_addrInfo(nullptr)
+    , m_policy(framing)
+    , m_framing(m_policy)
     {
         m_sock = socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP);
         if (ErrorCheck<Descriptor>(m_sock).Failed()) throw Exception();
@@ -112,6 +123,8 @@ public:
         if (ErrorCheck<int>(res).Failed()) throw Exception();
 
         std::cout << "Client connected to " << addr << "(" << port << ")." << std::endl;
+
+        if (m_policy.m_compression || m_policy.m_checksum || m_policy.m_serviceClass) Negotiate();
     }
 
     ~SystemClient() { this->Stop(); }
@@ -125,7 +138,11 @@ public:
             std::string input;
             std::getline(std::cin, input);
 
-            int res = send(m_sock, input.c_str(), static_cast<int>(input.length()), 0);
+            std::string output = input;
+            if (m_framing.IsFramed())
+                m_framing.Encode(input.data(), input.length(), output);
+
+            int res = send(m_sock, output.c_str(), static_cast<int>(output.length()), 0);
             if(ErrorCheck<int>(res).Failed())
             {
                 std::cerr << "Error writing data: " << Exception::GetErrorDescription() << std::endl;
@@ -137,6 +154,14 @@ public:
             }
 
             std::fill(std::begin(m_data), std::end(m_data), 0);
+            if (m_framing.IsFramed())
+            {
+                std::string dataReceived;
+                if (!ReceiveFramed(input.length(), dataReceived)) break;
+                std::cout << "Data received: " << dataReceived << std::endl;
+                continue;
+            }
+
             res = recv(m_sock, &m_data[0], BUF_SIZE, 0);
             if (ErrorCheck<int>(res).Failed())
             {
@@ -159,6 +184,46 @@ public:
         m_deleter(m_sock);
         std::cout << "System API based client finished." << std::endl;
     }
+
+private:
+    // Echo may come in several frames, split and joined by the stream
+    // in any way, so it's read until the whole message is decoded.
+    bool ReceiveFramed(size_t size, std::string& dataReceived)
+    {
+        while (dataReceived.size() < size)
+        {
+            int res = recv(m_sock, &m_data[0], BUF_SIZE, 0);
+            if (ErrorCheck<int>(res).Failed() || !res)
+            {
+                std::cerr << "Error reading data: " << Exception::GetErrorDescription() << std::endl;
+                return false;
+            }
+
+            m_framedInput.append(&m_data[0], res);
+            size_t consumed = 0;
+            if (!m_framing.Decode(m_framedInput.data(), m_framedInput.size(), consumed, dataReceived))
+            {
+                std::cerr << "Malformed frame received." << std::endl;
+                return false;
+            }
+            m_framedInput.erase(0, consumed);
+        }
+        return true;
+    }
+
+    // Offer framing features to the server before any data exchanged.
+    void Negotiate()
+    {
+        std::string offer = m_framing.Offer();
+        int res = send(m_sock, offer.c_str(), static_cast<int>(offer.length()), 0);
+        if (ErrorCheck<int>(res).Failed()) throw Exception();
+
+        res = recv(m_sock, &m_data[0], BUF_SIZE, 0);
+        if (ErrorCheck<int>(res).Failed()) throw Exception();
+
+        m_framing.Confirm(&m_data[0], res);
+        std::cout << "Framing " << (m_framing.IsFramed() ? "enabled." : "declined by server.") << std::endl;
+    }
 };
 
 
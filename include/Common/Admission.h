@@ -0,0 +1,71 @@
+#if !defined(__ADMISSION_H__)
+#define __ADMISSION_H__
+
+#include "CommonDefinitions.h"
+
+struct AdmissionPolicy
+{
+	// Connections served at once, zero means unlimited.
+	size_t m_maxConnections;
+	// Peers accepted per second on average, bursts of up to that many are allowed.
+	// Zero means unlimited.
+	size_t m_acceptRate;
+	// Event loop busy for longer per wakeup, in microseconds, is overloaded.
+	// Zero means loop isn't watched.
+	size_t m_maxLag;
+	// More events ready per wakeup is overload. Zero means it isn't watched.
+	size_t m_maxQueue;
+
+	AdmissionPolicy(size_t maxConnections = 0, size_t acceptRate = 0,
+		size_t maxLag = 0, size_t maxQueue = 0)
+	: m_maxConnections(maxConnections)
+	, m_acceptRate(acceptRate)
+	, m_maxLag(maxLag)
+	, m_maxQueue(maxQueue)
+	{}
+};
+
+// Load of the server at the moment a peer is about to be accepted.
+struct LoadSignals
+{
+	size_t m_connections;
+	// Smoothed event loop busy time per wakeup, microseconds.
+	size_t m_lag;
+	// Smoothed number of events ready per wakeup.
+	size_t m_queue;
+};
+
+// Decides whether a waiting peer is taken. Overloaded server turns peers
+// away at once so that they can retry elsewhere, instead of taking them
+// all and letting every one time out. Peers coming faster than accept
+// rate are left in backlog until the rate allows to take them.
+class AdmissionControl final
+{
+public:
+	using Clock_t = std::chrono::steady_clock;
+
+	enum Decision
+	{
+		admit,
+		// Accept, reply busy and close.
+		reject,
+		// Stop accepting for a while.
+		pause
+	};
+
+	AdmissionControl(const AdmissionPolicy& policy);
+
+	Decision Admit(const LoadSignals& load);
+
+	// How long accepting stops on pause, in milliseconds.
+	size_t GetPause() const;
+
+private:
+	AdmissionPolicy m_policy;
+	boost::mutex m_mutex;
+	// Token bucket of accept rate.
+	double m_tokens;
+	Clock_t::time_point m_refilled;
+};
+
+#endif // __ADMISSION_H__
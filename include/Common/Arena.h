@@ -0,0 +1,111 @@
+#if !defined(__ARENA_H__)
+#define __ARENA_H__
+
+#include "CommonDefinitions.h"
+
+// Bump pointer allocator for temporaries of a single request.
+// Memory is never freed piecemeal, the whole arena is rewound at once.
+class Arena final
+{
+	struct Block
+	{
+		Block* m_next;
+		size_t m_size;
+
+		char* Begin() { return reinterpret_cast<char*>(this + 1); }
+		char* End() { return Begin() + m_size; }
+	};
+
+	static const size_t BLOCK_SIZE = 64 * 1024;
+	// Blocks beyond this amount are released on reset rather than kept.
+	static const size_t MAX_RETAINED_SIZE = 4 * 1024 * 1024;
+
+public:
+	Arena();
+	~Arena();
+
+	Arena(const Arena&) = delete;
+	Arena& operator= (const Arena&) = delete;
+
+	void* Allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+	// Rewind to the beginning of the first block. Blocks are kept
+	// for the next request unless too much has been accumulated.
+	void Reset();
+
+	// Arena of the innermost scope active on calling thread, if any.
+	static Arena* Current();
+
+private:
+	Block* NewBlock(size_t size);
+	void MoveToNextBlock(size_t size, size_t alignment);
+	void Release(Block* block);
+
+private:
+	Block* m_first;
+	Block* m_current;
+	char* m_pos;
+	size_t m_retained;
+
+	friend class ArenaScope;
+};
+
+// Acquires an arena from calling thread's pool for a request dispatch.
+// Arena becomes current for the thread and is reset and returned
+// to the pool as soon as the scope is left.
+class ArenaScope final
+{
+	Arena* m_arena;
+	Arena* m_prev;
+
+public:
+	ArenaScope();
+	~ArenaScope();
+
+	ArenaScope(const ArenaScope&) = delete;
+	ArenaScope& operator= (const ArenaScope&) = delete;
+
+	Arena& Get() { return *m_arena; }
+};
+
+// Standard allocator drawing from the arena current at construction.
+// Without an active scope it falls back to global heap, so that
+// the same container type works both inside and outside dispatch.
+template <typename T>
+class ArenaAllocator
+{
+	Arena* m_arena;
+
+public:
+	using value_type = T;
+
+	ArenaAllocator() : m_arena(Arena::Current()) {}
+	explicit ArenaAllocator(Arena* arena) : m_arena(arena) {}
+
+	template <typename U>
+	ArenaAllocator(const ArenaAllocator<U>& other) : m_arena(other.GetArena()) {}
+
+	Arena* GetArena() const { return m_arena; }
+
+	T* allocate(size_t n)
+	{
+		if (!m_arena) return static_cast<T*>(::operator new(n * sizeof(T)));
+		return static_cast<T*>(m_arena->Allocate(n * sizeof(T), alignof(T)));
+	}
+
+	void deallocate(T* p, size_t)
+	{
+		// Arena memory is given back all at once on reset.
+		if (!m_arena) ::operator delete(p);
+	}
+
+	template <typename U>
+	bool operator== (const ArenaAllocator<U>& other) const { return m_arena == other.GetArena(); }
+
+	template <typename U>
+	bool operator!= (const ArenaAllocator<U>& other) const { return m_arena != other.GetArena(); }
+};
+
+using ArenaString = std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>>;
+
+#endif // __ARENA_H__
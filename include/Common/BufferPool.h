@@ -0,0 +1,31 @@
+#if !defined(__BUFFER_POOL_H__)
+#define __BUFFER_POOL_H__
+
+#include "CommonDefinitions.h"
+
+// IO buffers shared by all connections. Connection borrows a buffer
+// only while it has data to read or keep, so idle connection costs
+// nothing but its own state. Sizes are powers of two from MIN_SIZE up,
+// each class has its own free list. Every thread keeps a few buffers
+// of each class at hand, the rest is exchanged with a shared list
+// in batches to keep locking off the common path.
+class BufferPool final
+{
+public:
+	static const uint8_t CLASS_COUNT = 6;
+	static const size_t MIN_SIZE = 512;
+	static const size_t MAX_SIZE = MIN_SIZE << (CLASS_COUNT - 1);
+
+	static size_t GetSize(uint8_t sizeClass) { return MIN_SIZE << sizeClass; }
+	// Smallest class fitting given size, the largest class if none fits.
+	static uint8_t GetClass(size_t size);
+
+	static char* Acquire(uint8_t sizeClass);
+	static void Release(char* buffer, uint8_t sizeClass);
+
+	// Give memory of the shared list back to the system, buffers at hand
+	// of each thread are given back by the thread itself as it goes.
+	static void Trim();
+};
+
+#endif // __BUFFER_POOL_H__
@@ -0,0 +1,23 @@
+#if !defined(__CHECKSUM_H__)
+#define __CHECKSUM_H__
+
+#include "CommonDefinitions.h"
+
+// CRC32C (Castagnoli). SSE4.2 crc32 instruction used when CPU supports it,
+// otherwise falls back to slicing-by-8 table lookup.
+// Checksums can be chained: Compute(b, Compute(a)) equals checksum of a + b.
+class Crc32c final
+{
+public:
+	static uint32_t Compute(const void* data, size_t size, uint32_t crc = 0);
+
+	// Checksum the source while copying it, so that data is read only once.
+	static uint32_t Copy(void* dst, const void* src, size_t size, uint32_t crc = 0);
+
+	static bool IsAccelerated();
+
+	// Table driven implementation regardless of CPU, used for benchmarking.
+	static uint32_t ComputePortable(const void* data, size_t size, uint32_t crc = 0);
+};
+
+#endif // __CHECKSUM_H__
@@ -6,9 +6,12 @@
 #include <sys/sysinfo.h>
 #include <sys/file.h>
 #include <sys/epoll.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/resource.h>
 #include <pthread.h>
 #include <semaphore.h>
 #include <signal.h>
@@ -40,16 +43,20 @@ extern char* program_invocation_short_name;
 #include <string>
 #include <sstream>
 #include <iostream>
+#include <iomanip>
 #include <exception>
 #include <stdexcept>
 #include <queue>
+#include <deque>
 #include <list>
+#include <vector>
 #include <array>
 #include <algorithm>
 #include <sstream>
 #include <cstdio>
 #include <cstdlib>
 #include <ctime>
+#include <chrono>
 #include <cstring>
 #include <cassert>
 
@@ -64,9 +71,12 @@ extern char* program_invocation_short_name;
 #include <boost/asio.hpp>
 #include <boost/enable_shared_from_this.hpp>
 #include <boost/array.hpp>
+#include <boost/utility/base_from_member.hpp>
 #include <boost/unordered_map.hpp>
 #include <boost/unordered_set.hpp>
 #include <boost/atomic.hpp>
+#include <boost/utility/string_view.hpp>
+#include <boost/algorithm/string/predicate.hpp>
 
 #define USE_NATIVE
 
@@ -85,6 +95,13 @@ struct SubsysIniterNullObj {};
 
 #endif // _WIN64
 
+// Hot data placed on separate lines isn't bounced between cores.
+const size_t CACHE_LINE_SIZE = 64;
+
+// Connections are tagged with a service class, higher classes are served first.
+const uint8_t SERVICE_CLASS_COUNT = 4;
+const uint8_t TOP_SERVICE_CLASS = SERVICE_CLASS_COUNT - 1;
+
 #define CRTP_SELF(Target) \
     Target& Self() { return static_cast<Target&>(*this); }
 
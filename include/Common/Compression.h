@@ -0,0 +1,65 @@
+#if !defined(__COMPRESSION_H__)
+#define __COMPRESSION_H__
+
+#include "CommonDefinitions.h"
+
+#include <zlib.h>
+
+// Interface of payload codec. An instance keeps its stream state
+// between calls so that it's reused for many messages.
+struct ICodec
+{
+	virtual ~ICodec() = default;
+
+	virtual void Compress(const char* data, size_t size, std::string& out) = 0;
+	// Returns false if data is malformed or inflates to more than limit
+	// bytes, so that peers can't make the receiver expand a small message
+	// to a lot of memory.
+	virtual bool Decompress(const char* data, size_t size, size_t limit, std::string& out) = 0;
+};
+
+class ZlibCodec final : public ICodec
+{
+	z_stream m_deflate;
+	z_stream m_inflate;
+
+public:
+	ZlibCodec(int level = Z_BEST_SPEED);
+	~ZlibCodec();
+
+	void Compress(const char* data, size_t size, std::string& out) override;
+	bool Decompress(const char* data, size_t size, size_t limit, std::string& out) override;
+};
+
+using CodecCreator_t = boost::function<ICodec* (void)>;
+
+// Codecs known to the process. Codec is identified by its index
+// in the registry, so that a connection stores a single byte only.
+// Instances are created lazily once per thread and shared by all
+// the connections served by this thread.
+class CodecRegistry final
+{
+	struct Entry
+	{
+		std::string m_name;
+		CodecCreator_t m_creator;
+	};
+
+public:
+	static const uint8_t NO_CODEC = 0xff;
+
+	// Not thread safe, expected to be called at startup only.
+	static uint8_t Register(const std::string& name, CodecCreator_t&& creator);
+
+	static uint8_t Find(const std::string& name);
+	static const std::string& GetName(uint8_t id);
+	static std::string GetNames();
+
+	// Codec instance owned by the calling thread.
+	static ICodec* GetLocal(uint8_t id);
+
+private:
+	static std::vector<Entry>& Entries();
+};
+
+#endif // __COMPRESSION_H__
@@ -0,0 +1,101 @@
+#if !defined(__FRAMING_H__)
+#define __FRAMING_H__
+
+#include "CommonDefinitions.h"
+#include "Compression.h"
+#include "Checksum.h"
+#include "BufferPool.h"
+
+struct FramingPolicy
+{
+	// Whether the side agrees to compress at all.
+	bool m_compression;
+	// Messages shorter than this go uncompressed.
+	size_t m_threshold;
+	// Whether each frame carries CRC32C of its content.
+	bool m_checksum;
+	// Service class the client asks for, zero is the default one.
+	uint8_t m_serviceClass;
+
+	FramingPolicy(bool compression = false, size_t threshold = 256, bool checksum = false,
+		uint8_t serviceClass = 0)
+	: m_compression(compression)
+	, m_threshold(threshold)
+	, m_checksum(checksum)
+	, m_serviceClass(serviceClass)
+	{}
+};
+
+// Per-connection framing stage. At first exchange the client offers
+// a list of features (codecs and checksum), the server picks the ones
+// it agrees to and replies. If the first message isn't an offer
+// the connection stays plain. Once any feature is agreed each message
+// goes as a frame: length of the rest of the frame, a byte telling whether
+// the payload is compressed or not, the payload, and optionally CRC32C of
+// the flag and payload. Stream may split and join frames in any way, so
+// they're decoded only as they come in whole. The offer may also ask for
+// a service class, which doesn't affect framing.
+class FrameFilter final
+{
+	enum Stage : uint8_t
+	{
+		negotiating,
+		plain,
+		framed
+	};
+
+	static const char RAW_FRAME = 'R';
+	static const char COMPRESSED_FRAME = 'Z';
+	static const size_t CHECKSUM_SIZE = sizeof(uint32_t);
+	static const size_t LENGTH_SIZE = sizeof(uint32_t);
+
+	const FramingPolicy* m_policy;
+	Stage m_stage;
+	uint8_t m_codec;
+	bool m_checksum;
+	uint8_t m_serviceClass;
+
+public:
+	// Whole frame fits the largest receive buffer of a connection.
+	static const size_t MAX_FRAME_SIZE = BufferPool::MAX_SIZE;
+	// Payload a frame carries at most, decompressed one included.
+	static const size_t MAX_PAYLOAD_SIZE = MAX_FRAME_SIZE - LENGTH_SIZE - 1 - CHECKSUM_SIZE;
+
+	FrameFilter(const FramingPolicy& policy);
+
+	bool IsNegotiating() const { return m_stage == negotiating; }
+	bool IsFramed() const { return m_stage == framed; }
+	bool IsCompressed() const { return m_codec != CodecRegistry::NO_CODEC; }
+	bool IsChecksummed() const { return m_checksum; }
+	uint8_t GetServiceClass() const { return m_serviceClass; }
+
+	// Server side. Returns true if first message was an offer,
+	// in this case a reply to be sent back is given.
+	bool Accept(const char* data, size_t size, std::string& reply);
+
+	// Client side. Offer features enabled by policy and inspect the reply.
+	std::string Offer() const;
+	bool Confirm(const char* data, size_t size);
+
+	// Peel off framing of whole frames data begins with, verify and
+	// decompress them if needed, their payload is appended to output.
+	// Bytes of frames decoded are returned in consumed, incomplete frame
+	// left is to be decoded once the rest of it comes. Returns false
+	// if a frame is malformed. Raw payload is checksummed while being copied out.
+	bool Decode(const char* data, size_t size, size_t& consumed, std::string& out);
+	// Add framing, compress if message is large enough and append checksum.
+	// Message is split in as many frames as it takes for each to fit
+	// MAX_FRAME_SIZE, so that checksum of each is verified once it's whole.
+	void Encode(const char* data, size_t size, std::string& out);
+
+	// Forget negotiated features as connection gets reused.
+	void Reset();
+
+private:
+	// Frame without its length.
+	bool DecodeFrame(const char* data, size_t size, std::string& out);
+	// Payload fitting a single frame, frame is appended to output.
+	void EncodeFrame(const char* data, size_t size, std::string& out);
+};
+
+#endif // __FRAMING_H__
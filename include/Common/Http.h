@@ -0,0 +1,60 @@
+#if !defined(__HTTP_H__)
+#define __HTTP_H__
+
+#include "CommonDefinitions.h"
+
+// Request parsed in place, all the views point into the receive buffer.
+struct HttpRequest
+{
+	boost::string_view m_method;
+	boost::string_view m_target;
+	boost::string_view m_body;
+	// Minor version of HTTP/1.x.
+	int m_version;
+	bool m_keepAlive;
+};
+
+// Incremental HTTP/1.x request parser. Line ends are looked up
+// 16 bytes at a time with SSE2 where available.
+class HttpParser final
+{
+public:
+	enum Result
+	{
+		incomplete,
+		complete,
+		malformed
+	};
+
+	// Parses a single request from the beginning of data.
+	// On success the number of bytes it occupies is returned via consumed,
+	// so that pipelined requests are parsed one after another.
+	static Result Parse(const char* data, size_t size, HttpRequest& request, size_t& consumed);
+
+	// Position of the first byte equal to c, or end if there's none.
+	static const char* Find(const char* begin, const char* end, char c);
+};
+
+// Builds responses from precomputed header block.
+// Date header is cached per thread and refreshed once per second.
+class HttpResponder final
+{
+public:
+	enum Status
+	{
+		ok,
+		badRequest,
+		payloadTooLarge,
+		serviceUnavailable
+	};
+
+	// Appends response to out, so that responses to pipelined requests
+	// go with a single write.
+	static void Append(std::string& out, Status status, bool keepAlive,
+		const char* body, size_t bodySize, bool headOnly = false);
+
+	// Current value of Date header, e.g. "Sun, 18 Oct 2026 08:21:37 GMT".
+	static const std::string& GetDate();
+};
+
+#endif // __HTTP_H__
@@ -0,0 +1,54 @@
+#if !defined(__LATENCY_STATS_H__)
+#define __LATENCY_STATS_H__
+
+#include "CommonDefinitions.h"
+
+// Latency distribution in log-linear buckets, along with count, sum and
+// maximum. Each power of two range is split into equal sub-buckets, so
+// any latency is told with the same relative error, within 1/16.
+// Recorded lock free by any number of threads, each of them updating
+// a shard of its own mostly, read by summing the shards up.
+class LatencyStats final
+{
+public:
+	static const size_t SUB_BITS = 4;
+	static const size_t SUB_COUNT = 1 << SUB_BITS;
+	// Latencies up to 2^40 are told apart, longer ones fall in the last bucket.
+	static const size_t MAX_BITS = 40;
+	static const size_t BUCKET_COUNT = (MAX_BITS - SUB_BITS + 1) * SUB_COUNT;
+
+	LatencyStats();
+
+	void Record(uint64_t latency);
+
+	uint64_t GetCount() const;
+	uint64_t GetMean() const;
+	uint64_t GetMax() const;
+	uint64_t GetTotal() const;
+	// Upper bound of the bucket given share of samples fit in, e.g. 0.99.
+	uint64_t GetPercentile(double share) const;
+
+	// Samples per bucket summed over shards.
+	using Buckets_t = std::array<uint64_t, BUCKET_COUNT>;
+	void GetBuckets(Buckets_t& buckets) const;
+	// Largest latency bucket holds.
+	static uint64_t GetUpperBound(size_t bucket);
+
+private:
+	static const size_t SHARD_COUNT = 16;
+
+	struct Shard
+	{
+		std::array<boost::atomic<uint64_t>, BUCKET_COUNT> m_buckets;
+		boost::atomic<uint64_t> m_count;
+		boost::atomic<uint64_t> m_total;
+		boost::atomic<uint64_t> m_max;
+		// Totals of a shard and buckets of the next one don't share
+		// a cache line, wherever the array starts.
+		char m_padding[CACHE_LINE_SIZE];
+	};
+
+	std::array<Shard, SHARD_COUNT> m_shards;
+};
+
+#endif // __LATENCY_STATS_H__
@@ -0,0 +1,174 @@
+#if !defined(__LOGGER_H__)
+#define __LOGGER_H__
+
+#include "CommonDefinitions.h"
+
+struct LoggerPolicy;
+
+// Call site of log records. Records refer to it instead of carrying the
+// format, which is put together with arguments by the writer thread only.
+struct LogSite
+{
+	const char* m_format;
+	uint8_t m_level;
+	// Records passed per second, zero means unlimited.
+	uint32_t m_limit;
+	boost::atomic<uint32_t> m_second;
+	boost::atomic<uint32_t> m_passed;
+	// Records skipped by the limit since the last one passed.
+	boost::atomic<uint32_t> m_suppressed;
+
+	LogSite(uint8_t level, uint32_t limit, const char* format)
+	: m_format(format)
+	, m_level(level)
+	, m_limit(limit)
+	, m_second(0)
+	, m_passed(0)
+	, m_suppressed(0)
+	{}
+};
+
+// Binary record of fixed size, arguments are copied as they are.
+// Text arguments go to the tail of the record and are cut to fit.
+struct LogRecord
+{
+	enum ArgType : uint8_t
+	{
+		signedArg,
+		unsignedArg,
+		realArg,
+		textArg,
+		addressArg
+	};
+
+	static const size_t SIZE = 256;
+	static const size_t MAX_ARGS = 6;
+
+	uint64_t m_time;
+	const LogSite* m_site;
+	uint32_t m_suppressed;
+	uint8_t m_argCount;
+	std::array<ArgType, MAX_ARGS> m_types;
+	uint16_t m_textSize;
+	// Text is given by offset in the upper half and size in the lower.
+	std::array<uint64_t, MAX_ARGS> m_args;
+	char m_text[SIZE - 32 - 8 * MAX_ARGS];
+
+	void Add(ArgType type, uint64_t value)
+	{
+		if (m_argCount == MAX_ARGS) return;
+		m_types[m_argCount] = type;
+		m_args[m_argCount++] = value;
+	}
+
+	void AddText(ArgType type, const char* data, size_t size)
+	{
+		size = std::min(size, sizeof(m_text) - m_textSize);
+		memcpy(m_text + m_textSize, data, size);
+		Add(type, static_cast<uint64_t>(m_textSize) << 32 | size);
+		m_textSize = static_cast<uint16_t>(m_textSize + size);
+	}
+};
+
+static_assert(sizeof(LogRecord) == LogRecord::SIZE, "Log record must have fixed size");
+
+// Asynchronous logger. Each thread puts records to a ring of its own,
+// lock free and without formatting, a background thread formats them and
+// writes out in batches. Records coming while the ring is full are dropped
+// and counted. Call sites may limit rate of their records.
+class Logger final
+{
+public:
+	enum Level
+	{
+		debug,
+		info,
+		warning,
+		error
+	};
+
+	static void Start(const LoggerPolicy& policy);
+	// Records put before stop are written out.
+	static void Stop();
+
+	static bool IsEnabled(uint8_t level) { return level >= GetLevel(); }
+	static uint8_t GetLevel();
+	static uint64_t GetDropCount();
+
+	template <typename... Args>
+	static void Write(LogSite& site, const Args&... args)
+	{
+		LogRecord* record = Begin(site);
+		if (!record) return;
+
+		int captures[] = { 0, (Capture(*record, args), 0)... };
+		(void)captures;
+		Commit();
+	}
+
+private:
+	// Record to fill in the ring of current thread, null if it's dropped.
+	static LogRecord* Begin(LogSite& site);
+	static void Commit();
+
+	template <typename T>
+	static typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+	Capture(LogRecord& record, T value) { record.Add(LogRecord::signedArg, static_cast<uint64_t>(static_cast<int64_t>(value))); }
+
+	template <typename T>
+	static typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type
+	Capture(LogRecord& record, T value) { record.Add(LogRecord::unsignedArg, static_cast<uint64_t>(value)); }
+
+	template <typename T>
+	static typename std::enable_if<std::is_floating_point<T>::value>::type
+	Capture(LogRecord& record, T value)
+	{
+		double real = static_cast<double>(value);
+		uint64_t bits = 0;
+		memcpy(&bits, &real, sizeof(bits));
+		record.Add(LogRecord::realArg, bits);
+	}
+
+	static void Capture(LogRecord& record, const char* text) { record.AddText(LogRecord::textArg, text, strlen(text)); }
+	static void Capture(LogRecord& record, const std::string& text) { record.AddText(LogRecord::textArg, text.data(), text.size()); }
+	static void Capture(LogRecord& record, boost::string_view text) { record.AddText(LogRecord::textArg, text.data(), text.size()); }
+	// Address is turned into text by the writer.
+	static void Capture(LogRecord& record, const sockaddr_in6& address)
+	{
+		record.AddText(LogRecord::addressArg, reinterpret_cast<const char*>(&address), sizeof(address));
+	}
+};
+
+struct LoggerPolicy
+{
+	// Records below this level are skipped at call site.
+	uint8_t m_level;
+	// Records a thread may have waiting for the writer, power of two.
+	size_t m_ringSize;
+	// Writer takes records this often, in milliseconds.
+	size_t m_interval;
+
+	LoggerPolicy(uint8_t level = Logger::info, size_t ringSize = 1024, size_t interval = 10)
+	: m_level(level)
+	, m_ringSize(ringSize)
+	, m_interval(interval)
+	{}
+};
+
+// Format has {} for each argument.
+#define LOG_LIMITED(level, limit, format, ...)						\
+	do {															\
+		if (Logger::IsEnabled(level))								\
+		{															\
+			static LogSite logSite(level, limit, format);			\
+			Logger::Write(logSite, ##__VA_ARGS__);					\
+		}															\
+	} while (false)
+
+#define LOG(level, format, ...) LOG_LIMITED(level, 0, format, ##__VA_ARGS__)
+#define LOG_DEBUG(format, ...) LOG(Logger::debug, format, ##__VA_ARGS__)
+#define LOG_INFO(format, ...) LOG(Logger::info, format, ##__VA_ARGS__)
+#define LOG_WARNING(format, ...) LOG(Logger::warning, format, ##__VA_ARGS__)
+#define LOG_ERROR(format, ...) LOG(Logger::error, format, ##__VA_ARGS__)
+
+#endif // __LOGGER_H__
@@ -0,0 +1,133 @@
+#if !defined(__METRICS_H__)
+#define __METRICS_H__
+
+#include "CommonDefinitions.h"
+#include "LatencyStats.h"
+
+// Counter updated by any number of threads, each adding to a shard of its
+// own in a separate cache line mostly, read by summing the shards up.
+class Counter final
+{
+public:
+	Counter();
+
+	void Add(uint64_t value = 1);
+	uint64_t Get() const;
+
+private:
+	static const size_t SHARD_COUNT = 16;
+
+	struct Shard
+	{
+		boost::atomic<uint64_t> m_value;
+		char m_padding[CACHE_LINE_SIZE - sizeof(boost::atomic<uint64_t>)];
+	};
+
+	std::array<Shard, SHARD_COUNT> m_shards;
+};
+
+// Level going up and down, e.g. connections open. Kept the same way
+// as counter, shards may go below zero while their sum doesn't.
+class Gauge final
+{
+public:
+	void Add(int64_t value) { m_counter.Add(static_cast<uint64_t>(value)); }
+	void Sub(int64_t value) { m_counter.Add(static_cast<uint64_t>(-value)); }
+	int64_t Get() const { return static_cast<int64_t>(m_counter.Get()); }
+	// For gauges of a single writer only, e.g. sampled as they're exported.
+	void Set(int64_t value) { Add(value - Get()); }
+
+private:
+	Counter m_counter;
+};
+
+// Metric known to the registry. Label tells apart metrics of the same
+// name, e.g. errors by code, it's empty for a single one.
+struct MetricEntry
+{
+	enum Kind
+	{
+		counter,
+		gauge,
+		histogram
+	};
+
+	std::string m_name;
+	std::string m_label;
+	std::string m_help;
+	Kind m_kind;
+	const void* m_metric;
+
+	const Counter& GetCounter() const { return *static_cast<const Counter*>(m_metric); }
+	const Gauge& GetGauge() const { return *static_cast<const Gauge*>(m_metric); }
+	const LatencyStats& GetHistogram() const { return *static_cast<const LatencyStats*>(m_metric); }
+
+	// Labelled counters still at zero are left out of exports, e.g. errors never seen.
+	bool IsSilent() const { return m_kind == counter && !m_label.empty() && !GetCounter().Get(); }
+};
+
+// Registry of process metrics for export, along with metrics built in.
+// Owners register metrics of their own and unregister them before they're gone.
+class Metrics final
+{
+public:
+	// Stages a turn of connection goes through, latencies in microseconds.
+	enum Stage
+	{
+		// Since epoll has woken the thread till the turn has started.
+		waitStage,
+		// Read call.
+		readStage,
+		// Since input has been read till the response is being written.
+		handleStage,
+		// Write call.
+		writeStage,
+		stageCount
+	};
+
+	// Errors are counted by code, larger codes share the last counter.
+	static const size_t ERROR_CODE_COUNT = 134;
+
+	struct BuiltIn
+	{
+		Counter m_accepts;
+		Counter m_rejects;
+		Counter m_disconnects;
+		Counter m_bytesIn;
+		Counter m_bytesOut;
+		Counter m_messages;
+		std::array<Counter, ERROR_CODE_COUNT> m_errors;
+		Gauge m_activeConnections;
+		Gauge m_idleConnections;
+		std::array<LatencyStats, stageCount> m_stages;
+	};
+
+	static BuiltIn& Get();
+
+	static void Register(const std::string& name, const std::string& label, const std::string& help, const Counter& metric);
+	static void Register(const std::string& name, const std::string& label, const std::string& help, const Gauge& metric);
+	static void Register(const std::string& name, const std::string& label, const std::string& help, const LatencyStats& metric);
+	static void Unregister(const void* metric);
+	// Entries in order of registration.
+	static std::vector<MetricEntry> List();
+	// Visit entries with registry locked, so that none of them is gone meanwhile.
+	static void ForEach(const boost::function<void (const MetricEntry&)>& visitor);
+
+	// Registered metrics in Prometheus text format and in JSON,
+	// histograms are given by percentiles in the latter.
+	static void ExportText(std::string& out);
+	static void ExportJson(std::string& out);
+
+	static void CountError(int code);
+	static const char* GetStageName(Stage stage);
+
+	// Stage clock of the current thread. Turn starts at the time epoll has
+	// woken the thread, each stage is timed since the previous one ended.
+	static uint64_t ReadClock();
+	static void StartTurn(uint64_t wake);
+	static void EndStage(Stage stage);
+	// Stage isn't timed, e.g. read found nothing.
+	static void SkipStage();
+};
+
+#endif // __METRICS_H__
@@ -0,0 +1,74 @@
+#if !defined(__PEER_LIMITER_H__)
+#define __PEER_LIMITER_H__
+
+#include "CommonDefinitions.h"
+
+struct PeerLimitPolicy
+{
+	// Requests a single peer makes per second on average, bursts of up
+	// to that many are allowed. Zero means unlimited.
+	size_t m_requestRate;
+	// Bytes a single peer sends per second, the same way.
+	size_t m_byteRate;
+	// Peers tracked at once, the least recently seen are forgotten first.
+	size_t m_capacity;
+
+	PeerLimitPolicy(size_t requestRate = 0, size_t byteRate = 0, size_t capacity = 0)
+	: m_requestRate(requestRate)
+	, m_byteRate(byteRate)
+	, m_capacity(capacity)
+	{}
+
+	bool IsEnabled() const { return m_requestRate || m_byteRate; }
+};
+
+// Token buckets of request and byte rates per peer address, so that a
+// peer can't get around limits by opening more connections. Buckets are
+// kept in a set associative table of fixed size: an address maps to a set
+// of a few entries, and the least recently seen peer of a full set makes
+// room for a new one. Sets are guarded by striped locks.
+class PeerLimiter final
+{
+	using Clock_t = std::chrono::steady_clock;
+
+public:
+	using Key_t = uint64_t;
+
+	PeerLimiter(const PeerLimitPolicy& policy);
+
+	bool IsEnabled() const { return m_policy.IsEnabled(); }
+
+	// Peers are told apart by address. IPv6 host usually holds a whole /64,
+	// so only the prefix of native IPv6 address counts.
+	static Key_t GetKey(const sockaddr_in6& address);
+
+	// Take requests and bytes the peer has just sent. Returns for how long,
+	// in milliseconds, its input has to wait to get back within limits,
+	// zero if it's within them.
+	size_t Charge(Key_t key, size_t requests, size_t bytes);
+
+private:
+	struct Entry
+	{
+		// Zero if the entry is free.
+		Key_t m_key;
+		float m_requests;
+		float m_bytes;
+		// Milliseconds since the limiter started.
+		uint32_t m_seen;
+	};
+
+	Entry& Find(size_t set, Key_t key, uint32_t now);
+
+	static const size_t SET_SIZE = 8;
+	static const size_t STRIPE_COUNT = 64;
+
+private:
+	PeerLimitPolicy m_policy;
+	size_t m_setMask;
+	std::vector<Entry> m_entries;
+	std::array<boost::mutex, STRIPE_COUNT> m_stripes;
+	Clock_t::time_point m_start;
+};
+
+#endif // __PEER_LIMITER_H__
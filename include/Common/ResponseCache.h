@@ -0,0 +1,100 @@
+#if !defined(__RESPONSE_CACHE_H__)
+#define __RESPONSE_CACHE_H__
+
+#include "CommonDefinitions.h"
+
+struct ResponseCachePolicy
+{
+	bool m_enabled;
+	// Memory bound of all entries, keys and bookkeeping included.
+	size_t m_capacity;
+	// Entry lifetime, in milliseconds.
+	size_t m_ttl;
+	// Independently locked parts, to reduce contention.
+	size_t m_shards;
+
+	ResponseCachePolicy(bool enabled = false, size_t capacity = 64 * 1024 * 1024,
+		size_t ttl = 1000, size_t shards = 16)
+	: m_enabled(enabled)
+	, m_capacity(capacity)
+	, m_ttl(ttl)
+	, m_shards(shards)
+	{}
+};
+
+// Cache of responses keyed by request bytes. Each shard evicts entries
+// by CLOCK algorithm once its part of the memory bound is exceeded,
+// expired entries go first. Concurrent misses for the same request
+// are coalesced: only the first caller runs the handler, the others
+// wait for its result instead of computing the same response again.
+class ResponseCache final
+{
+public:
+	using Clock_t = std::chrono::steady_clock;
+	using Handler_t = boost::function<std::string (const std::string&)>;
+
+	ResponseCache(const ResponseCachePolicy& policy);
+
+	std::string Get(const std::string& request, const Handler_t& handler);
+
+private:
+	// Computation in progress which other callers wait for.
+	struct Flight
+	{
+		bool m_done;
+		std::string m_response;
+		boost::exception_ptr m_error;
+		boost::condition_variable m_cond;
+
+		Flight() : m_done(false) {}
+	};
+
+	using FlightPtr_t = boost::shared_ptr<Flight>;
+	using Index_t = boost::unordered_map<std::string, size_t>;
+	// Slot and the time its entry expires at.
+	using Expiry_t = std::pair<size_t, Clock_t::time_point>;
+
+	struct Slot
+	{
+		// Points to the key kept by index, nodes are never moved.
+		const std::string* m_key;
+		std::string m_response;
+		Clock_t::time_point m_expires;
+		size_t m_cost;
+		bool m_referenced;
+	};
+
+	struct Shard
+	{
+		boost::mutex m_mutex;
+		Index_t m_index;
+		std::vector<Slot> m_slots;
+		std::vector<size_t> m_freeSlots;
+		boost::unordered_map<std::string, FlightPtr_t> m_flights;
+		// Entries in order they expire, which is the order of insertion
+		// since all of them live equally long. Those evicted meanwhile
+		// are skipped as they come to the front.
+		std::deque<Expiry_t> m_expiries;
+		size_t m_hand;
+		size_t m_cost;
+
+		Shard() : m_hand(0), m_cost(0) {}
+	};
+
+	// Rough per-entry overhead of index node and slot.
+	static const size_t ENTRY_OVERHEAD = sizeof(Slot) + sizeof(Index_t::value_type) + sizeof(Expiry_t) + 4 * sizeof(void*);
+
+	Shard& GetShard(const std::string& request);
+	bool Lookup(Shard& shard, const std::string& request, Clock_t::time_point now, std::string& response);
+	void Insert(Shard& shard, const std::string& request, const std::string& response, Clock_t::time_point now);
+	void EvictExpired(Shard& shard, Clock_t::time_point now);
+	void EvictNext(Shard& shard, Clock_t::time_point now);
+	void Evict(Shard& shard, size_t slot);
+
+private:
+	size_t m_shardCapacity;
+	Clock_t::duration m_ttl;
+	std::vector<boost::shared_ptr<Shard>> m_shards;
+};
+
+#endif // __RESPONSE_CACHE_H__
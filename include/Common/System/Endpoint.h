@@ -2,6 +2,10 @@
 #define __ENDPOINT_H__
 
 #include "CommonDefinitions.h"
+#include "Framing.h"
+#include "BufferPool.h"
+#include "System/TimerWheel.h"
+#include "Metrics.h"
 
 #if defined(_WIN64)
 
@@ -31,6 +35,8 @@ struct IAcceptor : IEndpoint
 	virtual ~IAcceptor() = default;
 
 	virtual bool AcceptAsync(IConnection* connection) = 0;
+	// Take next waiting peer only to send it reply and close.
+	virtual bool RejectAsync(boost::string_view reply) = 0;
 	virtual std::string GetPeerInfo() = 0;
 };
 template <typename Impl, typename Interface = IEndpoint>
@@ -70,6 +76,9 @@ public:
 		return true;
 	}
 
+	// Peers aren't turned away here, they wait for the accept posted.
+	bool RejectAsync(boost::string_view) override { return false; }
+
 	std::string GetPeerInfo() override
 	{
 		return m_impl.GetPeerInfo();
@@ -251,7 +260,17 @@ struct IEndpoint
 	virtual ~IEndpoint() = default;
 
 	virtual int Get() = 0;
+	// Returns true if input is left for another turn, see IoBudget.
 	virtual bool Complete() = 0;
+
+	// Slot taken in IO manager registry while endpoint is bound to it.
+	virtual uint32_t GetSlot() = 0;
+	virtual void SetSlot(uint32_t slot) = 0;
+	// Timer state, null for endpoints never timed out.
+	virtual TimerNode* GetTimer() = 0;
+	// Events of endpoints of higher classes are handled first.
+	virtual uint8_t GetServiceClass() = 0;
+	virtual void SetServiceClass(uint8_t serviceClass) = 0;
 };
 
 struct IConnection : IEndpoint
@@ -259,10 +278,27 @@ struct IConnection : IEndpoint
 	virtual ~IConnection() = default;
 
 	virtual void Set(int fd) = 0;
-	virtual size_t ReadAsync() = 0;
-	virtual size_t WriteAsync(const std::string& data) = 0;
+	// Bytes read, zero if the peer has closed the connection,
+	// negative if there's nothing to read this turn.
+	virtual ssize_t ReadAsync() = 0;
+	virtual size_t WriteAsync(boost::string_view data) = 0;
 	virtual std::string GetInputData() = 0;
 	virtual void Disconnect() = 0;
+	// Close once output backlogged is written. Input isn't read meanwhile,
+	// the next read reports the connection closed. Returns false if there's
+	// no backlog, the connection is to be disconnected right away.
+	virtual bool Linger() = 0;
+
+	// Unconsumed input for protocols parsing it in place, decoded one
+	// when framing is on. Consumed part is dropped, the rest is kept
+	// for the next read. Framed input is kept undecoded till its frame
+	// comes whole, decoded input left unconsumed is dropped by the next read.
+	virtual boost::string_view GetInputView() = 0;
+	virtual void Consume(size_t size) = 0;
+	// No room left for the next read, unconsumed input occupies whole buffer.
+	virtual bool IsInputFull() = 0;
+	// Part of input is left unconsumed, e.g. a request hasn't come in whole.
+	virtual bool HasPendingInput() = 0;
 };
 
 struct IAcceptor : IEndpoint
@@ -270,7 +306,12 @@ struct IAcceptor : IEndpoint
 	virtual ~IAcceptor() = default;
 
 	virtual bool AcceptAsync(IConnection* connection) = 0;
+	// Take next waiting peer only to send it reply and close.
+	// Returns false if there's nobody waiting.
+	virtual bool RejectAsync(boost::string_view reply) = 0;
 	virtual std::string GetPeerInfo() = 0;
+	// Address of the peer accepted last.
+	virtual const sockaddr_in6& GetPeerAddress() = 0;
 };
 
 template <typename Impl, typename Interface = IEndpoint>
@@ -285,6 +326,11 @@ public:
 	virtual ~EndpointBase() = default;
 
 	int Get() override { return m_impl.Get(); }
+	uint32_t GetSlot() override { return m_impl.GetSlot(); }
+	void SetSlot(uint32_t slot) override { m_impl.SetSlot(slot); }
+	TimerNode* GetTimer() override { return m_impl.GetTimer(); }
+	uint8_t GetServiceClass() override { return m_impl.GetServiceClass(); }
+	void SetServiceClass(uint8_t serviceClass) override { m_impl.SetServiceClass(serviceClass); }
 
 protected:
 	Impl m_impl;
@@ -303,7 +349,9 @@ public:
 	virtual ~AcceptorBase() = default;
 
 	bool AcceptAsync(IConnection* connection) override { return this->m_impl.Accept(connection); }
+	bool RejectAsync(boost::string_view reply) override { return this->m_impl.Reject(reply); }
 	std::string GetPeerInfo() override { return this->m_impl.GetPeerInfo(); }
+	const sockaddr_in6& GetPeerAddress() override { return this->m_impl.GetPeerAddress(); }
 };
 
 template <typename Impl>
@@ -319,32 +367,33 @@ public:
 	virtual ~ConnectionBase() = default;
 
 	void Set(int fd) override { this->m_impl.Set(fd); }
-	size_t ReadAsync() override { return this->m_impl.Read(); }
-	size_t WriteAsync(const std::string& data) override { return this->m_impl.Write(data); }
+	ssize_t ReadAsync() override { return this->m_impl.Read(this); }
+	size_t WriteAsync(boost::string_view data) override { return this->m_impl.Write(this, data); }
 	std::string GetInputData() override { return this->m_impl.GetInputData(); }
+	boost::string_view GetInputView() override { return this->m_impl.GetInputView(); }
+	void Consume(size_t size) override { this->m_impl.Consume(size); }
+	bool IsInputFull() override { return this->m_impl.IsInputFull(); }
+	bool HasPendingInput() override { return this->m_impl.HasPendingInput(); }
+	bool Linger() override { return this->m_impl.Linger(); }
 };
 
 using StartAsyncIoCallback_t = boost::function<void (IEndpoint*)>;
 using StopAsyncIoCallback_t = boost::function<void (IEndpoint*)>;
+using ServiceClassCallback_t = boost::function<void (IEndpoint*, uint8_t)>;
 
 template <typename Derived>
 class EndpointImplBase
 {
 protected:
-	static const size_t MAX_BUF_SIZE = 1024;
 	int m_endpoint;
-	StartAsyncIoCallback_t m_startAsyncIoCallback;
-	StopAsyncIoCallback_t m_stopAsyncIoCallback;
+	uint32_t m_slot;
 
 	CRTP_SELF(Derived)
 
 public:
-	EndpointImplBase(
-		StartAsyncIoCallback_t&& startAsyncIoCallback,
-		StopAsyncIoCallback_t&& stopAsyncIoCallback)
+	EndpointImplBase()
 	: m_endpoint(0)
-	, m_startAsyncIoCallback(startAsyncIoCallback)
-	, m_stopAsyncIoCallback(stopAsyncIoCallback)
+	, m_slot(0)
 	{}
 
 	~EndpointImplBase()
@@ -357,6 +406,12 @@ public:
 		return m_endpoint;
 	}
 
+	uint32_t GetSlot() const { return m_slot; }
+	void SetSlot(uint32_t slot) { m_slot = slot; }
+	TimerNode* GetTimer() { return nullptr; }
+	uint8_t GetServiceClass() const { return 0; }
+	void SetServiceClass(uint8_t) {}
+
 	bool Complete(IConnection* connection)
 	{
 		return Self().Complete(connection);
@@ -381,14 +436,22 @@ class AcceptorImpl final : public EndpointImplBase<AcceptorImpl>
     addrinfo* m_addrInfo;
 	sockaddr_in6 m_peerAddr;
 	AcceptCallback_t m_acceptCallback;
+	StartAsyncIoCallback_t m_startAsyncIoCallback;
+	StopAsyncIoCallback_t m_stopAsyncIoCallback;
 	IConnection* m_newConnection;
+	// Accepting is resumed as it expires.
+	TimerNode m_timer;
+	// Peers of control acceptor, e.g. admin one, are left out of metrics
+	// and aren't shed along with data traffic.
+	bool m_control;
 
 	using Base_t = EndpointImplBase<AcceptorImpl>;
 
 public:
     AcceptorImpl(uint16_t port, AcceptCallback_t&& acceptCallback,
 		StartAsyncIoCallback_t&& startAsyncIoCallback,
-		StopAsyncIoCallback_t&& stopAsyncIoCallback);
+		StopAsyncIoCallback_t&& stopAsyncIoCallback,
+		bool control);
     ~AcceptorImpl();
 
 	void StartAsyncIo(IEndpoint* endpoint);
@@ -397,22 +460,44 @@ public:
     bool Complete();
 
 	bool Accept(IConnection* connection);
+	bool Reject(boost::string_view reply);
 	std::string GetPeerInfo();
+	const sockaddr_in6& GetPeerAddress() const { return m_peerAddr; }
+
+	TimerNode* GetTimer() { return &m_timer; }
 };
 
+// Callbacks are the same for all connections of a server,
+// so connections share them instead of keeping own copies.
+struct ConnectionCallbacks
+{
+	OperationCallback_t m_dataExchange;
+	StopAsyncIoCallback_t m_stopAsyncIo;
+	// Connection leaves its input unread for a while.
+	StopAsyncIoCallback_t m_deferInput;
+	// Peer has asked for a service class in handshake.
+	ServiceClassCallback_t m_setServiceClass;
+	// Output backlog of connection has appeared or is gone, so whether
+	// it waits for the socket to take more output has changed.
+	StopAsyncIoCallback_t m_watchOutput;
+};
+
+using ConnectionCallbacksPtr_t = boost::shared_ptr<const ConnectionCallbacks>;
+
+// State of connection is kept small so that millions of idle ones are cheap.
+// Read buffer is borrowed from the pool as a turn of the connection reads
+// and given back when the turn ends, unless unconsumed input is left to keep.
+// Its size follows the average message size.
+// Input isn't read while output is backlogged, peer reading nothing gets
+// no more responses.
 class ConnectionImpl final :  public EndpointImplBase<ConnectionImpl>
 {
 	using Base_t = EndpointImplBase<ConnectionImpl>;
 
 public:
-	using Buffer_t = boost::array<char, MAX_BUF_SIZE>;
-
-	ConnectionImpl(
-		OperationCallback_t&& dataExchangeCallback,
-		StartAsyncIoCallback_t&& startAsyncIoCallback,
-		StopAsyncIoCallback_t&& stopAsyncIoCallback);
-
-	~ConnectionImpl() = default;
+	// Callbacks are owned by the server and outlive its connections.
+	ConnectionImpl(const FramingPolicy& framing, const ConnectionCallbacks* callbacks);
+	~ConnectionImpl();
 
 	void StartAsyncIo(IEndpoint*) {}
 	void StopAsyncIo(IEndpoint* endpoint);
@@ -420,20 +505,51 @@ public:
 	bool Complete(IConnection* connection);
 
 	void Set(int fd);
-	size_t Read();
-	size_t Write(const std::string& data);
+	ssize_t Read(IEndpoint* endpoint);
+	size_t Write(IEndpoint* endpoint, boost::string_view data);
 	std::string GetInputData();
+	boost::string_view GetInputView();
+	void Consume(size_t size);
+	bool Linger();
 	void Reset();
 
+	bool IsInputFull() const { return m_pending == BufferPool::MAX_SIZE; }
+	bool HasPendingInput() const { return m_pending != 0; }
+	TimerNode* GetTimer() { return &m_timer; }
+	// Read by threads sorting events, while another one may be handling the connection.
+	uint8_t GetServiceClass() const { return m_serviceClass.load(boost::memory_order_relaxed); }
+	void SetServiceClass(uint8_t serviceClass) { m_serviceClass.store(serviceClass, boost::memory_order_relaxed); }
+
 private:
-	void SetDataExchangeMode(bool dxm) { m_dataExchange = dxm; }
-	bool IsInitialState() const { return !m_dataExchange; }
+	// Connection exchanges data as long as it's given a descriptor.
+	bool IsInitialState() const { return !m_endpoint; }
+	// Whatever socket doesn't take at once is kept in output backlog,
+	// later output goes after it.
+	size_t WriteRaw(IEndpoint* endpoint, const char* data, size_t dataSize);
+
+	// Returns false if buffer should grow but memory is short.
+	bool BorrowBuffer();
+	void ReleaseBuffer();
+	// Drop consumed part of the buffer, the rest is moved to its beginning.
+	void DropInput(size_t size);
+
+	static const uint8_t DEFAULT_SIZE_CLASS = 1;
 
 private:
-	bool m_dataExchange;
-	OperationCallback_t m_dataExchangeCallback;
-	Buffer_t m_readBuf;
-	Buffer_t m_writeBuf;
+	boost::atomic<uint8_t> m_serviceClass;
+	// Size class of the buffer being borrowed, or the one to borrow next time.
+	uint8_t m_sizeClass;
+	// Moving average of bytes read at once.
+	uint16_t m_averageRead;
+	// Valid bytes in read buffer, including those kept from previous reads.
+	uint16_t m_bytesRead;
+	// Bytes left unconsumed by the previous read.
+	uint16_t m_pending;
+	// Idle and request timeouts.
+	TimerNode m_timer;
+	char* m_buffer;
+	const ConnectionCallbacks* m_callbacks;
+	FrameFilter m_framing;
 };
 
 class Acceptor final : public AcceptorBase<AcceptorImpl>
@@ -442,10 +558,11 @@ class Acceptor final : public AcceptorBase<AcceptorImpl>
 public:
 	Acceptor(unsigned short port, AcceptCallback_t&& acceptCallback,
 		StartAsyncIoCallback_t&& startAsyncIoCallback,
-		StopAsyncIoCallback_t&& stopAsyncIoCallback)
+		StopAsyncIoCallback_t&& stopAsyncIoCallback,
+		bool control = false)
 	: Base_t(port, std::forward<AcceptCallback_t>(acceptCallback),
 		std::forward<StartAsyncIoCallback_t>(startAsyncIoCallback),
-		std::forward<StopAsyncIoCallback_t>(stopAsyncIoCallback)) 
+		std::forward<StopAsyncIoCallback_t>(stopAsyncIoCallback), control) 
 	{}
 
 	virtual ~Acceptor() { m_impl.StopAsyncIo(this); }
@@ -463,14 +580,8 @@ class Connection final : public ConnectionBase<ConnectionImpl>
 {
 	using Base_t = ConnectionBase<ConnectionImpl>;
 public:
-	Connection(
-		OperationCallback_t&& dataExchangeCallback,
-		StartAsyncIoCallback_t&& startAsyncIoCallback,
-		StopAsyncIoCallback_t&& stopAsyncIoCallback)
-	: Base_t(
-		std::forward<OperationCallback_t>(dataExchangeCallback),
-		std::forward<StartAsyncIoCallback_t>(startAsyncIoCallback),
-		std::forward<StopAsyncIoCallback_t>(stopAsyncIoCallback)) {}
+	Connection(const FramingPolicy& framing, const ConnectionCallbacks* callbacks)
+	: Base_t(framing, callbacks) {}
 
 	virtual ~Connection() { Disconnect(); }
 
@@ -480,6 +591,11 @@ public:
 		m_impl.StopAsyncIo(this);
 		m_impl.Reset();
 	}
+
+	// Each connection takes a single cache line of its own.
+	static void* operator new(size_t size);
+	static void* operator new(size_t size, const std::nothrow_t&) noexcept;
+	static void operator delete(void* p, size_t size) noexcept;
 };
 
 
@@ -585,14 +701,21 @@ protected:
 	Container m_availConnections;
 	// A function object from outside creating new entries.
 	Creator m_creator;
+	boost::atomic<size_t> m_activeCount;
 
 public:
-	ConnectionManager(Creator&& creator)
+	ConnectionManager(Creator&& creator, size_t count = DEFAULT_CONNECTION_COUNT)
 	: m_creator(std::forward<Creator>(creator))
+	, m_activeCount(0)
 	{
 		// Allocate some number of connections beforehand to be available.
-		for(size_t i = 0; i < DEFAULT_CONNECTION_COUNT; ++i)
-			m_availConnections.Add(m_creator());
+		for(size_t i = 0; i < count; ++i)
+		{
+			IConnection* e = m_creator();
+			if (!e) throw std::bad_alloc();
+			m_availConnections.Add(e);
+		}
+		Metrics::Get().m_idleConnections.Add(count);
 	}
 
 	IConnection* Get()
@@ -603,17 +726,21 @@ public:
 		// Is there something in the list of available connections?
 		if (m_availConnections.IsEmpty())
 		{
-			// Create new entry.
+			// Create new entry, there might be no memory for it.
 			e = m_creator();
+			if (!e) return nullptr;
 		}
 		else
 		{
 			// Obtain the foremost entry.
 			e = m_availConnections.Release();	
+			Metrics::Get().m_idleConnections.Sub(1);
 		}
 
 		// Put entry in the list of active entries and return it.
 		m_activeConnections.Add(e);
+		m_activeCount.fetch_add(1, boost::memory_order_relaxed);
+		Metrics::Get().m_activeConnections.Add(1);
 		return e;
 	}
 
@@ -623,10 +750,16 @@ public:
 
 		// Remove entry from the active list.
 		m_activeConnections.Remove(e);
+		m_activeCount.fetch_sub(1, boost::memory_order_relaxed);
+		Metrics::Get().m_activeConnections.Sub(1);
 
 		// Put it into the list of available entries.
 		m_availConnections.Add(e);
+		Metrics::Get().m_idleConnections.Add(1);
 	}
+
+	// Connections in use, read without locking.
+	size_t GetActiveCount() const { return m_activeCount.load(boost::memory_order_relaxed); }
 };
 
 #endif // __ENDPOINT_H__
@@ -0,0 +1,26 @@
+#if !defined(__IO_BUDGET_H__)
+#define __IO_BUDGET_H__
+
+#include "CommonDefinitions.h"
+
+// Bytes an endpoint may read and write in a single turn, so that one
+// with a firehose peer doesn't keep its thread from the others. Endpoint
+// refused to read stops as if its input were drained, and is given
+// another turn after other ready endpoints. A turn is taken by a single
+// thread, so the budget left is kept per thread.
+class IoBudget final
+{
+public:
+	// Zero means unlimited.
+	static void SetLimit(size_t limit);
+
+	// Turn of an endpoint begins.
+	static void Renew();
+	static void Charge(size_t bytes);
+	// Returns false if the turn is over, that's remembered till the next one.
+	static bool Allows();
+	// Endpoint has been refused during its turn.
+	static bool IsExhausted();
+};
+
+#endif // __IO_BUDGET_H__
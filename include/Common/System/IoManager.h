@@ -3,6 +3,9 @@
 
 #include "CommonDefinitions.h"
 #include "System/Endpoint.h"
+#include "System/SlotMap.h"
+#include "System/TimerWheel.h"
+#include "Metrics.h"
 
 #if defined(_WIN64)
 
@@ -30,22 +33,54 @@ private:
 
 #elif defined(__linux__)
 
+// Returns timeout to arm expired endpoint again, zero to leave it be.
+using TimerCallback_t = boost::function<size_t (IEndpoint*)>;
+
 class IoManager final
 {
 	// Exiting eventfd wrapped into endpoint.
 	class Exiter : public IEndpoint
 	{
 		int m_fd;
+		uint32_t m_slot;
 	public:
 		Exiter();
 		virtual ~Exiter() { close(m_fd); }
 
 		int Get() override { return m_fd; }
 		bool Complete() override { Signal(); return false; }
+		uint32_t GetSlot() override { return m_slot; }
+		void SetSlot(uint32_t slot) override { m_slot = slot; }
+		TimerNode* GetTimer() override { return nullptr; }
+		uint8_t GetServiceClass() override { return 0; }
+		void SetServiceClass(uint8_t) override {}
 
 		void Signal(bool first = false);
 	};
 
+	// Timer descriptor turning the timing wheel, wrapped into endpoint.
+	// It ticks only while there are timers filed.
+	class Ticker : public IEndpoint
+	{
+		int m_fd;
+		uint32_t m_slot;
+		IoManager& m_manager;
+	public:
+		Ticker(IoManager& manager);
+		virtual ~Ticker() { close(m_fd); }
+
+		int Get() override { return m_fd; }
+		bool Complete() override;
+		uint32_t GetSlot() override { return m_slot; }
+		void SetSlot(uint32_t slot) override { m_slot = slot; }
+		TimerNode* GetTimer() override { return nullptr; }
+		uint8_t GetServiceClass() override { return 0; }
+		void SetServiceClass(uint8_t) override {}
+
+		void Start();
+		void Stop();
+	};
+
 	// Use this wrapper class to facilitate adding/removing epoll events. 
 	class EventWrapper
 	{
@@ -53,29 +88,166 @@ class IoManager final
 	public:
 		EventWrapper() : m_fd(0) {}
 		void Set(int fd) { m_fd = fd; }
-		void DoOp(int opcode, uint32_t events, IEndpoint* endpoint);
+		void DoOp(int opcode, uint32_t events, int fd, uint64_t data = 0);
+	};
+	// Counters of a thread running the loop, exported along with the rest.
+	struct LoopStats
+	{
+		Counter m_wakeups;
+		Counter m_events;
+		// Time spent handling events and waiting for them, in microseconds.
+		Counter m_busyTime;
+		Counter m_waitTime;
+		Counter m_stalls;
+		// Watched by the stall watchdog: since when the thread has been
+		// handling events, zero while it waits, and descriptor of endpoint
+		// taking its turn.
+		boost::atomic<uint64_t> m_busySince;
+		boost::atomic<int> m_fd;
+		pthread_t m_thread;
+		// Start of the turn reported last, each stall is reported once.
+		uint64_t m_reported;
+
+		LoopStats() : m_busySince(0), m_fd(-1), m_thread(pthread_self()), m_reported(0) {}
 	};
 public:
-	// Create new epoll.
-	IoManager(size_t threadCount);
+	// Create new epoll. Metrics of the manager are labelled by its name.
+	IoManager(size_t threadCount, const std::string& name = "data");
 	~IoManager();
 
 	// Bind endpoint to an epoll.
 	void Bind(IEndpoint* endpoint);
 	// Unbind endpoint from an epoll.
 	void Unbind(IEndpoint* endpoint);
+	// Unbind endpoint about to be closed, saving a call to epoll.
+	void Forget(IEndpoint* endpoint);
 	// Post exit signal to finish up thread routines.
 	void Stop();
 
+	// Endpoint timers, timeouts are in milliseconds rounded up to ticks.
+	// Expired endpoint is given to the callback, which may return a timeout
+	// to arm it again, e.g. for periodic pings. Callback is called with
+	// timers locked, so it mustn't unbind endpoints or touch timers itself.
+	void SetTimerCallback(TimerCallback_t&& callback) { m_timerCallback = std::forward<TimerCallback_t>(callback); }
+	// Expire after timeout, whatever has been armed before.
+	void ArmTimer(IEndpoint* endpoint, size_t timeout);
+	// Expire after timeout unless armed to expire earlier.
+	void CapTimer(IEndpoint* endpoint, size_t timeout);
+	void CancelTimer(IEndpoint* endpoint);
+
+	// Coarse clock in ticks, read once per loop iteration.
+	static uint32_t GetTick();
+
+	// Endpoint isn't going to read its input for a while. Edge triggered
+	// epoll won't notify it again until new data comes, hence it's kept
+	// to be rearmed once reading is allowed again.
+	void Defer(IEndpoint* endpoint);
+	// Rearm deferred endpoints, those having input get an event again.
+	void ResumeDeferred();
+	// Stop watching input of endpoint, e.g. while its peer is over a rate limit.
+	// Input coming meanwhile is reported as endpoint is rearmed.
+	void PauseInput(IEndpoint* endpoint);
+	// Make epoll check readiness of endpoint again as if it were just bound.
+	// Output is watched along with input while endpoint has output backlog.
+	void Rearm(IEndpoint* endpoint);
+
+	// Endpoints of the top service class get a lane of their own: separate
+	// epoll polled by dedicated threads which never sleep, so that they're
+	// neither woken late nor queued behind other endpoints' events.
+	// Has to be enabled before endpoints of the class appear.
+	void EnableLane();
+	// Busy poll the lane until IO manager stops.
+	void RunLane();
+	void StopLane() { m_laneRunning.store(false, boost::memory_order_relaxed); }
+	// Change class of endpoint, it moves to or from the lane if needed.
+	void SetServiceClass(IEndpoint* endpoint, uint8_t serviceClass);
+
+	// Time since events have been taken till endpoint has been handled,
+	// in microseconds, per service class.
+	const LatencyStats& GetLatency(uint8_t serviceClass) const { return m_latency[serviceClass]; }
+
+	// Load of event loops smoothed over recent wakeups: time spent
+	// handling events of a wakeup, in microseconds, and number of them.
+	size_t GetLag() const { return m_lag.load(boost::memory_order_relaxed) / LOAD_SMOOTHING; }
+	size_t GetQueueDepth() const { return m_queueDepth.load(boost::memory_order_relaxed) / LOAD_SMOOTHING; }
+
+	// Turns endpoints have ended with input left over their IO budget,
+	// and turns given to such endpoints later.
+	size_t GetExhaustedCount() const { return m_exhausted.Get(); }
+	size_t GetRevisitCount() const { return m_revisits.Get(); }
+
 	// Data coming to particular endpoint post-processed here.
 	void Run();
 
+	// Watch loop threads from a thread of its own. Thread which hasn't got
+	// back to waiting for events within threshold, in milliseconds, is
+	// reported along with endpoint it's handling and its stack.
+	void StartWatchdog(size_t threshold);
+
+	// Walk all endpoints currently bound.
+	template <typename Visitor>
+	void ForEach(Visitor&& visitor) const { m_endpoints.ForEach(std::forward<Visitor>(visitor)); }
+
+private:
+	bool IsInLane(IEndpoint* endpoint) { return m_laneFd >= 0 && endpoint->GetServiceClass() == TOP_SERVICE_CLASS; }
+	EventWrapper& GetEvents(IEndpoint* endpoint) { return IsInLane(endpoint) ? m_laneEwr : m_ewr; }
+	static uint32_t GetInterest(IEndpoint* endpoint);
+	// Handle events taken at once, higher classes first.
+	// Returns false if exit signal is among them.
+	bool Dispatch(const epoll_event* events, size_t readyCount, uint64_t start, LoopStats& loop);
+	// Give acquired endpoint its turns. Returns true if input is left over,
+	// the endpoint is then queued to the thread for another turn.
+	bool Handle(SlotMap<IEndpoint>::Handle_t handle, IEndpoint* endpoint);
+	// Another turn to each endpoint queued, before the thread waits again.
+	void Revisit(LoopStats& loop);
+	// Wakeup has been handled, end is the time it's over.
+	void Account(LoopStats& loop, size_t readyCount, uint64_t start, uint64_t end);
+
+	void SetDeadline(IEndpoint* endpoint, uint32_t deadline);
+	void OnTick();
+	void Expire(SlotMap<IEndpoint>::Handle_t handle, uint32_t due, uint32_t tick);
+	void UpdateLoad(size_t readyCount, size_t busyTime);
+	// Stats of the calling thread, registered as it starts running the loop.
+	LoopStats& AddLoop(const char* role);
+	void Watch(size_t threshold);
+	void StopWatchdog();
+
 private:
 	static const size_t MAX_ENDPOINTS = 0xffff;
+	// Load averages keep sums of this many recent samples.
+	static const size_t LOAD_SMOOTHING = 8;
+	std::string m_name;
 	boost::atomic<size_t> m_threadCount;
+	boost::atomic<size_t> m_lag;
+	boost::atomic<size_t> m_queueDepth;
+	Counter m_exhausted;
+	Counter m_revisits;
 	int m_fd;
+	// Epoll user data is a handle in this registry rather than a pointer,
+	// so that events queued for an endpoint already unbound are dropped.
+	SlotMap<IEndpoint> m_endpoints;
+	boost::mutex m_deferredLock;
+	std::vector<SlotMap<IEndpoint>::Handle_t> m_deferred;
 	Exiter m_exiter;
 	EventWrapper m_ewr;
+	int m_laneFd;
+	EventWrapper m_laneEwr;
+	boost::atomic<bool> m_laneRunning;
+	std::array<LatencyStats, SERVICE_CLASS_COUNT> m_latency;
+	// Per wakeup: time waited for events, time spent handling them and
+	// their number. Time of a single endpoint's turn, per event.
+	LatencyStats m_waitTime;
+	LatencyStats m_busyTime;
+	LatencyStats m_batchSize;
+	LatencyStats m_handlerTime;
+	// Timers of all endpoints, whichever thread is woken by ticker turns the wheel.
+	boost::mutex m_timerLock;
+	TimerWheel m_timers;
+	TimerCallback_t m_timerCallback;
+	Ticker m_ticker;
+	boost::mutex m_loopsLock;
+	std::deque<LoopStats> m_loops;
+	boost::thread m_watchdog;
 };
 
 #endif // _WIN64
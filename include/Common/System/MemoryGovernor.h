@@ -0,0 +1,66 @@
+#if !defined(__MEMORY_GOVERNOR_H__)
+#define __MEMORY_GOVERNOR_H__
+
+#include "CommonDefinitions.h"
+
+struct MemoryBudgetPolicy
+{
+	// Memory accounted for connections and buffers, unlimited if zero.
+	size_t m_budget;
+	// Whether load is shed on memory pressure reported by the kernel too.
+	bool m_pressure;
+	// Interval of budget and pressure sampling, in milliseconds.
+	size_t m_interval;
+
+	MemoryBudgetPolicy(size_t budget = 0, bool pressure = false, size_t interval = 100)
+	: m_budget(budget)
+	, m_pressure(pressure)
+	, m_interval(interval)
+	{}
+
+	bool IsEnabled() const { return m_budget || m_pressure; }
+};
+
+// Global accountant of memory taken by connections and IO buffers.
+// A background thread compares it with the budget and, if asked to and
+// kernel provides it, reads memory pressure stall information. The thread
+// runs only if there's a budget or pressure to watch. Load is shed
+// in stages as pressure rises: first buffer pools are shrunk, then
+// connections asking for larger buffers stop reading until relief,
+// finally new peers are refused right after accept.
+class MemoryGovernor final
+{
+public:
+	enum Category
+	{
+		connections,
+		buffers,
+		categoryCount
+	};
+
+	enum Stage
+	{
+		normal,
+		shrink,
+		throttle,
+		shed
+	};
+
+	using StageCallback_t = boost::function<void (Stage)>;
+
+	// Start sampling unless policy has nothing to watch, callback is
+	// called from sampling thread on every stage change.
+	static void Start(const MemoryBudgetPolicy& policy, StageCallback_t&& callback);
+	static void Stop();
+
+	static void Charge(Category category, size_t size);
+	static void Discharge(Category category, size_t size);
+	static size_t GetUsage(Category category);
+
+	static Stage GetStage();
+	// Allocation failed regardless of accounting, shed load until next
+	// sample. Without sampling only the allocation failed is given up.
+	static void OnAllocationFailure();
+};
+
+#endif // __MEMORY_GOVERNOR_H__
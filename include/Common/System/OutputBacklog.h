@@ -0,0 +1,35 @@
+#if !defined(__OUTPUT_BACKLOG_H__)
+#define __OUTPUT_BACKLOG_H__
+
+#include "CommonDefinitions.h"
+
+// Output a socket hasn't taken at once, kept per descriptor since
+// connection state has no room for it. Backlog of a descriptor is changed
+// only by the thread handling its connection, others may only look at it.
+class OutputBacklog final
+{
+public:
+	// Make room for descriptors below the limit of open files. Without it
+	// nothing can be kept and writing to a full socket fails.
+	static void Init();
+
+	static bool IsEmpty(int fd);
+	// Returns false if there's no room for the descriptor.
+	static bool Keep(int fd, const char* data, size_t size);
+	// Write as much of backlog as the socket takes. Returns true if it's
+	// gone, either written whole or dropped as the peer is gone.
+	static bool Flush(int fd);
+	static void Drop(int fd);
+
+	// Descriptor is closed once its backlog is written, its input isn't
+	// read meanwhile. Mark outlives the backlog until it's forgotten.
+	static void Linger(int fd);
+	static bool IsLingering(int fd);
+	// Whether the peer has taken any of the backlog since asked last,
+	// so lingering descriptor is given more time. Any thread may ask.
+	static bool HasProgressed(int fd);
+	// Drop backlog and mark of descriptor about to be closed.
+	static void Forget(int fd);
+};
+
+#endif // __OUTPUT_BACKLOG_H__
@@ -0,0 +1,53 @@
+#if !defined(__POOL_MEMORY_H__)
+#define __POOL_MEMORY_H__
+
+#include "CommonDefinitions.h"
+
+struct PoolMemoryPolicy
+{
+	// Region size backing the pools, pools use ordinary heap if zero.
+	size_t m_size;
+	// Back the region with 2 MB pages.
+	bool m_hugePages;
+	// Keep the region resident.
+	bool m_lock;
+	// Connections created at startup out of the region.
+	size_t m_connections;
+
+	PoolMemoryPolicy(size_t size = 0, bool hugePages = false, bool lock = false, size_t connections = 1)
+	: m_size(size)
+	, m_hugePages(hugePages)
+	, m_lock(lock)
+	, m_connections(connections)
+	{}
+};
+
+// A single region reserved at startup which connection and buffer pools
+// are carved from. The region is prefaulted so that connection surges
+// don't stall on page faults, and with huge pages the pools take a few
+// TLB entries instead of thousands. Explicitly reserved huge pages are
+// tried first, then transparent ones, then ordinary pages. Pieces are
+// never given back, pools keep them in their free lists.
+class PoolMemory final
+{
+public:
+	enum Backing
+	{
+		none,
+		smallPages,
+		transparentHugePages,
+		hugePages
+	};
+
+	static void Init(const PoolMemoryPolicy& policy);
+
+	// Piece of the region, or null if there's no region or it's exhausted.
+	static void* Allocate(size_t size, size_t alignment = CACHE_LINE_SIZE);
+	static bool Owns(const void* p);
+
+	static Backing GetBacking();
+	static const char* GetBackingName();
+	static bool IsLocked();
+};
+
+#endif // __POOL_MEMORY_H__
@@ -0,0 +1,28 @@
+#if !defined(__PROBES_H__)
+#define __PROBES_H__
+
+// Static tracepoints of provider tcp6, listed with e.g.
+// bpftrace -l 'usdt:./Server:tcp6:*' or readelf -n Server. A probe is a
+// single nop until a tracer attaches, its arguments are values at hand.
+// Probes are compiled in where sys/sdt.h is installed (systemtap-sdt-dev),
+// unless NO_PROBES is defined.
+#if defined(__linux__) && !defined(NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define PROBES_ENABLED
+#endif
+#endif
+
+#if defined(PROBES_ENABLED)
+#define PROBE1(name, a) DTRACE_PROBE1(tcp6, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(tcp6, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(tcp6, name, a, b, c)
+#define PROBE4(name, a, b, c, d) DTRACE_PROBE4(tcp6, name, a, b, c, d)
+#else
+#define PROBE1(name, a) do {} while (0)
+#define PROBE2(name, a, b) do {} while (0)
+#define PROBE3(name, a, b, c) do {} while (0)
+#define PROBE4(name, a, b, c, d) do {} while (0)
+#endif // PROBES_ENABLED
+
+#endif // __PROBES_H__
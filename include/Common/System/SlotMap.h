@@ -0,0 +1,197 @@
+#if !defined(__SLOT_MAP_H__)
+#define __SLOT_MAP_H__
+
+#include "CommonDefinitions.h"
+
+// Registry of objects addressed by handles instead of raw pointers.
+// Handle packs 32-bit slot index with 32-bit generation of the slot,
+// generation changes each time the slot is taken or freed. Thereby
+// a handle kept somewhere after removal, e.g. in epoll user data,
+// is told stale in O(1) even if the object itself has been reused.
+// Lookup and iteration are lock free, slots live in chunks which
+// are never moved or freed while the map exists. Object can also be
+// taken for exclusive handling, events coming meanwhile are counted
+// and make the thread handling it run once more instead.
+template <typename T>
+class SlotMap final
+{
+	static const size_t CHUNK_SIZE = 4096;
+	static const size_t MAX_CHUNKS = 1024;
+
+	struct Slot
+	{
+		// Generation in the upper half, odd one means the slot is taken.
+		// Lower half counts handlers wanting the object at the moment.
+		boost::atomic<uint64_t> m_state;
+		boost::atomic<T*> m_value;
+
+		Slot() : m_state(0), m_value(nullptr) {}
+
+		uint32_t GetGeneration() const { return static_cast<uint32_t>(m_state.load(boost::memory_order_acquire) >> 32); }
+	};
+
+	static uint64_t ToState(uint32_t generation) { return static_cast<uint64_t>(generation) << 32; }
+
+public:
+	using Handle_t = uint64_t;
+
+	static const size_t MAX_SIZE = CHUNK_SIZE * MAX_CHUNKS;
+
+	SlotMap() : m_size(0)
+	{
+		for (auto& chunk : m_chunks) chunk.store(nullptr, boost::memory_order_relaxed);
+	}
+
+	~SlotMap()
+	{
+		for (auto& chunk : m_chunks) delete[] chunk.load(boost::memory_order_relaxed);
+	}
+
+	SlotMap(const SlotMap&) = delete;
+	SlotMap& operator= (const SlotMap&) = delete;
+
+	static uint32_t GetSlot(Handle_t handle) { return static_cast<uint32_t>(handle); }
+	static uint32_t GetGeneration(Handle_t handle) { return static_cast<uint32_t>(handle >> 32); }
+
+	Handle_t Insert(T* value)
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+
+		uint32_t index = 0;
+		if (m_free.empty())
+		{
+			size_t size = m_size.load(boost::memory_order_relaxed);
+			if (size == MAX_SIZE) throw std::length_error("Slot map is full");
+
+			if (!(size % CHUNK_SIZE))
+				m_chunks[size / CHUNK_SIZE].store(new Slot[CHUNK_SIZE], boost::memory_order_release);
+
+			index = static_cast<uint32_t>(size);
+			m_size.store(size + 1, boost::memory_order_release);
+		}
+		else
+		{
+			index = m_free.back();
+			m_free.pop_back();
+		}
+
+		Slot& slot = GetSlotRef(index);
+		slot.m_value.store(value, boost::memory_order_relaxed);
+		uint32_t generation = slot.GetGeneration() + 1;
+		slot.m_state.store(ToState(generation), boost::memory_order_release);
+
+		return (static_cast<Handle_t>(generation) << 32) | index;
+	}
+
+	void Remove(uint32_t index)
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		assert(index < m_size.load(boost::memory_order_relaxed));
+
+		Slot& slot = GetSlotRef(index);
+		uint32_t generation = slot.GetGeneration();
+		if (!(generation & 1)) return;
+
+		// Pending handlers are forgotten, the object is gone for them.
+		slot.m_state.store(ToState(generation + 1), boost::memory_order_release);
+		slot.m_value.store(nullptr, boost::memory_order_relaxed);
+		m_free.push_back(index);
+	}
+
+	// Current handle of a taken slot.
+	Handle_t GetHandle(uint32_t index) const
+	{
+		uint32_t generation = GetSlotRef(index).GetGeneration();
+		return (static_cast<Handle_t>(generation) << 32) | index;
+	}
+
+	// Object the handle refers to, or null if the handle is stale.
+	T* Find(Handle_t handle) const
+	{
+		uint32_t index = GetSlot(handle);
+		uint32_t generation = GetGeneration(handle);
+		if (index >= m_size.load(boost::memory_order_acquire)) return nullptr;
+
+		const Slot& slot = GetSlotRef(index);
+		if (slot.GetGeneration() != generation) return nullptr;
+		T* value = slot.m_value.load(boost::memory_order_acquire);
+		// Slot might have been freed and taken again meanwhile.
+		if (slot.GetGeneration() != generation) return nullptr;
+
+		return value;
+	}
+
+	// Object the handle refers to, taken for exclusive handling. Null if
+	// the handle is stale or another thread is handling the object, that
+	// thread is told to handle it once more as it releases the object.
+	T* Acquire(Handle_t handle)
+	{
+		uint32_t index = GetSlot(handle);
+		uint32_t generation = GetGeneration(handle);
+		if (index >= m_size.load(boost::memory_order_acquire)) return nullptr;
+
+		Slot& slot = GetSlotRef(index);
+		uint64_t state = slot.m_state.load(boost::memory_order_acquire);
+		do
+		{
+			if ((state >> 32) != generation) return nullptr;
+		}
+		while (!slot.m_state.compare_exchange_weak(state, state + 1, boost::memory_order_acq_rel));
+
+		if (static_cast<uint32_t>(state)) return nullptr;
+		return slot.m_value.load(boost::memory_order_acquire);
+	}
+
+	// Give back object taken by Acquire. Returns true if it has been wanted
+	// meanwhile and has to be handled once more, all such wants make a single
+	// round. Object removed meanwhile isn't handled anymore.
+	bool Release(Handle_t handle)
+	{
+		uint32_t generation = GetGeneration(handle);
+		Slot& slot = GetSlotRef(GetSlot(handle));
+
+		uint64_t state = slot.m_state.load(boost::memory_order_acquire);
+		uint64_t desired = 0;
+		do
+		{
+			if ((state >> 32) != generation) return false;
+			desired = static_cast<uint32_t>(state) > 1 ? ToState(generation) + 1 : ToState(generation);
+		}
+		while (!slot.m_state.compare_exchange_weak(state, desired, boost::memory_order_acq_rel));
+
+		return desired != ToState(generation);
+	}
+
+	// Visit every object in the map, slots are walked in memory order.
+	template <typename Visitor>
+	void ForEach(Visitor&& visitor) const
+	{
+		size_t size = m_size.load(boost::memory_order_acquire);
+		for (size_t i = 0; i < size; i += CHUNK_SIZE)
+		{
+			const Slot* chunk = m_chunks[i / CHUNK_SIZE].load(boost::memory_order_acquire);
+			size_t count = size - i < CHUNK_SIZE ? size - i : CHUNK_SIZE;
+
+			for (size_t j = 0; j < count; ++j)
+			{
+				if (!(chunk[j].GetGeneration() & 1)) continue;
+				T* value = chunk[j].m_value.load(boost::memory_order_acquire);
+				if (value) visitor(value);
+			}
+		}
+	}
+
+private:
+	Slot& GetSlotRef(uint32_t index) const
+	{
+		return m_chunks[index / CHUNK_SIZE].load(boost::memory_order_acquire)[index % CHUNK_SIZE];
+	}
+
+private:
+	std::array<boost::atomic<Slot*>, MAX_CHUNKS> m_chunks;
+	boost::atomic<size_t> m_size;
+	std::vector<uint32_t> m_free;
+	boost::mutex m_mutex;
+};
+
+#endif // __SLOT_MAP_H__
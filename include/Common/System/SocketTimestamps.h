@@ -0,0 +1,37 @@
+#if !defined(__SOCKET_TIMESTAMPS_H__)
+#define __SOCKET_TIMESTAMPS_H__
+
+#include "CommonDefinitions.h"
+
+#if defined(__linux__)
+
+// Software timestamps of the kernel taken for connections: when their
+// input has arrived and when their output has been passed to the device.
+// Time input has waited in socket till it's read, and time since handler
+// has written output till it's transmitted, go to histograms.
+//
+// Reading and writing go through here as long as timestamps are enabled.
+// Transmit time is asked for a single write of a connection at a time,
+// so that the timestamp coming back is known to be of that write. It's
+// kept per descriptor since connection state has no room for it.
+class SocketTimestamps final
+{
+public:
+	static void Init(bool enabled);
+	static void Shutdown();
+	static bool IsEnabled();
+
+	// Connection has been given the descriptor.
+	static void Enable(int fd);
+	// Same as read and send without SIGPIPE, timestamps are taken along.
+	static ssize_t Read(int fd, char* buffer, size_t size);
+	static ssize_t Write(int fd, const char* data, size_t size);
+	// Take transmit timestamps queued by the kernel.
+	static void Collect(int fd);
+	// Connection is closed, timestamp awaited is dropped.
+	static void Forget(int fd);
+};
+
+#endif // __linux__
+
+#endif // __SOCKET_TIMESTAMPS_H__
@@ -0,0 +1,106 @@
+#if !defined(__STATS_SEGMENT_H__)
+#define __STATS_SEGMENT_H__
+
+#include "CommonDefinitions.h"
+
+struct StatsPolicy
+{
+	// Metrics are published this often, in milliseconds (0 - no segment).
+	size_t m_interval;
+
+	StatsPolicy(size_t interval = 0) : m_interval(interval) {}
+};
+
+#if defined(__linux__)
+
+// Layout of the segment, shared with readers in other processes.
+// Any change to it has to bump the version.
+const uint32_t STATS_MAGIC = 0x53543654;
+const uint32_t STATS_VERSION = 1;
+
+struct StatsHeader
+{
+	uint32_t m_magic;
+	uint32_t m_version;
+	uint32_t m_entrySize;
+	uint32_t m_capacity;
+	uint64_t m_pid;
+	// Wall clock the segment has been created at, in microseconds.
+	uint64_t m_created;
+	// Odd while entries are being written, readers retry then
+	// or if it has changed while they were copying.
+	boost::atomic<uint64_t> m_sequence;
+	// Fields below are covered by the sequence.
+	// Monotonic clock of the last publishing, in microseconds.
+	uint64_t m_published;
+	uint32_t m_entryCount;
+	uint32_t m_reserved;
+};
+
+// Metric as of publishing. Histograms are given by count of samples,
+// their sum, median, 99th percentile and maximum.
+struct StatsEntry
+{
+	enum Kind : uint32_t
+	{
+		counter,
+		gauge,
+		histogram
+	};
+
+	// Name along with labels, e.g. errors_total{errno="32"}, cut to fit.
+	char m_name[80];
+	Kind m_kind;
+	uint32_t m_reserved;
+	// Counter, gauge cast to signed, or histogram count.
+	uint64_t m_value;
+	uint64_t m_sum;
+	uint64_t m_median;
+	uint64_t m_p99;
+	uint64_t m_max;
+};
+
+static_assert(sizeof(StatsEntry) == 128, "Stats entry must have fixed size");
+
+// Metrics registry published to a file in /dev/shm named after the
+// process and its id, e.g. /dev/shm/Server.1234.stats. A background
+// thread copies it under seqlock, so external monitors map the file
+// and read it at any rate without any syscalls or locks in the server.
+class StatsSegment final
+{
+public:
+	static void Start(const StatsPolicy& policy);
+	// File is removed.
+	static void Stop();
+
+	static std::string GetPath(const std::string& name, uint64_t pid);
+};
+
+struct StatsSnapshot
+{
+	uint64_t m_published;
+	std::vector<StatsEntry> m_entries;
+};
+
+// Maps segment of another process read only.
+class StatsReader final
+{
+public:
+	// Throws if the file isn't there or its layout is of another version.
+	explicit StatsReader(const std::string& path);
+	~StatsReader();
+
+	uint64_t GetPid() const { return m_header->m_pid; }
+	uint64_t GetCreated() const { return m_header->m_created; }
+	// Consistent copy of entries, taken again while publisher is writing.
+	void Read(StatsSnapshot& snapshot) const;
+
+private:
+	int m_fd;
+	size_t m_size;
+	const StatsHeader* m_header;
+};
+
+#endif // __linux__
+
+#endif // __STATS_SEGMENT_H__
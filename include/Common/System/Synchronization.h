@@ -2,6 +2,13 @@
 #define __SYNCHRONIZATION_H__
 
 #include "CommonDefinitions.h"
+#include "Metrics.h"
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif // __linux__
 
 template < typename DerivedType > class GenericLock
 {
@@ -19,6 +26,12 @@ public:
         Self().Unlock();
     }
 
+    // Returns false if the lock is held by another thread.
+    bool TryLock ()
+    {
+        return Self().TryLock();
+    }
+
 protected:
     DerivedType & Self()
     {
@@ -26,6 +39,16 @@ protected:
     }
 };
 
+// Let the other hardware thread of the core go on while spinning.
+inline void CpuRelax()
+{
+#if defined(_WIN64)
+    YieldProcessor();
+#elif defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
 template < typename LockType > class ScopedLocker
 {
     LockType& m_lock;
@@ -59,6 +82,11 @@ public:
     {
         LeaveCriticalSection(&m_cs);
     }
+
+    bool TryLock()
+    {
+        return TryEnterCriticalSection(&m_cs) != FALSE;
+    }
 };
 
 #elif defined(__linux__)
@@ -86,8 +114,227 @@ public:
     {
         pthread_mutex_unlock(&m_mtx);
     }
+
+    bool TryLock()
+    {
+        return pthread_mutex_trylock(&m_mtx) == 0;
+    }
+};
+
+// Adaptive mutex: spins briefly as the holder of a short critical section
+// is likely to be done soon, then sleeps on futex. State is 0 if the lock
+// is free, 1 if it's held, 2 if it's held and there may be threads sleeping.
+class FutexLock : public GenericLock<FutexLock>
+{
+    static const size_t SPIN_COUNT = 100;
+    uint32_t m_state;
+
+    boost::atomic_ref<uint32_t> State() { return boost::atomic_ref<uint32_t>(m_state); }
+
+    static long Futex(uint32_t* address, int op, uint32_t value)
+    {
+        return syscall(SYS_futex, address, op, value, nullptr, nullptr, 0);
+    }
+public:
+    FutexLock() : m_state(0) {}
+
+    void Lock()
+    {
+        if (TryLock()) return;
+
+        for (size_t i = 0; i < SPIN_COUNT; ++i)
+        {
+            CpuRelax();
+            if (State().load(boost::memory_order_relaxed) == 0 && TryLock()) return;
+        }
+
+        // Lock is marked as waited for, so whoever releases it wakes a sleeper.
+        // Woken thread takes it marked again as there may be more of them.
+        while (State().exchange(2, boost::memory_order_acquire) != 0)
+            Futex(&m_state, FUTEX_WAIT_PRIVATE, 2);
+    }
+
+    void Unlock()
+    {
+        if (State().exchange(0, boost::memory_order_release) == 2)
+            Futex(&m_state, FUTEX_WAKE_PRIVATE, 1);
+    }
+
+    bool TryLock()
+    {
+        uint32_t state = 0;
+        return State().compare_exchange_strong(state, 1, boost::memory_order_acquire, boost::memory_order_relaxed);
+    }
 };
 
 #endif // _WIN64
 
+// Test-and-test-and-set spinlock. Waiters spin reading the lock, so its
+// cache line stays shared till it's released, and back off exponentially
+// to avoid all of them rushing at once. Threads outnumbering cores yield.
+class SpinLock : public GenericLock<SpinLock>
+{
+    static const size_t MAX_BACKOFF = 1024;
+    boost::atomic<bool> m_locked;
+public:
+    SpinLock() : m_locked(false) {}
+
+    void Lock()
+    {
+        size_t backoff = 1;
+        while (m_locked.exchange(true, boost::memory_order_acquire))
+        {
+            while (m_locked.load(boost::memory_order_relaxed))
+            {
+                if (backoff == MAX_BACKOFF)
+                {
+                    boost::this_thread::yield();
+                    continue;
+                }
+
+                for (size_t i = 0; i < backoff; ++i) CpuRelax();
+                backoff *= 2;
+            }
+        }
+    }
+
+    void Unlock()
+    {
+        m_locked.store(false, boost::memory_order_release);
+    }
+
+    bool TryLock()
+    {
+        return !m_locked.load(boost::memory_order_relaxed) && !m_locked.exchange(true, boost::memory_order_acquire);
+    }
+};
+
+// Fair spinlock: threads take tickets and get the lock in their order,
+// backing off in proportion to the number of them ahead. Thread preempted
+// while its turn comes holds up all behind it, so threads mustn't outnumber
+// cores.
+class TicketLock : public GenericLock<TicketLock>
+{
+    static const size_t BACKOFF_PER_WAITER = 32;
+    boost::atomic<uint32_t> m_next;
+    boost::atomic<uint32_t> m_serving;
+public:
+    TicketLock() : m_next(0), m_serving(0) {}
+
+    void Lock()
+    {
+        uint32_t ticket = m_next.fetch_add(1, boost::memory_order_relaxed);
+        for (;;)
+        {
+            uint32_t serving = m_serving.load(boost::memory_order_acquire);
+            if (serving == ticket) return;
+
+            for (size_t i = (ticket - serving) * BACKOFF_PER_WAITER; i; --i) CpuRelax();
+        }
+    }
+
+    void Unlock()
+    {
+        // Only the holder moves it on.
+        m_serving.store(m_serving.load(boost::memory_order_relaxed) + 1, boost::memory_order_release);
+    }
+
+    bool TryLock()
+    {
+        uint32_t serving = m_serving.load(boost::memory_order_relaxed);
+        uint32_t next = serving;
+        return m_next.compare_exchange_strong(next, serving + 1, boost::memory_order_acquire, boost::memory_order_relaxed);
+    }
+};
+
+// Contention of lock site, registered as the site is first locked. Sites
+// are told apart by tag types naming them, e.g.
+// struct ConnectionPoolSite { static const char* GetName() { return "connection_pool"; } };
+template < typename Site > class LockSiteStats
+{
+public:
+    static LockSiteStats& Get()
+    {
+        static LockSiteStats stats;
+        return stats;
+    }
+
+    static uint64_t ReadClock()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Time waited for the lock and held, in nanoseconds. Lock taken at once
+    // has waited for nothing, acquisitions which had to wait are counted.
+    LatencyStats m_wait;
+    LatencyStats m_hold;
+    Counter m_contended;
+
+private:
+    LockSiteStats()
+    {
+        std::string label = std::string("site=\"") + Site::GetName() + "\"";
+        Metrics::Register("lock_wait_ns", label, "Time waited for lock.", m_wait);
+        Metrics::Register("lock_hold_ns", label, "Time lock has been held.", m_hold);
+        Metrics::Register("lock_contended_total", label, "Acquisitions which had to wait for lock.", m_contended);
+    }
+
+    ~LockSiteStats()
+    {
+        Metrics::Unregister(&m_wait);
+        Metrics::Unregister(&m_hold);
+        Metrics::Unregister(&m_contended);
+    }
+};
+
+// Lock of any kind profiled as a lock site. Holder's time is kept in the
+// lock itself, it's touched by the thread holding it only.
+template < typename LockType, typename Site > class InstrumentedLock : public GenericLock<InstrumentedLock<LockType, Site>>
+{
+    LockType m_lock;
+    uint64_t m_acquired;
+public:
+    InstrumentedLock() : m_acquired(0) {}
+
+    void Lock()
+    {
+        LockSiteStats<Site>& stats = LockSiteStats<Site>::Get();
+        uint64_t wait = 0;
+        if (m_lock.TryLock()) m_acquired = LockSiteStats<Site>::ReadClock();
+        else
+        {
+            uint64_t start = LockSiteStats<Site>::ReadClock();
+            m_lock.Lock();
+            m_acquired = LockSiteStats<Site>::ReadClock();
+            wait = m_acquired - start;
+            stats.m_contended.Add();
+        }
+        stats.m_wait.Record(wait);
+    }
+
+    void Unlock()
+    {
+        uint64_t held = LockSiteStats<Site>::ReadClock() - m_acquired;
+        m_lock.Unlock();
+        LockSiteStats<Site>::Get().m_hold.Record(held);
+    }
+
+    bool TryLock()
+    {
+        if (!m_lock.TryLock()) return false;
+        m_acquired = LockSiteStats<Site>::ReadClock();
+        LockSiteStats<Site>::Get().m_wait.Record(0);
+        return true;
+    }
+};
+
+// Lock of a site is profiled in builds made with LOCK_PROFILING defined,
+// e.g. make LOCK_PROFILING=1, otherwise it's the very lock given.
+#if defined(LOCK_PROFILING)
+template < typename LockType, typename Site > using SiteLock = InstrumentedLock<LockType, Site>;
+#else
+template < typename LockType, typename Site > using SiteLock = LockType;
+#endif // LOCK_PROFILING
+
 #endif // __SYNCHRONIZATION_H__
\ No newline at end of file
@@ -0,0 +1,67 @@
+#if !defined(__TCP_INFO_H__)
+#define __TCP_INFO_H__
+
+#include "CommonDefinitions.h"
+
+struct TcpInfoPolicy
+{
+	// Connection is sampled at most this often, in milliseconds (0 - never).
+	size_t m_interval;
+	// Samples a thread takes per wakeup of its event loop, the rest of
+	// connections due wait for the next one.
+	size_t m_budget;
+
+	TcpInfoPolicy(size_t interval = 0, size_t budget = 16)
+	: m_interval(interval)
+	, m_budget(budget) {}
+};
+
+#if defined(__linux__)
+
+// Kernel view of a connection as of its last sample: round trip time and
+// its variance in microseconds, congestion window and segments sent but
+// not acknowledged yet, and segments retransmitted since it's been opened.
+struct TcpSample
+{
+	int m_fd;
+	uint32_t m_rtt;
+	uint32_t m_rttVar;
+	uint32_t m_cwnd;
+	uint32_t m_unacked;
+	uint32_t m_retransmits;
+};
+
+// TCP_INFO of connections, sampled by threads handling them as they take
+// their turns and kept per descriptor since connection state has no room
+// for it. Samples go to histograms, so network delay can be told from
+// time spent in the server, and the worst connections are listed on demand.
+class TcpInfo final
+{
+public:
+	enum Order
+	{
+		byRtt,
+		byRetransmits,
+		byUnacked
+	};
+
+	// Make room for descriptors below the limit of open files.
+	static void Init(const TcpInfoPolicy& policy);
+	static void Shutdown();
+	static bool IsEnabled();
+
+	// Event loop thread has woken up, its budget is renewed.
+	static void Renew();
+	// Sample connection taking its turn if it's due and budget allows.
+	static void Sample(int fd);
+	// Connection is closed, its sample is dropped.
+	static void Forget(int fd);
+
+	// Connections sampled, worst first. Samples are read while threads
+	// update them, the list is approximate.
+	static void ListWorst(Order order, size_t count, std::vector<TcpSample>& worst);
+};
+
+#endif // __linux__
+
+#endif // __TCP_INFO_H__
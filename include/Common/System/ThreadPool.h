@@ -36,6 +36,11 @@ public:
     using ThreadCallback_t = boost::function<void (void)>;
 
     ThreadPool(ThreadCallback_t threadCallback);
+    // Given number of threads, each pinned to a CPU of its own from the
+    // last one the process may run on down if asked to. Thread starting
+    // the pool keeps off those CPUs, so do threads it starts later.
+    // Threads aren't pinned if there aren't enough CPUs to spare.
+    ThreadPool(ThreadCallback_t threadCallback, size_t threadCount, bool pinned);
     ~ThreadPool();
 
     size_t GetThreadCount() const;
@@ -49,6 +54,7 @@ private:
 private:
     ThreadCallback_t m_threadCallback;
     uint32_t m_threadCount;
+    bool m_pinned;
     std::vector<pthread_t> m_threads;
     
 };
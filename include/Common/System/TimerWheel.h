@@ -0,0 +1,95 @@
+#if !defined(__TIMER_WHEEL_H__)
+#define __TIMER_WHEEL_H__
+
+#include "CommonDefinitions.h"
+
+// Timer state embedded in the record it belongs to. Deadline is just
+// stored when moved later, the wheel sees it as it reaches the tick
+// the timer has been filed for and files it again.
+struct TimerNode
+{
+	// Tick the timer expires at, zero if it isn't armed.
+	boost::atomic<uint32_t> m_deadline;
+	// Tick the wheel looks at the timer next, zero if it isn't filed.
+	boost::atomic<uint32_t> m_filed;
+
+	TimerNode() : m_deadline(0), m_filed(0) {}
+};
+
+// Hierarchical timing wheel of handles. Level 0 has a slot per tick,
+// each next level has a slot per turn of the previous one. Handle is
+// filed to the lowest level its distance fits in and moves down as
+// the wheel turns, so filing is O(1) and a handle is touched at most
+// once per level. Ticks wrap around, distances are taken modulo 2^32.
+// Not synchronized, owner serializes access.
+class TimerWheel final
+{
+	static const size_t LEVEL_BITS = 6;
+	static const size_t SLOT_COUNT = 1 << LEVEL_BITS;
+	static const size_t LEVEL_COUNT = 4;
+	// Handles filed further than that come up earlier and are filed again.
+	static const uint32_t MAX_DISTANCE = (1u << (LEVEL_BITS * LEVEL_COUNT)) - 1;
+
+public:
+	using Handle_t = uint64_t;
+
+	explicit TimerWheel(uint32_t now);
+
+	bool IsEmpty() const { return !m_size; }
+	size_t GetSize() const { return m_size; }
+
+	// Move empty wheel to the current tick before filing after a pause.
+	void Restart(uint32_t now);
+
+	// Handle comes up as the wheel reaches given tick, or next tick if it's past.
+	void File(Handle_t handle, uint32_t due);
+
+	// Turn the wheel up to given tick. Each handle coming up is given
+	// to the visitor along with the tick it has been filed for and the
+	// tick being reached. Visitor may file handles again.
+	template <typename Visitor>
+	void Advance(uint32_t now, Visitor&& visitor)
+	{
+		while (m_size && static_cast<int32_t>(now - m_next) >= 0)
+		{
+			uint32_t tick = m_next;
+
+			// Higher level slot is spread over lower ones as they complete a turn.
+			for (size_t level = 1; level < LEVEL_COUNT; ++level)
+			{
+				if (tick & ((1u << (LEVEL_BITS * level)) - 1)) break;
+				Cascade(level, (tick >> (LEVEL_BITS * level)) & (SLOT_COUNT - 1));
+			}
+
+			m_expired.swap(m_levels[0][tick & (SLOT_COUNT - 1)]);
+			m_size -= m_expired.size();
+			++m_next;
+
+			for (const Entry& entry : m_expired) visitor(entry.m_handle, entry.m_due, tick);
+			m_expired.clear();
+		}
+
+		Restart(now);
+	}
+
+private:
+	struct Entry
+	{
+		Handle_t m_handle;
+		uint32_t m_due;
+	};
+
+	using Slot_t = std::vector<Entry>;
+
+	void Place(const Entry& entry);
+	void Cascade(size_t level, size_t index);
+
+private:
+	std::array<std::array<Slot_t, SLOT_COUNT>, LEVEL_COUNT> m_levels;
+	Slot_t m_expired;
+	// Next tick to be reached.
+	uint32_t m_next;
+	size_t m_size;
+};
+
+#endif // __TIMER_WHEEL_H__
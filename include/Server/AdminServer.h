@@ -0,0 +1,94 @@
+#if !defined(__ADMIN_SERVER_H__)
+#define __ADMIN_SERVER_H__
+
+#include "CommonDefinitions.h"
+#include "Http.h"
+#include "Logger.h"
+#include "Metrics.h"
+#include "System/Endpoint.h"
+#include "System/IoManager.h"
+#include "System/ThreadPool.h"
+
+#if defined(__linux__)
+
+class AdminServer;
+
+// Connection of admin peer, it takes a single request and is closed
+// as soon as the response is written.
+class AdminConnection final : public IConnection
+{
+public:
+    AdminConnection(AdminServer& server);
+    virtual ~AdminConnection() { if (m_fd >= 0) close(m_fd); }
+
+    int Get() override { return m_fd; }
+    bool Complete() override;
+    uint32_t GetSlot() override { return m_slot; }
+    void SetSlot(uint32_t slot) override { m_slot = slot; }
+    TimerNode* GetTimer() override { return &m_timer; }
+    uint8_t GetServiceClass() override { return 0; }
+    void SetServiceClass(uint8_t) override {}
+
+    void Set(int fd) override;
+    ssize_t ReadAsync() override;
+    size_t WriteAsync(boost::string_view data) override;
+    std::string GetInputData() override { return m_input; }
+    void Disconnect() override;
+    boost::string_view GetInputView() override { return m_input; }
+    void Consume(size_t size) override { m_input.erase(0, size); }
+    bool IsInputFull() override { return m_input.size() == MAX_REQUEST_SIZE; }
+    bool HasPendingInput() override { return !m_input.empty(); }
+    bool Linger() override { return false; }
+
+private:
+    static const size_t MAX_REQUEST_SIZE = 4096;
+
+    AdminServer& m_server;
+    int m_fd;
+    uint32_t m_slot;
+    TimerNode m_timer;
+    std::string m_input;
+};
+
+// Admin listener on loopback, serving process metrics to monitoring:
+// Prometheus text format at /metrics and JSON at /metrics.json, and
+// connections with the worst TCP_INFO samples at /tcp. It runs
+// an event loop of its own on a single thread, so scraping never takes
+// turns from data connections.
+class AdminServer final
+{
+public:
+    // Refreshes metrics sampled rather than counted, e.g. connection
+    // table summary, right before they're exported.
+    using SampleCallback_t = boost::function<void ()>;
+
+    AdminServer(unsigned short port, SampleCallback_t&& sample);
+    ~AdminServer();
+
+    void Start();
+    void Stop();
+
+    // Request is null if it's malformed or too big.
+    void Respond(const HttpRequest* request, std::string& response);
+    void Close(AdminConnection* connection);
+
+private:
+    void OnAcceptComplete(IConnection* connection);
+    void StartAsyncIo(IEndpoint* endpoint);
+    void StopAsyncIo(IEndpoint* endpoint);
+    // Peer keeping connection without a request is shut down.
+    size_t OnTimeout(IEndpoint* endpoint);
+    void WorkCallback();
+
+private:
+    SampleCallback_t m_sample;
+    IoManager m_ioMgr;
+    ThreadPool m_threadPool;
+    // Touched by the loop thread only, the rest are deleted along with it.
+    PointerHashTable_t m_connections;
+    boost::scoped_ptr<IAcceptor> m_acceptor;
+};
+
+#endif // __linux__
+
+#endif // __ADMIN_SERVER_H__
@@ -7,6 +7,56 @@
 #include "System/IoManager.h"
 #include "System/ThreadPool.h"
 #include "System/Synchronization.h"
+#include "Framing.h"
+#include "Http.h"
+#include "ResponseCache.h"
+#include "Admission.h"
+#include "Logger.h"
+#include "PeerLimiter.h"
+#include "Arena.h"
+#include "System/PoolMemory.h"
+#include "System/MemoryGovernor.h"
+#include "System/IoBudget.h"
+#include "System/OutputBacklog.h"
+#include "System/StatsSegment.h"
+#include "System/TcpInfo.h"
+#include "System/SocketTimestamps.h"
+#include "AdminServer.h"
+
+// Server tuning coming from command line.
+struct ServerSettings
+{
+    unsigned short m_port;
+    FramingPolicy m_framing;
+    // Native Linux server responds to HTTP/1.1 requests instead of echoing.
+    bool m_http;
+    ResponseCachePolicy m_cache;
+    PoolMemoryPolicy m_memory;
+    MemoryBudgetPolicy m_budget;
+    // Native Linux server closes connections silent for this long, ms (0 - never).
+    size_t m_idleTimeout;
+    // Request has to come in whole within this time since its first part, ms (0 - no limit).
+    size_t m_requestTimeout;
+    AdmissionPolicy m_admission;
+    PeerLimitPolicy m_peerLimit;
+    // Native Linux server busy polls connections of the top service class
+    // with this many threads pinned to the last CPUs (0 - no lane, the class
+    // shares event loops and is just handled first).
+    size_t m_laneThreads;
+    // Bytes a connection reads and writes per turn of native Linux server
+    // event loop, the rest waits for other ready connections (0 - unlimited).
+    size_t m_ioBudget;
+    LoggerPolicy m_log;
+    // Native Linux server serves metrics on this loopback port (0 - no admin listener).
+    unsigned short m_adminPort;
+    StatsPolicy m_stats;
+    // Native Linux server reports event loop threads busy longer than this, ms (0 - unwatched).
+    size_t m_stallThreshold;
+    TcpInfoPolicy m_tcpInfo;
+    // Native Linux server times input waiting in sockets and output waiting
+    // for the device by kernel software timestamps.
+    bool m_timestamps;
+};
 
 class AsioServer final : public AppLogic<AsioServer, true>
 {
@@ -15,11 +65,17 @@ class Connection : public boost::enable_shared_from_this<Connection>
     static const size_t BUF_SIZE = 1024;
     boost::asio::ip::tcp::socket m_sock;
     char m_data[BUF_SIZE];
+    FrameFilter m_framing;
+    // Received frames not decoded yet as they haven't come whole.
+    std::string m_framedInput;
+    std::string m_inputData;
+    std::string m_outputData;
     boost::function<void(const boost::system::error_code& err, size_t bytesRead)> m_readCallback;
     boost::function<void(const boost::system::error_code& err, size_t bytesRead)> m_writeCallback;
 
-    Connection(boost::asio::io_service& ioSrv)
+    Connection(boost::asio::io_service& ioSrv, const FramingPolicy& framing)
     : m_sock(ioSrv)
+    , m_framing(framing)
     {
         memset(m_data, 0, BUF_SIZE);
     }
@@ -27,9 +83,9 @@ class Connection : public boost::enable_shared_from_this<Connection>
 public:
     using Pointer_t = boost::shared_ptr<Connection>;
 
-    static Pointer_t Create(boost::asio::io_service& ioSrv)
+    static Pointer_t Create(boost::asio::io_service& ioSrv, const FramingPolicy& framing)
     {
-        return Pointer_t(new Connection(ioSrv));
+        return Pointer_t(new Connection(ioSrv, framing));
     }
 
     boost::asio::ip::tcp::socket& GetSocket()
@@ -43,7 +99,7 @@ public:
 };
 
 public:
-    AsioServer(uint16_t port);
+    AsioServer(const ServerSettings& settings);
     ~AsioServer() { Stop(); }
 
     void OnRun();
@@ -55,6 +111,7 @@ private:
     void OnAccept(Connection::Pointer_t connection, const boost::system::error_code& err);
 
 private:
+    ServerSettings m_settings;
     boost::asio::io_service m_ioSvc;
     boost::asio::ip::tcp::endpoint m_endpoint;
     boost::asio::ip::tcp::acceptor m_acceptor;
@@ -82,11 +139,12 @@ class SystemServer : public AppLogic
 {
     CRTP_SELF(Derived)
 public:
-    SystemServer(unsigned short port)
-    : m_port(port)
+    SystemServer(const ServerSettings& settings)
+    : m_settings(settings)
+    , m_port(settings.m_port)
     , m_threadPool(boost::bind(&SystemServer::AsyncWorkCallback, this))
     , m_ioMgr(m_threadPool.GetThreadCount())
-    , m_cnMgr(boost::bind(&SystemServer::CreateConnection, this)) 
+    , m_cnMgr(boost::bind(&SystemServer::CreateConnection, this), settings.m_memory.m_connections)
     {
         m_acceptor = CreateAcceptor();
         m_ioMgr.Bind(m_acceptor);
@@ -114,6 +172,7 @@ public:
         std::cout << "Finishing system API based server..." << std::endl;
         m_ioMgr.Stop();
         m_threadPool.Stop();
+        PrintMetrics();
         std::cout << "System API based server finished." << std::endl;
     }
 
@@ -129,9 +188,22 @@ public:
 
     bool DoAccept()
     {
+        // Overloaded server turns peers away at once or leaves them
+        // in backlog for a while, rather than letting all of them time out.
+        switch (Self().Admit())
+        {
+        case AdmissionControl::reject:
+            return m_acceptor->RejectAsync(Self().GetBusyReply());
+        case AdmissionControl::pause:
+            return false;
+        default:
+            break;
+        }
+
+        // Acceptor turns the peer away if there's no connection for it.
         IConnection* connection = m_cnMgr.Get();
         bool res = m_acceptor->AcceptAsync(connection);
-        if (!res) m_cnMgr.Release(connection);
+        if (!res && connection) m_cnMgr.Release(connection);
 
         return res;
     }
@@ -141,7 +213,29 @@ public:
         Self().OnAcceptComplete(newConnection);
     }
 
+    // Servers without admission control take every peer.
+    AdmissionControl::Decision Admit() { return AdmissionControl::admit; }
+    std::string GetBusyReply() { return std::string(); }
+
 protected:
+    void PrintMetrics()
+    {
+        Metrics::BuiltIn& metrics = Metrics::Get();
+        std::cout << "Accepted " << metrics.m_accepts.Get() << ", rejected " << metrics.m_rejects.Get()
+            << ", disconnected " << metrics.m_disconnects.Get() << " peers; " << metrics.m_messages.Get()
+            << " messages, " << metrics.m_bytesIn.Get() << " bytes in, " << metrics.m_bytesOut.Get()
+            << " bytes out." << std::endl;
+
+        for (size_t i = 0; i < Metrics::stageCount; ++i)
+        {
+            const LatencyStats& latency = metrics.m_stages[i];
+            if (!latency.GetCount()) continue;
+
+            std::cout << "Stage " << Metrics::GetStageName(static_cast<Metrics::Stage>(i)) << ": latency mean " << latency.GetMean()
+                << " us, p99 " << latency.GetPercentile(0.99) << " us, max " << latency.GetMax() << " us." << std::endl;
+        }
+    }
+
     void AsyncWorkCallback()
     {
         try
@@ -156,6 +250,7 @@ protected:
     }
 
 protected:
+    ServerSettings m_settings;
     unsigned short m_port;
     SocketSubsystemIniter m_sockIniter;
     ThreadPool m_threadPool;
@@ -166,6 +261,12 @@ protected:
 
 #if defined(USE_NATIVE)
 
+// Pool of connections shared by IO threads.
+struct ConnectionPoolSite
+{
+    static const char* GetName() { return "connection_pool"; }
+};
+
 #if defined(_WIN64)
 
 class CWinSockServer final : public SystemServer
@@ -179,14 +280,14 @@ class CWinSockServer final : public SystemServer
     < 
         1, PointerList_t,
         boost::function<IConnection* (void)>,
-        CWindowsLock, ScopedLocker
+        SiteLock<CWindowsLock, ConnectionPoolSite>, ScopedLocker
     >,
     CWinSockIniter
 >
 {
 public:
-    CWinSockServer(unsigned short port)
-    : SystemServer(port) {}
+    CWinSockServer(const ServerSettings& settings)
+    : SystemServer(settings) {}
 
     IConnection* CreateConnection();
     IAcceptor* CreateAcceptor();
@@ -203,7 +304,11 @@ using CurrentServer = CWinSockServer;
 
 #elif defined(__linux__)
 
-class LinuxServer final : public SystemServer
+// Connection callbacks have to exist before the base class
+// creates the first connection, hence they're kept in a base too.
+using LinuxServerCallbacks = boost::base_from_member<ConnectionCallbacksPtr_t>;
+
+class LinuxServer final : private LinuxServerCallbacks, public SystemServer
 <
     LinuxServer,
     Acceptor,
@@ -214,22 +319,76 @@ class LinuxServer final : public SystemServer
     < 
         1, PointerList_t,
         boost::function<IConnection* (void)>,
-        LinuxLock, ScopedLocker
+        SiteLock<LinuxLock, ConnectionPoolSite>, ScopedLocker
     >,
     SubsysIniterNullObj
 >
 {
 public:
-    LinuxServer(unsigned short port)
-    : SystemServer(port) {}
+    LinuxServer(const ServerSettings& settings)
+    : LinuxServerCallbacks(CreateConnectionCallbacks(this, settings))
+    , SystemServer(settings)
+    , m_responseCache(settings.m_cache)
+    , m_admission(settings.m_admission)
+    , m_peerLimiter(settings.m_peerLimit)
+    , m_peerCount(0)
+    , m_lanePool(boost::bind(&LinuxServer::LaneWorkCallback, this), settings.m_laneThreads, true)
+    {
+        if (m_peerLimiter.IsEnabled()) AllocatePeers();
+        IoBudget::SetLimit(settings.m_ioBudget);
+        OutputBacklog::Init();
+        MemoryGovernor::Start(settings.m_budget, boost::bind(&LinuxServer::OnMemoryStage, this, _1));
+        m_ioMgr.SetTimerCallback(boost::bind(&LinuxServer::OnTimeout, this, _1));
+
+        if (settings.m_laneThreads)
+        {
+            m_ioMgr.EnableLane();
+            m_lanePool.Start();
+        }
+
+        m_ioMgr.StartWatchdog(settings.m_stallThreshold);
+        TcpInfo::Init(settings.m_tcpInfo);
+        SocketTimestamps::Init(settings.m_timestamps);
+        RegisterConnectionTable();
+        if (settings.m_adminPort)
+        {
+            m_admin.reset(new AdminServer(settings.m_adminPort, boost::bind(&LinuxServer::SampleConnections, this)));
+            m_admin->Start();
+        }
+    }
+
+    ~LinuxServer()
+    {
+        m_admin.reset();
+        UnregisterConnectionTable();
+        m_ioMgr.StopLane();
+        m_lanePool.Stop();
+        MemoryGovernor::Stop();
+        TcpInfo::Shutdown();
+        SocketTimestamps::Shutdown();
+        PrintLoopStats();
+    }
 
     IConnection* CreateConnection();
     IAcceptor* CreateAcceptor(); 
 
     void OnAcceptComplete(IConnection* connection);
 
+    AdmissionControl::Decision Admit();
+    std::string GetBusyReply();
+
 private:
+    static ConnectionCallbacksPtr_t CreateConnectionCallbacks(LinuxServer* server, const ServerSettings& settings);
+
     size_t OnDataExchangeComplete(IConnection* connection);
+    size_t OnHttpExchangeComplete(IConnection* connection);
+
+    // Produce response for request, through the cache if it's enabled.
+    // Response is built in the arena of current dispatch.
+    void Dispatch(boost::string_view request, ArenaString& response);
+    void HandleRequest(boost::string_view request, ArenaString& response);
+    // Connection is released once output backlogged is written.
+    void Close(IConnection* connection);
 
     // Associate newly created connection with IO manager
     // so that it's ready to asynchronous IO just now. 
@@ -239,6 +398,58 @@ private:
     // it won't be taking part in asynchronouse IO.
     // Called right before the resetting connection to initial state.   
     void StopAsyncIo(IEndpoint* endpoint);
+
+    // Input of connection is left unread until memory pressure relieves.
+    void DeferInput(IEndpoint* endpoint);
+    // Output backlog of connection has appeared or is gone.
+    void WatchOutput(IEndpoint* endpoint);
+    void SetServiceClass(IEndpoint* endpoint, uint8_t serviceClass);
+    // Memory governor has moved to another stage of load shedding.
+    void OnMemoryStage(MemoryGovernor::Stage stage);
+
+    // Arm idle or request timeout, depending on whether a request is half way in.
+    void RefreshTimer(IConnection* connection);
+    // Connection timed out is shut down, its loop then sees the peer gone.
+    // Connection of a throttled peer is resumed instead.
+    size_t OnTimeout(IEndpoint* endpoint);
+
+    // Peer of connection has sent requests and bytes. Peer over its rate
+    // limits isn't read until it's back within them, returns true then.
+    bool ThrottlePeer(IConnection* connection, size_t requests, size_t bytes);
+    bool IsThrottled(IEndpoint* endpoint);
+    void AllocatePeers();
+
+    void LaneWorkCallback();
+    void PrintLoopStats();
+
+    // Summary of connections bound, sampled as metrics are exported.
+    void RegisterConnectionTable();
+    void UnregisterConnectionTable();
+    void SampleConnections();
+
+private:
+    // Peer of a connection, kept aside since connection state has no room
+    // for it. Indexed by descriptor, which is known before the connection
+    // is bound and isn't reused until it's unbound.
+    struct PeerState
+    {
+        PeerLimiter::Key_t m_key;
+        // Input isn't watched until the connection's timer expires.
+        uint32_t m_throttled;
+    };
+
+    ResponseCache m_responseCache;
+    AdmissionControl m_admission;
+    PeerLimiter m_peerLimiter;
+    // Pages are touched only by descriptors taken.
+    boost::scoped_array<PeerState> m_peers;
+    size_t m_peerCount;
+    ThreadPool m_lanePool;
+    // Set by admin thread only.
+    std::array<Gauge, SERVICE_CLASS_COUNT> m_boundConnections;
+    Gauge m_backloggedConnections;
+    Gauge m_throttledConnections;
+    boost::scoped_ptr<AdminServer> m_admin;
 };
 
 using CurrentServer = LinuxServer;
@@ -0,0 +1,58 @@
+#include "Bench.h"
+#include "Checksum.h"
+
+// Amount of data pushed through each measurement regardless of frame size.
+static const size_t BYTES_PER_RUN = 256 * 1024 * 1024;
+
+void RunChecksumBench()
+{
+    std::cout << "CRC32C hardware acceleration: "
+        << (Crc32c::IsAccelerated() ? "SSE4.2" : "not available") << std::endl;
+    std::cout << "Throughput, GB/s" << std::endl;
+    std::cout << std::setw(10) << "frame" << std::setw(10) << "memcpy" << std::setw(10) << "table"
+        << std::setw(10) << "crc32c" << std::setw(12) << "crc+memcpy" << std::setw(10) << "fused" << std::endl;
+
+    std::vector<char> src(1024 * 1024);
+    std::vector<char> dst(src.size());
+    std::generate(std::begin(src), std::end(src), []() { return static_cast<char>(rand()); });
+
+    // Keep results alive so that compiler doesn't throw the work away.
+    volatile uint32_t sink = 0;
+
+    for (size_t frame = 64; frame <= src.size(); frame *= 4)
+    {
+        size_t iterations = BYTES_PER_RUN / frame;
+        double gb = static_cast<double>(iterations * frame) / 1e9;
+
+        double copy = MeasureSeconds(iterations, [&]()
+        {
+            memcpy(&dst[0], &src[0], frame);
+            sink = sink + dst[frame - 1];
+        });
+
+        double table = MeasureSeconds(iterations, [&]()
+        {
+            sink = sink + Crc32c::ComputePortable(&src[0], frame);
+        });
+
+        double crc = MeasureSeconds(iterations, [&]()
+        {
+            sink = sink + Crc32c::Compute(&src[0], frame);
+        });
+
+        double separate = MeasureSeconds(iterations, [&]()
+        {
+            sink = sink + Crc32c::Compute(&src[0], frame);
+            memcpy(&dst[0], &src[0], frame);
+        });
+
+        double fused = MeasureSeconds(iterations, [&]()
+        {
+            sink = sink + Crc32c::Copy(&dst[0], &src[0], frame);
+        });
+
+        std::cout << std::fixed << std::setprecision(2)
+            << std::setw(10) << frame << std::setw(10) << gb / copy << std::setw(10) << gb / table
+            << std::setw(10) << gb / crc << std::setw(12) << gb / separate << std::setw(10) << gb / fused << std::endl;
+    }
+}
@@ -0,0 +1,98 @@
+#include "Bench.h"
+#include "System/Endpoint.h"
+#include "System/Synchronization.h"
+
+#if defined(__linux__)
+
+// Each measurement runs this long regardless of how fast the lock is,
+// so that a lock stalled by preempted waiters doesn't hold up the rest.
+static const size_t RUN_MILLISECONDS = 300;
+
+// Connection taking no resources, only its pointer goes through the manager.
+class IdleConnection final : public IConnection
+{
+public:
+    int Get() override { return -1; }
+    bool Complete() override { return false; }
+    uint32_t GetSlot() override { return 0; }
+    void SetSlot(uint32_t) override {}
+    TimerNode* GetTimer() override { return nullptr; }
+    uint8_t GetServiceClass() override { return 0; }
+    void SetServiceClass(uint8_t) override {}
+
+    void Set(int) override {}
+    ssize_t ReadAsync() override { return 0; }
+    size_t WriteAsync(boost::string_view) override { return 0; }
+    std::string GetInputData() override { return std::string(); }
+    void Disconnect() override {}
+    boost::string_view GetInputView() override { return boost::string_view(); }
+    void Consume(size_t) override {}
+    bool IsInputFull() override { return false; }
+    bool HasPendingInput() override { return false; }
+    bool Linger() override { return false; }
+};
+
+// Get and release pairs per second of all threads together.
+template <typename Lock>
+static double MeasureManager(size_t threadCount)
+{
+    using Manager_t = ConnectionManager<1, PointerList_t, boost::function<IConnection* (void)>, Lock, ScopedLocker>;
+
+    // Every thread holds a single connection at most, so they're all made beforehand.
+    Manager_t manager([]() -> IConnection* { return new IdleConnection(); }, threadCount);
+    boost::atomic<bool> running(true);
+    std::vector<uint64_t> counts(threadCount);
+
+    std::vector<boost::thread> threads;
+    for (size_t i = 0; i < threadCount; ++i)
+    {
+        threads.emplace_back([&manager, &running, &counts, i]()
+        {
+            uint64_t count = 0;
+            while (running.load(boost::memory_order_relaxed))
+            {
+                manager.Release(manager.Get());
+                ++count;
+            }
+            counts[i] = count;
+        });
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    boost::this_thread::sleep(boost::posix_time::milliseconds(RUN_MILLISECONDS));
+    running.store(false, boost::memory_order_relaxed);
+    for (boost::thread& thread : threads) thread.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    uint64_t total = 0;
+    for (uint64_t count : counts) total += count;
+    return total / seconds;
+}
+
+void RunLockBench()
+{
+    size_t cores = std::max(boost::thread::hardware_concurrency(), 1u);
+    std::cout << "ConnectionManager Get and Release, millions of pairs per second, "
+        << cores << " hardware threads" << std::endl;
+    std::cout << std::setw(10) << "threads" << std::setw(10) << "pthread" << std::setw(10) << "futex"
+        << std::setw(10) << "spin" << std::setw(10) << "ticket" << std::endl;
+
+    // Up to twice as many threads as cores, to see how locks take preemption.
+    for (size_t threads = 1; threads <= 2 * cores; threads *= 2)
+    {
+        std::cout << std::fixed << std::setprecision(2) << std::setw(10) << threads
+            << std::setw(10) << MeasureManager<LinuxLock>(threads) / 1e6
+            << std::setw(10) << MeasureManager<FutexLock>(threads) / 1e6
+            << std::setw(10) << MeasureManager<SpinLock>(threads) / 1e6
+            << std::setw(10) << MeasureManager<TicketLock>(threads) / 1e6 << std::endl;
+    }
+}
+
+#else
+
+void RunLockBench()
+{
+    std::cout << "Lock policies are measured on Linux only." << std::endl;
+}
+
+#endif // __linux__
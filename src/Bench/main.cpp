@@ -0,0 +1,28 @@
+#include "Bench.h"
+
+namespace opt = boost::program_options;
+
+int main(int argc, char* argv[])
+{
+    opt::options_description desc("Benchmark options");
+    desc.add_options()
+    ("suite,s", opt::value<std::string>()->default_value("all"), "checksum, locks or all")
+    ("help,h", "see this help text");
+
+    opt::variables_map varMap;
+    opt::store(opt::parse_command_line(argc, argv, desc), varMap);
+    opt::notify(varMap);
+
+    if(varMap.count("help"))
+    {
+        std::cout << desc << std::endl;
+        return 1;
+    }
+
+    std::string suite = varMap["suite"].as<std::string>();
+
+    if (suite == "checksum" || suite == "all") RunChecksumBench();
+    if (suite == "locks" || suite == "all") RunLockBench();
+
+    return 0;
+}
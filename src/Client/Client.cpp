@@ -1,9 +1,11 @@
 #include "CommonDefinitions.h"
 #include "Client.h"
 
-AsioClient::AsioClient(const char* addr, uint16_t port)
+AsioClient::AsioClient(const char* addr, uint16_t port, const FramingPolicy& framing)
 : m_sock(m_ioSvc)
 , m_endpoint(boost::asio::ip::address::from_string(addr), port)
+, m_policy(framing)
+, m_framing(m_policy)
 {
     m_sock.connect(m_endpoint);
     auto peer = m_sock.remote_endpoint();
@@ -11,6 +13,15 @@ AsioClient::AsioClient(const char* addr, uint16_t port)
         << m_endpoint.port() << ") connected to " 
         << peer.address().to_string() 
         << "(" << peer.port() << ")." << std::endl;
+
+    if (m_policy.m_compression || m_policy.m_checksum || m_policy.m_serviceClass)
+    {
+        // Offer framing features to the server before any data exchanged.
+        boost::asio::write(m_sock, boost::asio::buffer(m_framing.Offer()));
+        size_t bytesRead = m_sock.read_some(boost::asio::buffer(m_data));
+        m_framing.Confirm(&m_data[0], bytesRead);
+        std::cout << "Framing " << (m_framing.IsFramed() ? "enabled." : "declined by server.") << std::endl;
+    }
 }
 
 void AsioClient::OnRun()
@@ -22,8 +33,12 @@ void AsioClient::OnRun()
         std::string input;
         std::getline(std::cin, input);
 
+        std::string output = input;
+        if (m_framing.IsFramed())
+            m_framing.Encode(input.data(), input.length(), output);
+
         boost::system::error_code err;
-        boost::asio::write(m_sock, boost::asio::buffer(input), err);
+        boost::asio::write(m_sock, boost::asio::buffer(output), err);
         if(err)
         {
             std::cerr << "Error writing data: " << err.message() << std::endl;
@@ -34,6 +49,34 @@ void AsioClient::OnRun()
         }
 
         std::fill(std::begin(m_data), std::end(m_data), 0);
+
+        if (m_framing.IsFramed())
+        {
+            // Echo may come in several frames, split and joined by the stream
+            // in any way, so it's read until the whole message is decoded.
+            std::string dataReceived;
+            bool malformed = false;
+            while (dataReceived.size() < input.length())
+            {
+                size_t bytesRead = m_sock.read_some(boost::asio::buffer(m_data), err);
+                if (err) break;
+
+                m_framedInput.append(&m_data[0], bytesRead);
+                size_t consumed = 0;
+                malformed = !m_framing.Decode(m_framedInput.data(), m_framedInput.size(), consumed, dataReceived);
+                if (malformed) break;
+                m_framedInput.erase(0, consumed);
+            }
+
+            if (err)
+                std::cerr << "Error reading data: " << err.message() << std::endl;
+            else if (malformed)
+                std::cerr << "Malformed frame received." << std::endl;
+            else
+                std::cout << "Data received: " << dataReceived << std::endl;
+            continue;
+        }
+
         size_t bytesRead = boost::asio::read(m_sock, boost::asio::buffer(m_data), boost::asio::transfer_all(), err);
         if (err && err != boost::asio::error::eof)
         {
@@ -12,6 +12,10 @@ int main(int argc, char* argv[])
     desc.add_options()
     ("address,a", opt::value<std::string>()->default_value(DEFAULT_HOST))
     ("port,p", opt::value<short>()->default_value(DEFAULT_PORT))
+    ("compression,c", opt::bool_switch(), "offer payload compression to the server")
+    ("checksum", opt::bool_switch(), "offer CRC32C checksum of each frame to the server")
+    ("service-class", opt::value<unsigned>()->default_value(0),
+        "ask the server to serve this connection in given class, higher ones go first (0-3)")
     ("help,h", "see this help text");
 
     opt::variables_map varMap;
@@ -26,7 +30,11 @@ int main(int argc, char* argv[])
 
     const char* host = (varMap.count("host")) ? varMap["host"].as<std::string>().c_str() : DEFAULT_HOST;
     short port = (varMap.count("port")) ? varMap["port"].as<short>() : DEFAULT_PORT;
-    RUN_APP(CurrentClient, host, port);
+    FramingPolicy framing;
+    framing.m_compression = varMap["compression"].as<bool>();
+    framing.m_checksum = varMap["checksum"].as<bool>();
+    framing.m_serviceClass = static_cast<uint8_t>(std::min<unsigned>(varMap["service-class"].as<unsigned>(), TOP_SERVICE_CLASS));
+    RUN_APP(CurrentClient, host, port, framing);
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,37 @@
+#include "Admission.h"
+#include "System/MemoryGovernor.h"
+
+AdmissionControl::AdmissionControl(const AdmissionPolicy& policy)
+: m_policy(policy)
+, m_tokens(static_cast<double>(policy.m_acceptRate))
+, m_refilled(Clock_t::now())
+{}
+
+AdmissionControl::Decision AdmissionControl::Admit(const LoadSignals& load)
+{
+	if (m_policy.m_maxConnections && load.m_connections >= m_policy.m_maxConnections) return reject;
+	if (m_policy.m_maxLag && load.m_lag > m_policy.m_maxLag) return reject;
+	if (m_policy.m_maxQueue && load.m_queue > m_policy.m_maxQueue) return reject;
+	if (MemoryGovernor::GetStage() >= MemoryGovernor::throttle) return reject;
+
+	if (!m_policy.m_acceptRate) return admit;
+
+	boost::mutex::scoped_lock lock(m_mutex);
+
+	Clock_t::time_point now = Clock_t::now();
+	double rate = static_cast<double>(m_policy.m_acceptRate);
+	double elapsed = std::chrono::duration<double>(now - m_refilled).count();
+	m_tokens = std::min(m_tokens + elapsed * rate, rate);
+	m_refilled = now;
+
+	if (m_tokens < 1.0) return pause;
+
+	m_tokens -= 1.0;
+	return admit;
+}
+
+size_t AdmissionControl::GetPause() const
+{
+	// Time for the next token to come.
+	return m_policy.m_acceptRate ? std::max<size_t>(1000 / m_policy.m_acceptRate, 1) : 0;
+}
@@ -0,0 +1,132 @@
+#include "Arena.h"
+
+namespace
+{
+
+// Arenas of calling thread not in use at the moment.
+struct ArenaPool
+{
+	std::vector<Arena*> m_free;
+	Arena* m_current;
+
+	ArenaPool() : m_current(nullptr) {}
+
+	~ArenaPool()
+	{
+		std::for_each(std::begin(m_free), std::end(m_free), [](Arena* a) { delete a; });
+	}
+};
+
+thread_local ArenaPool s_pool;
+
+inline char* AlignUp(char* p, size_t alignment)
+{
+	uintptr_t addr = reinterpret_cast<uintptr_t>(p);
+	return reinterpret_cast<char*>((addr + alignment - 1) & ~(alignment - 1));
+}
+
+} // namespace
+
+Arena::Arena()
+: m_first(NewBlock(BLOCK_SIZE))
+, m_current(m_first)
+, m_pos(m_first->Begin())
+, m_retained(BLOCK_SIZE)
+{}
+
+Arena::~Arena()
+{
+	Release(m_first);
+}
+
+void* Arena::Allocate(size_t size, size_t alignment)
+{
+	char* p = AlignUp(m_pos, alignment);
+	if (p + size > m_current->End())
+	{
+		MoveToNextBlock(size, alignment);
+		p = AlignUp(m_pos, alignment);
+	}
+
+	m_pos = p + size;
+	return p;
+}
+
+void Arena::Reset()
+{
+	// Too much memory held after an unusually big request.
+	if (m_retained > MAX_RETAINED_SIZE)
+	{
+		Release(m_first->m_next);
+		m_first->m_next = nullptr;
+		m_retained = m_first->m_size;
+	}
+
+	m_current = m_first;
+	m_pos = m_first->Begin();
+}
+
+Arena* Arena::Current()
+{
+	return s_pool.m_current;
+}
+
+Arena::Block* Arena::NewBlock(size_t size)
+{
+	Block* block = static_cast<Block*>(::operator new(sizeof(Block) + size));
+	block->m_next = nullptr;
+	block->m_size = size;
+	return block;
+}
+
+void Arena::MoveToNextBlock(size_t size, size_t alignment)
+{
+	size_t required = size + alignment;
+
+	// Reuse blocks kept from the previous requests if they're large enough.
+	Block* next = m_current->m_next;
+	if (!next || next->m_size < required)
+	{
+		Block* block = NewBlock(required > BLOCK_SIZE ? required : BLOCK_SIZE);
+		block->m_next = next;
+		m_current->m_next = block;
+		m_retained += block->m_size;
+		next = block;
+	}
+
+	m_current = next;
+	m_pos = m_current->Begin();
+}
+
+void Arena::Release(Block* block)
+{
+	while (block)
+	{
+		Block* next = block->m_next;
+		::operator delete(block);
+		block = next;
+	}
+}
+
+ArenaScope::ArenaScope()
+: m_prev(s_pool.m_current)
+{
+	if (s_pool.m_free.empty())
+	{
+		m_arena = new Arena();
+	}
+	else
+	{
+		m_arena = s_pool.m_free.back();
+		s_pool.m_free.pop_back();
+	}
+
+	s_pool.m_current = m_arena;
+}
+
+ArenaScope::~ArenaScope()
+{
+	m_arena->Reset();
+	s_pool.m_current = m_prev;
+	s_pool.m_free.push_back(m_arena);
+}
@@ -0,0 +1,159 @@
+#include "BufferPool.h"
+#include "System/PoolMemory.h"
+#include "System/MemoryGovernor.h"
+
+namespace
+{
+
+// Memory kept at hand by each thread, per size class.
+const size_t THREAD_CACHE_SIZE = 256 * 1024;
+// Memory kept by the shared list, per size class. The rest goes back to heap.
+const size_t SHARED_CACHE_SIZE = 16 * 1024 * 1024;
+
+using FreeList_t = std::vector<char*>;
+using FreeLists_t = std::array<FreeList_t, BufferPool::CLASS_COUNT>;
+
+struct SharedCache
+{
+	boost::mutex m_mutex;
+	FreeLists_t m_lists;
+};
+
+SharedCache& GetShared()
+{
+	// Never destroyed, threads give their buffers back on exit
+	// which may happen after static destructors have run.
+	static SharedCache* shared = new SharedCache();
+	return *shared;
+}
+
+inline char* AllocateBuffer(uint8_t sizeClass)
+{
+	size_t size = BufferPool::GetSize(sizeClass);
+	void* buffer = PoolMemory::Allocate(size);
+	if (!buffer) buffer = ::operator new(size);
+
+	MemoryGovernor::Charge(MemoryGovernor::buffers, size);
+	return static_cast<char*>(buffer);
+}
+
+inline void FreeBuffer(char* buffer, uint8_t sizeClass)
+{
+	::operator delete(buffer);
+	MemoryGovernor::Discharge(MemoryGovernor::buffers, BufferPool::GetSize(sizeClass));
+}
+
+// Pools keep next to nothing at hand while memory is short.
+inline bool IsShrinking()
+{
+	return MemoryGovernor::GetStage() >= MemoryGovernor::shrink;
+}
+
+inline size_t GetThreadLimit(uint8_t sizeClass)
+{
+	if (IsShrinking()) return 1;
+	return std::max<size_t>(THREAD_CACHE_SIZE / BufferPool::GetSize(sizeClass), 4);
+}
+
+inline size_t GetSharedLimit(uint8_t sizeClass)
+{
+	if (IsShrinking()) return 0;
+	return SHARED_CACHE_SIZE / BufferPool::GetSize(sizeClass);
+}
+
+struct ThreadCache
+{
+	FreeLists_t m_lists;
+
+	~ThreadCache()
+	{
+		for (uint8_t i = 0; i < BufferPool::CLASS_COUNT; ++i)
+			Flush(i, m_lists[i].size());
+	}
+
+	// Move given number of buffers to the shared list, free those not fitting there.
+	void Flush(uint8_t sizeClass, size_t count)
+	{
+		FreeList_t& local = m_lists[sizeClass];
+		SharedCache& shared = GetShared();
+
+		boost::mutex::scoped_lock lock(shared.m_mutex);
+		FreeList_t& list = shared.m_lists[sizeClass];
+		for (; count; --count)
+		{
+			char* buffer = local.back();
+			local.pop_back();
+
+			// Buffers carved from pool memory can't be freed, they're kept anyway.
+			if (list.size() < GetSharedLimit(sizeClass) || PoolMemory::Owns(buffer)) list.push_back(buffer);
+			else FreeBuffer(buffer, sizeClass);
+		}
+	}
+
+	// Take up to given number of buffers from the shared list.
+	void Refill(uint8_t sizeClass, size_t count)
+	{
+		FreeList_t& local = m_lists[sizeClass];
+		SharedCache& shared = GetShared();
+
+		boost::mutex::scoped_lock lock(shared.m_mutex);
+		FreeList_t& list = shared.m_lists[sizeClass];
+		for (; count && !list.empty(); --count)
+		{
+			local.push_back(list.back());
+			list.pop_back();
+		}
+	}
+};
+
+thread_local ThreadCache s_cache;
+
+} // namespace
+
+uint8_t BufferPool::GetClass(size_t size)
+{
+	uint8_t sizeClass = 0;
+	while (sizeClass < CLASS_COUNT - 1 && GetSize(sizeClass) < size) ++sizeClass;
+	return sizeClass;
+}
+
+char* BufferPool::Acquire(uint8_t sizeClass)
+{
+	assert(sizeClass < CLASS_COUNT);
+
+	FreeList_t& local = s_cache.m_lists[sizeClass];
+	if (local.empty()) s_cache.Refill(sizeClass, std::max<size_t>(GetThreadLimit(sizeClass) / 2, 1));
+	if (local.empty()) return AllocateBuffer(sizeClass);
+
+	char* buffer = local.back();
+	local.pop_back();
+	return buffer;
+}
+
+void BufferPool::Release(char* buffer, uint8_t sizeClass)
+{
+	assert(sizeClass < CLASS_COUNT);
+
+	FreeList_t& local = s_cache.m_lists[sizeClass];
+	local.push_back(buffer);
+
+	size_t limit = GetThreadLimit(sizeClass);
+	if (local.size() > limit) s_cache.Flush(sizeClass, local.size() - limit / 2);
+}
+
+void BufferPool::Trim()
+{
+	SharedCache& shared = GetShared();
+	boost::mutex::scoped_lock lock(shared.m_mutex);
+
+	for (uint8_t i = 0; i < CLASS_COUNT; ++i)
+	{
+		FreeList_t& list = shared.m_lists[i];
+		// Buffers carved from pool memory stay, the rest is freed.
+		auto rest = std::partition(std::begin(list), std::end(list),
+			[](char* buffer) { return PoolMemory::Owns(buffer); });
+
+		std::for_each(rest, std::end(list), [i](char* buffer) { FreeBuffer(buffer, i); });
+		list.erase(rest, std::end(list));
+	}
+}
@@ -0,0 +1,154 @@
+#include "Checksum.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <nmmintrin.h>
+#define CRC32C_HW_TARGET __attribute__((target("sse4.2")))
+#elif defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#include <nmmintrin.h>
+#define CRC32C_HW_TARGET
+#endif
+
+namespace
+{
+
+// Reversed Castagnoli polynomial.
+const uint32_t POLY = 0x82f63b78;
+
+struct Tables
+{
+	uint32_t m_data[8][256];
+
+	Tables()
+	{
+		for (uint32_t i = 0; i < 256; ++i)
+		{
+			uint32_t crc = i;
+			for (int bit = 0; bit < 8; ++bit)
+				crc = (crc & 1) ? (crc >> 1) ^ POLY : crc >> 1;
+			m_data[0][i] = crc;
+		}
+
+		for (uint32_t i = 0; i < 256; ++i)
+		{
+			for (int t = 1; t < 8; ++t)
+				m_data[t][i] = (m_data[t - 1][i] >> 8) ^ m_data[0][m_data[t - 1][i] & 0xff];
+		}
+	}
+};
+
+const Tables s_tables;
+
+uint32_t UpdatePortable(uint32_t crc, const uint8_t* src, uint8_t* dst, size_t size)
+{
+	const uint32_t (&t)[8][256] = s_tables.m_data;
+
+	while (size >= 8)
+	{
+		uint64_t word;
+		memcpy(&word, src, 8);
+		if (dst)
+		{
+			memcpy(dst, &word, 8);
+			dst += 8;
+		}
+
+		// Little endian byte order assumed, as for all supported platforms.
+		uint32_t lo = static_cast<uint32_t>(word) ^ crc;
+		uint32_t hi = static_cast<uint32_t>(word >> 32);
+		crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+			t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+
+		src += 8;
+		size -= 8;
+	}
+
+	while (size--)
+	{
+		if (dst) *dst++ = *src;
+		crc = (crc >> 8) ^ t[0][(crc ^ *src++) & 0xff];
+	}
+
+	return crc;
+}
+
+#if defined(CRC32C_HW_TARGET)
+
+CRC32C_HW_TARGET uint32_t UpdateHardware(uint32_t crc, const uint8_t* src, uint8_t* dst, size_t size)
+{
+	uint64_t crc64 = crc;
+
+	while (size >= 8)
+	{
+		uint64_t word;
+		memcpy(&word, src, 8);
+		crc64 = _mm_crc32_u64(crc64, word);
+		if (dst)
+		{
+			memcpy(dst, &word, 8);
+			dst += 8;
+		}
+
+		src += 8;
+		size -= 8;
+	}
+
+	crc = static_cast<uint32_t>(crc64);
+	while (size--)
+	{
+		if (dst) *dst++ = *src;
+		crc = _mm_crc32_u8(crc, *src++);
+	}
+
+	return crc;
+}
+
+bool DetectHardware()
+{
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 1);
+	return (info[2] & (1 << 20)) != 0;
+#else
+	return __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+#else
+
+uint32_t UpdateHardware(uint32_t crc, const uint8_t* src, uint8_t* dst, size_t size)
+{
+	return UpdatePortable(crc, src, dst, size);
+}
+
+bool DetectHardware() { return false; }
+
+#endif // CRC32C_HW_TARGET
+
+using Update_t = uint32_t (*)(uint32_t, const uint8_t*, uint8_t*, size_t);
+
+// Implementation chosen once at startup.
+const bool s_accelerated = DetectHardware();
+const Update_t s_update = s_accelerated ? &UpdateHardware : &UpdatePortable;
+
+} // namespace
+
+uint32_t Crc32c::Compute(const void* data, size_t size, uint32_t crc)
+{
+	return ~s_update(~crc, static_cast<const uint8_t*>(data), nullptr, size);
+}
+
+uint32_t Crc32c::Copy(void* dst, const void* src, size_t size, uint32_t crc)
+{
+	return ~s_update(~crc, static_cast<const uint8_t*>(src), static_cast<uint8_t*>(dst), size);
+}
+
+bool Crc32c::IsAccelerated()
+{
+	return s_accelerated;
+}
+
+uint32_t Crc32c::ComputePortable(const void* data, size_t size, uint32_t crc)
+{
+	return ~UpdatePortable(~crc, static_cast<const uint8_t*>(data), nullptr, size);
+}
@@ -0,0 +1,141 @@
+#include "Compression.h"
+
+ZlibCodec::ZlibCodec(int level)
+{
+	memset(&m_deflate, 0, sizeof(m_deflate));
+	memset(&m_inflate, 0, sizeof(m_inflate));
+
+	if (deflateInit(&m_deflate, level) != Z_OK)
+		throw std::runtime_error("Unable to initialize zlib compression stream.");
+
+	if (inflateInit(&m_inflate) != Z_OK)
+	{
+		deflateEnd(&m_deflate);
+		throw std::runtime_error("Unable to initialize zlib decompression stream.");
+	}
+}
+
+ZlibCodec::~ZlibCodec()
+{
+	deflateEnd(&m_deflate);
+	inflateEnd(&m_inflate);
+}
+
+void ZlibCodec::Compress(const char* data, size_t size, std::string& out)
+{
+	// Reset keeps internal state allocated, so no allocation per message.
+	deflateReset(&m_deflate);
+
+	size_t prefix = out.size();
+	out.resize(prefix + deflateBound(&m_deflate, static_cast<uLong>(size)));
+
+	m_deflate.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+	m_deflate.avail_in = static_cast<uInt>(size);
+	m_deflate.next_out = reinterpret_cast<Bytef*>(&out[prefix]);
+	m_deflate.avail_out = static_cast<uInt>(out.size() - prefix);
+
+	// Output buffer is big enough to finish in a single call.
+	int res = deflate(&m_deflate, Z_FINISH);
+	assert(res == Z_STREAM_END);
+	(void)res;
+
+	out.resize(prefix + m_deflate.total_out);
+}
+
+bool ZlibCodec::Decompress(const char* data, size_t size, size_t limit, std::string& out)
+{
+	inflateReset(&m_inflate);
+
+	m_inflate.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+	m_inflate.avail_in = static_cast<uInt>(size);
+
+	size_t prefix = out.size();
+	size_t chunk = std::max<size_t>(2 * size, 256);
+
+	for (;;)
+	{
+		// Stream going on past the limit is given up right there.
+		size_t produced = out.size();
+		if (produced - prefix >= limit) return false;
+		chunk = std::min(chunk, limit - (produced - prefix));
+
+		out.resize(produced + chunk);
+		m_inflate.next_out = reinterpret_cast<Bytef*>(&out[produced]);
+		m_inflate.avail_out = static_cast<uInt>(chunk);
+
+		int res = inflate(&m_inflate, Z_NO_FLUSH);
+		out.resize(out.size() - m_inflate.avail_out);
+
+		if (res == Z_STREAM_END) return true;
+		// Truncated or malformed stream.
+		if (res != Z_OK) return false;
+
+		chunk *= 2;
+	}
+}
+
+std::vector<CodecRegistry::Entry>& CodecRegistry::Entries()
+{
+	// Zlib is always available, other codecs are added by Register.
+	static std::vector<Entry> entries =
+	{
+		{ "zlib", []() -> ICodec* { return new ZlibCodec(); } }
+	};
+	return entries;
+}
+
+uint8_t CodecRegistry::Register(const std::string& name, CodecCreator_t&& creator)
+{
+	std::vector<Entry>& entries = Entries();
+
+	uint8_t id = Find(name);
+	if (id != NO_CODEC)
+	{
+		entries[id].m_creator = creator;
+		return id;
+	}
+
+	if (entries.size() >= NO_CODEC)
+		throw std::length_error("Too many codecs registered.");
+
+	entries.push_back({ name, creator });
+	return static_cast<uint8_t>(entries.size() - 1);
+}
+
+uint8_t CodecRegistry::Find(const std::string& name)
+{
+	std::vector<Entry>& entries = Entries();
+	for (size_t i = 0; i < entries.size(); ++i)
+	{
+		if (entries[i].m_name == name) return static_cast<uint8_t>(i);
+	}
+	return NO_CODEC;
+}
+
+const std::string& CodecRegistry::GetName(uint8_t id)
+{
+	return Entries().at(id).m_name;
+}
+
+std::string CodecRegistry::GetNames()
+{
+	// Codecs registered later considered faster, so they go first.
+	std::vector<Entry>& entries = Entries();
+	std::string names;
+	for (auto it = entries.rbegin(); it != entries.rend(); ++it)
+	{
+		if (!names.empty()) names += ',';
+		names += it->m_name;
+	}
+	return names;
+}
+
+ICodec* CodecRegistry::GetLocal(uint8_t id)
+{
+	static thread_local std::vector<boost::shared_ptr<ICodec>> codecs;
+
+	if (codecs.size() <= id) codecs.resize(id + 1);
+	if (!codecs[id]) codecs[id].reset(Entries().at(id).m_creator());
+
+	return codecs[id].get();
+}
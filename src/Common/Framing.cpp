@@ -0,0 +1,240 @@
+#include "Framing.h"
+
+// Marks the handshake message so it can't be confused with ordinary data.
+static const char HANDSHAKE_TAG[] = "\x1b" "FRAME:";
+static const size_t HANDSHAKE_TAG_LEN = sizeof(HANDSHAKE_TAG) - 1;
+static const char CHECKSUM_FEATURE[] = "crc32c";
+static const char SERVICE_CLASS_FEATURE[] = "class=";
+static const size_t SERVICE_CLASS_FEATURE_LEN = sizeof(SERVICE_CLASS_FEATURE) - 1;
+
+const size_t FrameFilter::MAX_PAYLOAD_SIZE;
+
+// Service class feature carries a single digit.
+static bool ParseServiceClass(const std::string& feature, uint8_t& serviceClass)
+{
+	if (feature.size() != SERVICE_CLASS_FEATURE_LEN + 1) return false;
+	if (feature.compare(0, SERVICE_CLASS_FEATURE_LEN, SERVICE_CLASS_FEATURE)) return false;
+
+	char digit = feature[SERVICE_CLASS_FEATURE_LEN];
+	if (digit < '0' || digit >= '0' + SERVICE_CLASS_COUNT) return false;
+
+	serviceClass = static_cast<uint8_t>(digit - '0');
+	return true;
+}
+
+FrameFilter::FrameFilter(const FramingPolicy& policy)
+: m_policy(&policy)
+, m_stage(negotiating)
+, m_codec(CodecRegistry::NO_CODEC)
+, m_checksum(false)
+, m_serviceClass(0)
+{}
+
+bool FrameFilter::Accept(const char* data, size_t size, std::string& reply)
+{
+	assert(IsNegotiating());
+
+	// Whatever comes first negotiation is over.
+	m_stage = plain;
+
+	if (size < HANDSHAKE_TAG_LEN || memcmp(data, HANDSHAKE_TAG, HANDSHAKE_TAG_LEN))
+		return false;
+
+	// Take the first codec offered which is known here too.
+	std::stringstream features(std::string(data + HANDSHAKE_TAG_LEN, size - HANDSHAKE_TAG_LEN));
+	std::string feature;
+	std::string accepted;
+
+	while (std::getline(features, feature, ','))
+	{
+		if (feature == CHECKSUM_FEATURE)
+		{
+			if (!m_policy->m_checksum || m_checksum) continue;
+			m_checksum = true;
+		}
+		else if (!feature.compare(0, SERVICE_CLASS_FEATURE_LEN, SERVICE_CLASS_FEATURE))
+		{
+			if (!ParseServiceClass(feature, m_serviceClass)) continue;
+		}
+		else
+		{
+			if (!m_policy->m_compression || IsCompressed()) continue;
+			m_codec = CodecRegistry::Find(feature);
+			if (!IsCompressed()) continue;
+		}
+
+		if (!accepted.empty()) accepted += ',';
+		accepted += feature;
+	}
+
+	if (IsCompressed() || IsChecksummed()) m_stage = framed;
+
+	// Empty feature list in reply means offer declined.
+	reply.assign(HANDSHAKE_TAG, HANDSHAKE_TAG_LEN);
+	reply += accepted;
+
+	return true;
+}
+
+std::string FrameFilter::Offer() const
+{
+	std::string offer(HANDSHAKE_TAG, HANDSHAKE_TAG_LEN);
+	if (m_policy->m_compression) offer += CodecRegistry::GetNames();
+	if (m_policy->m_checksum)
+	{
+		if (offer.size() > HANDSHAKE_TAG_LEN) offer += ',';
+		offer += CHECKSUM_FEATURE;
+	}
+	if (m_policy->m_serviceClass)
+	{
+		if (offer.size() > HANDSHAKE_TAG_LEN) offer += ',';
+		offer += SERVICE_CLASS_FEATURE;
+		offer += static_cast<char>('0' + m_policy->m_serviceClass);
+	}
+	return offer;
+}
+
+bool FrameFilter::Confirm(const char* data, size_t size)
+{
+	assert(IsNegotiating());
+	m_stage = plain;
+
+	if (size < HANDSHAKE_TAG_LEN || memcmp(data, HANDSHAKE_TAG, HANDSHAKE_TAG_LEN))
+		return false;
+
+	std::stringstream features(std::string(data + HANDSHAKE_TAG_LEN, size - HANDSHAKE_TAG_LEN));
+	std::string feature;
+
+	while (std::getline(features, feature, ','))
+	{
+		if (feature == CHECKSUM_FEATURE)
+			m_checksum = true;
+		else if (!ParseServiceClass(feature, m_serviceClass))
+			m_codec = CodecRegistry::Find(feature);
+	}
+
+	if (IsCompressed() || IsChecksummed()) m_stage = framed;
+
+	return true;
+}
+
+bool FrameFilter::Decode(const char* data, size_t size, size_t& consumed, std::string& out)
+{
+	assert(IsFramed());
+	consumed = 0;
+
+	while (size - consumed >= LENGTH_SIZE)
+	{
+		uint32_t length = 0;
+		memcpy(&length, data + consumed, LENGTH_SIZE);
+		if (!length || LENGTH_SIZE + length > MAX_FRAME_SIZE) return false;
+
+		// The rest of the frame is yet to come.
+		if (size - consumed - LENGTH_SIZE < length) break;
+
+		if (!DecodeFrame(data + consumed + LENGTH_SIZE, length, out)) return false;
+		consumed += LENGTH_SIZE + length;
+	}
+
+	return true;
+}
+
+bool FrameFilter::DecodeFrame(const char* data, size_t size, std::string& out)
+{
+	// Flag and payload, checksum is stored after them.
+	size_t frameSize = size;
+	uint32_t expected = 0;
+	if (m_checksum)
+	{
+		if (size < CHECKSUM_SIZE) return false;
+		frameSize -= CHECKSUM_SIZE;
+		memcpy(&expected, data + frameSize, CHECKSUM_SIZE);
+	}
+
+	if (!frameSize) return false;
+
+	size_t offset = out.size();
+	switch (data[0])
+	{
+	case RAW_FRAME:
+		out.resize(offset + frameSize - 1);
+		if (!m_checksum)
+		{
+			memcpy(&out[offset], data + 1, frameSize - 1);
+			return true;
+		}
+		// Payload verified while it's being copied out.
+		return Crc32c::Copy(&out[offset], data + 1, frameSize - 1, Crc32c::Compute(data, 1)) == expected;
+
+	case COMPRESSED_FRAME:
+		if (!IsCompressed()) return false;
+		if (m_checksum && Crc32c::Compute(data, frameSize) != expected) return false;
+		// Frame never inflates past what a raw one could carry.
+		return CodecRegistry::GetLocal(m_codec)->Decompress(data + 1, frameSize - 1, MAX_PAYLOAD_SIZE, out);
+
+	default:
+		return false;
+	}
+}
+
+void FrameFilter::Encode(const char* data, size_t size, std::string& out)
+{
+	assert(IsFramed());
+	out.clear();
+
+	// Message larger than a frame may take goes in several ones,
+	// each is decoded and verified as soon as it's received whole.
+	size_t offset = 0;
+	do
+	{
+		size_t payload = std::min<size_t>(size - offset, MAX_PAYLOAD_SIZE);
+		EncodeFrame(data + offset, payload, out);
+		offset += payload;
+	}
+	while (offset < size);
+}
+
+void FrameFilter::EncodeFrame(const char* data, size_t size, std::string& out)
+{
+	// Length is known once the frame is complete.
+	size_t start = out.size();
+	size_t body = start + LENGTH_SIZE;
+	out.resize(body);
+
+	if (IsCompressed() && size >= m_policy->m_threshold)
+	{
+		out += COMPRESSED_FRAME;
+		CodecRegistry::GetLocal(m_codec)->Compress(data, size, out);
+
+		// Incompressible data sent as is, so frame is never larger than a raw one.
+		if (out.size() - body > size) out.resize(body);
+	}
+
+	uint32_t crc = 0;
+	if (out.size() == body)
+	{
+		out.resize(body + size + 1);
+		out[body] = RAW_FRAME;
+		if (m_checksum)
+			crc = Crc32c::Copy(&out[body + 1], data, size, Crc32c::Compute(&out[body], 1));
+		else
+			memcpy(&out[body + 1], data, size);
+	}
+	else if (m_checksum)
+	{
+		crc = Crc32c::Compute(out.data() + body, out.size() - body);
+	}
+
+	if (m_checksum) out.append(reinterpret_cast<const char*>(&crc), CHECKSUM_SIZE);
+
+	uint32_t length = static_cast<uint32_t>(out.size() - body);
+	memcpy(&out[start], &length, LENGTH_SIZE);
+}
+
+void FrameFilter::Reset()
+{
+	m_stage = negotiating;
+	m_codec = CodecRegistry::NO_CODEC;
+	m_checksum = false;
+	m_serviceClass = 0;
+}
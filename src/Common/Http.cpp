@@ -0,0 +1,212 @@
+#include "Http.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define HTTP_USE_SSE2
+#endif
+
+namespace
+{
+
+const size_t MAX_CONTENT_LENGTH = 1 << 30;
+
+#if defined(HTTP_USE_SSE2)
+inline unsigned CountTrailingZeros(unsigned mask)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return index;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+#endif // HTTP_USE_SSE2
+
+// Cut off CR of CRLF line end.
+inline const char* LineEnd(const char* begin, const char* eol)
+{
+	return (eol != begin && eol[-1] == '\r') ? eol - 1 : eol;
+}
+
+inline boost::string_view Trim(const char* begin, const char* end)
+{
+	while (begin != end && (*begin == ' ' || *begin == '\t')) ++begin;
+	while (end != begin && (end[-1] == ' ' || end[-1] == '\t')) --end;
+	return boost::string_view(begin, end - begin);
+}
+
+inline bool IEquals(boost::string_view lhs, const char* rhs)
+{
+	return boost::algorithm::iequals(lhs, rhs);
+}
+
+// Status line and headers which never change, Date included.
+struct ResponsePrefixes
+{
+	time_t m_second;
+	std::string m_date;
+	std::array<std::string, 4> m_prefixes;
+
+	ResponsePrefixes() : m_second(0) {}
+
+	void Refresh()
+	{
+		time_t now = time(nullptr);
+		if (now == m_second) return;
+		m_second = now;
+
+		tm gmt;
+#if defined(_WIN64)
+		gmtime_s(&gmt, &now);
+#else
+		gmtime_r(&now, &gmt);
+#endif
+		char date[64];
+		m_date.assign(date, strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &gmt));
+
+		static const char* statusLines[] =
+		{
+			"HTTP/1.1 200 OK\r\n",
+			"HTTP/1.1 400 Bad Request\r\n",
+			"HTTP/1.1 413 Payload Too Large\r\n",
+			"HTTP/1.1 503 Service Unavailable\r\n"
+		};
+
+		for (size_t i = 0; i < m_prefixes.size(); ++i)
+		{
+			std::string& prefix = m_prefixes[i];
+			prefix = statusLines[i];
+			prefix += "Server: Tcp6Server\r\nContent-Type: text/plain\r\nDate: ";
+			prefix += m_date;
+			prefix += "\r\n";
+		}
+	}
+};
+
+ResponsePrefixes& GetPrefixes()
+{
+	// Each IO thread keeps own copy so that no locking is needed.
+	static thread_local ResponsePrefixes prefixes;
+	prefixes.Refresh();
+	return prefixes;
+}
+
+} // namespace
+
+const char* HttpParser::Find(const char* begin, const char* end, char c)
+{
+#if defined(HTTP_USE_SSE2)
+	const __m128i pattern = _mm_set1_epi8(c);
+	while (end - begin >= 16)
+	{
+		__m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+		unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, pattern)));
+		if (mask) return begin + CountTrailingZeros(mask);
+		begin += 16;
+	}
+#endif // HTTP_USE_SSE2
+
+	while (begin != end && *begin != c) ++begin;
+	return begin;
+}
+
+HttpParser::Result HttpParser::Parse(const char* data, size_t size, HttpRequest& request, size_t& consumed)
+{
+	const char* begin = data;
+	const char* end = data + size;
+
+	// Empty lines ahead of request line should be ignored (RFC 7230, 3.5).
+	while (begin != end && (*begin == '\r' || *begin == '\n')) ++begin;
+
+	// Request line: method, target and version separated by single spaces.
+	const char* eol = Find(begin, end, '\n');
+	if (eol == end) return incomplete;
+
+	const char* lineEnd = LineEnd(begin, eol);
+	const char* methodEnd = Find(begin, lineEnd, ' ');
+	if (methodEnd == begin || methodEnd == lineEnd) return malformed;
+	const char* targetEnd = Find(methodEnd + 1, lineEnd, ' ');
+	if (targetEnd == methodEnd + 1 || targetEnd == lineEnd) return malformed;
+
+	boost::string_view version(targetEnd + 1, lineEnd - targetEnd - 1);
+	if (version.size() != 8 || version.substr(0, 7) != "HTTP/1." || !isdigit(version[7]))
+		return malformed;
+
+	request.m_method = boost::string_view(begin, methodEnd - begin);
+	request.m_target = boost::string_view(methodEnd + 1, targetEnd - methodEnd - 1);
+	request.m_version = version[7] - '0';
+	// HTTP/1.1 keeps connection alive unless told otherwise, HTTP/1.0 does opposite.
+	request.m_keepAlive = request.m_version > 0;
+
+	size_t contentLength = 0;
+	const char* pos = eol + 1;
+
+	// Header fields up to the empty line.
+	for (;;)
+	{
+		eol = Find(pos, end, '\n');
+		if (eol == end) return incomplete;
+
+		lineEnd = LineEnd(pos, eol);
+		if (lineEnd == pos)
+		{
+			pos = eol + 1;
+			break;
+		}
+
+		const char* colon = Find(pos, lineEnd, ':');
+		if (colon == lineEnd || colon == pos) return malformed;
+
+		boost::string_view name(pos, colon - pos);
+		boost::string_view value = Trim(colon + 1, lineEnd);
+
+		if (IEquals(name, "Content-Length"))
+		{
+			if (value.empty()) return malformed;
+			contentLength = 0;
+			for (char c : value)
+			{
+				if (!isdigit(c)) return malformed;
+				contentLength = contentLength * 10 + (c - '0');
+				if (contentLength > MAX_CONTENT_LENGTH) return malformed;
+			}
+		}
+		else if (IEquals(name, "Connection"))
+		{
+			if (IEquals(value, "close")) request.m_keepAlive = false;
+			else if (IEquals(value, "keep-alive")) request.m_keepAlive = true;
+		}
+		else if (IEquals(name, "Transfer-Encoding"))
+		{
+			// Chunked bodies aren't supported.
+			return malformed;
+		}
+
+		pos = eol + 1;
+	}
+
+	if (static_cast<size_t>(end - pos) < contentLength) return incomplete;
+
+	request.m_body = boost::string_view(pos, contentLength);
+	consumed = pos + contentLength - data;
+	return complete;
+}
+
+void HttpResponder::Append(std::string& out, Status status, bool keepAlive,
+	const char* body, size_t bodySize, bool headOnly)
+{
+	out += GetPrefixes().m_prefixes[status];
+
+	char contentLength[32];
+	int len = snprintf(contentLength, sizeof(contentLength), "Content-Length: %zu\r\n", bodySize);
+	out.append(contentLength, len);
+
+	out += keepAlive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+	if (!headOnly) out.append(body, bodySize);
+}
+
+const std::string& HttpResponder::GetDate()
+{
+	return GetPrefixes().m_date;
+}
@@ -0,0 +1,120 @@
+#include "LatencyStats.h"
+#include <cmath>
+
+namespace
+{
+
+// Threads take shards round robin as they record for the first time.
+boost::atomic<size_t> s_nextShard(0);
+thread_local size_t s_shard = s_nextShard.fetch_add(1, boost::memory_order_relaxed);
+
+inline size_t HighestBit(uint64_t value)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanReverse64(&index, value);
+	return index;
+#else
+	return 63 - __builtin_clzll(value);
+#endif
+}
+
+inline size_t GetBucket(uint64_t latency)
+{
+	// Below the first power of two split, each latency has a bucket of its own.
+	if (latency < LatencyStats::SUB_COUNT) return static_cast<size_t>(latency);
+
+	size_t bit = HighestBit(latency);
+	if (bit >= LatencyStats::MAX_BITS) return LatencyStats::BUCKET_COUNT - 1;
+
+	size_t shift = bit - LatencyStats::SUB_BITS;
+	return (shift + 1) * LatencyStats::SUB_COUNT + static_cast<size_t>(latency >> shift) - LatencyStats::SUB_COUNT;
+}
+
+} // namespace
+
+LatencyStats::LatencyStats()
+{
+	for (Shard& shard : m_shards)
+	{
+		for (auto& bucket : shard.m_buckets) bucket.store(0, boost::memory_order_relaxed);
+		shard.m_count.store(0, boost::memory_order_relaxed);
+		shard.m_total.store(0, boost::memory_order_relaxed);
+		shard.m_max.store(0, boost::memory_order_relaxed);
+	}
+}
+
+void LatencyStats::Record(uint64_t latency)
+{
+	Shard& shard = m_shards[s_shard % SHARD_COUNT];
+	shard.m_buckets[GetBucket(latency)].fetch_add(1, boost::memory_order_relaxed);
+	shard.m_count.fetch_add(1, boost::memory_order_relaxed);
+	shard.m_total.fetch_add(latency, boost::memory_order_relaxed);
+
+	uint64_t max = shard.m_max.load(boost::memory_order_relaxed);
+	while (latency > max && !shard.m_max.compare_exchange_weak(max, latency, boost::memory_order_relaxed)) {}
+}
+
+uint64_t LatencyStats::GetCount() const
+{
+	uint64_t count = 0;
+	for (const Shard& shard : m_shards) count += shard.m_count.load(boost::memory_order_relaxed);
+	return count;
+}
+
+uint64_t LatencyStats::GetMean() const
+{
+	uint64_t count = GetCount();
+	return count ? GetTotal() / count : 0;
+}
+
+uint64_t LatencyStats::GetMax() const
+{
+	uint64_t max = 0;
+	for (const Shard& shard : m_shards) max = std::max(max, shard.m_max.load(boost::memory_order_relaxed));
+	return max;
+}
+
+uint64_t LatencyStats::GetTotal() const
+{
+	uint64_t total = 0;
+	for (const Shard& shard : m_shards) total += shard.m_total.load(boost::memory_order_relaxed);
+	return total;
+}
+
+void LatencyStats::GetBuckets(Buckets_t& buckets) const
+{
+	buckets.fill(0);
+	for (const Shard& shard : m_shards)
+	{
+		for (size_t i = 0; i < BUCKET_COUNT; ++i)
+			buckets[i] += shard.m_buckets[i].load(boost::memory_order_relaxed);
+	}
+}
+
+uint64_t LatencyStats::GetUpperBound(size_t bucket)
+{
+	if (bucket < SUB_COUNT) return bucket;
+
+	size_t shift = bucket / SUB_COUNT - 1;
+	uint64_t sub = bucket % SUB_COUNT + SUB_COUNT;
+	return ((sub + 1) << shift) - 1;
+}
+
+uint64_t LatencyStats::GetPercentile(double share) const
+{
+	Buckets_t buckets;
+	GetBuckets(buckets);
+
+	uint64_t count = 0;
+	for (uint64_t n : buckets) count += n;
+
+	uint64_t wanted = static_cast<uint64_t>(std::ceil(share * count));
+	uint64_t seen = 0;
+	for (size_t i = 0; i < BUCKET_COUNT; ++i)
+	{
+		seen += buckets[i];
+		if (seen && seen >= wanted) return std::min(GetUpperBound(i), GetMax());
+	}
+	return GetMax();
+}
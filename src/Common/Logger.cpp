@@ -0,0 +1,289 @@
+#include "Logger.h"
+
+namespace
+{
+
+// Records of a single thread, the thread puts them and the writer takes.
+struct Ring
+{
+	boost::scoped_array<LogRecord> m_records;
+	size_t m_mask;
+	boost::atomic<size_t> m_head;
+	boost::atomic<size_t> m_tail;
+	// Thread has exited, ring is freed as soon as it's drained.
+	boost::atomic<bool> m_orphaned;
+
+	// Records are zeroed so that their pages aren't faulted in on hot path.
+	Ring(size_t size)
+	: m_records(new LogRecord[size]())
+	, m_mask(size - 1)
+	, m_head(0)
+	, m_tail(0)
+	, m_orphaned(false)
+	{}
+};
+
+struct State
+{
+	boost::atomic<uint8_t> m_level;
+	boost::atomic<uint64_t> m_dropped;
+	LoggerPolicy m_policy;
+	boost::mutex m_ringsLock;
+	std::vector<Ring*> m_rings;
+	boost::thread m_thread;
+
+	State() : m_level(Logger::info), m_dropped(0) {}
+};
+
+State s_state;
+
+// Ring of the thread is registered with its first record.
+struct RingHolder
+{
+	Ring* m_ring = nullptr;
+	~RingHolder() { if (m_ring) m_ring->m_orphaned.store(true, boost::memory_order_release); }
+};
+
+thread_local RingHolder s_holder;
+
+// Wall clock in microseconds. Coarse clock is a few times cheaper to read,
+// its resolution of a few milliseconds is enough to tell records apart.
+uint64_t ReadTime()
+{
+#if defined(__linux__)
+	timespec now;
+	clock_gettime(CLOCK_REALTIME_COARSE, &now);
+	return static_cast<uint64_t>(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+#else
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+#endif
+}
+
+Ring* GetRing()
+{
+	if (s_holder.m_ring) return s_holder.m_ring;
+
+	boost::mutex::scoped_lock lock(s_state.m_ringsLock);
+	size_t size = 1;
+	while (size < s_state.m_policy.m_ringSize) size <<= 1;
+	s_holder.m_ring = new Ring(size);
+	s_state.m_rings.push_back(s_holder.m_ring);
+	return s_holder.m_ring;
+}
+
+void AppendAddress(std::string& out, const char* data)
+{
+	sockaddr_in6 address;
+	memcpy(&address, data, sizeof(address));
+
+	char host[INET6_ADDRSTRLEN] = {};
+	inet_ntop(AF_INET6, &address.sin6_addr, host, sizeof(host));
+	out += host;
+	out += ':';
+	out += std::to_string(ntohs(address.sin6_port));
+}
+
+void AppendArg(std::string& out, const LogRecord& record, size_t i)
+{
+	uint64_t value = record.m_args[i];
+	switch (record.m_types[i])
+	{
+	case LogRecord::signedArg:
+		out += std::to_string(static_cast<int64_t>(value));
+		break;
+	case LogRecord::unsignedArg:
+		out += std::to_string(value);
+		break;
+	case LogRecord::realArg:
+	{
+		double real = 0;
+		memcpy(&real, &value, sizeof(real));
+		char text[32];
+		snprintf(text, sizeof(text), "%g", real);
+		out += text;
+		break;
+	}
+	case LogRecord::textArg:
+		out.append(record.m_text + (value >> 32), static_cast<uint32_t>(value));
+		break;
+	case LogRecord::addressArg:
+		AppendAddress(out, record.m_text + (value >> 32));
+		break;
+	}
+}
+
+void Format(std::string& out, const LogRecord& record)
+{
+	static const char levels[] = "DIWE";
+
+	time_t seconds = static_cast<time_t>(record.m_time / 1000000);
+	tm local = {};
+#if defined(_WIN64)
+	localtime_s(&local, &seconds);
+#else
+	localtime_r(&seconds, &local);
+#endif
+
+	char prefix[32];
+	snprintf(prefix, sizeof(prefix), "%02d:%02d:%02d.%06u %c ", local.tm_hour, local.tm_min, local.tm_sec,
+		static_cast<unsigned>(record.m_time % 1000000), levels[record.m_site->m_level]);
+	out += prefix;
+
+	// Each {} takes the next argument, those missing leave it as it is.
+	size_t arg = 0;
+	for (const char* f = record.m_site->m_format; *f; ++f)
+	{
+		if (f[0] == '{' && f[1] == '}' && arg < record.m_argCount)
+		{
+			AppendArg(out, record, arg++);
+			++f;
+		}
+		else out += *f;
+	}
+
+	if (record.m_suppressed) out += " (" + std::to_string(record.m_suppressed) + " similar suppressed)";
+	out += '\n';
+}
+
+void Flush(std::string& out, FILE* file)
+{
+	if (out.empty()) return;
+	fwrite(out.data(), 1, out.size(), file);
+	fflush(file);
+	out.clear();
+}
+
+// Take whatever threads have put so far. Records of a thread keep their
+// order, those of different threads are written ring by ring.
+void Drain(uint64_t& reportedDrops)
+{
+	static std::string output;
+	static std::string errors;
+
+	std::vector<Ring*> rings;
+	{
+		boost::mutex::scoped_lock lock(s_state.m_ringsLock);
+		rings = s_state.m_rings;
+	}
+
+	for (Ring* ring : rings)
+	{
+		bool orphaned = ring->m_orphaned.load(boost::memory_order_acquire);
+		size_t head = ring->m_head.load(boost::memory_order_relaxed);
+		size_t tail = ring->m_tail.load(boost::memory_order_acquire);
+
+		for (; head != tail; ++head)
+		{
+			const LogRecord& record = ring->m_records[head & ring->m_mask];
+			Format(record.m_site->m_level >= Logger::warning ? errors : output, record);
+		}
+		ring->m_head.store(head, boost::memory_order_release);
+
+		if (orphaned)
+		{
+			boost::mutex::scoped_lock lock(s_state.m_ringsLock);
+			s_state.m_rings.erase(std::find(s_state.m_rings.begin(), s_state.m_rings.end(), ring));
+			delete ring;
+		}
+	}
+
+	uint64_t dropped = s_state.m_dropped.load(boost::memory_order_relaxed);
+	if (dropped != reportedDrops)
+	{
+		errors += std::to_string(dropped - reportedDrops) + " log records dropped, buffers full.\n";
+		reportedDrops = dropped;
+	}
+
+	Flush(output, stdout);
+	Flush(errors, stderr);
+}
+
+void WriteOut()
+{
+	boost::posix_time::milliseconds interval(s_state.m_policy.m_interval);
+	uint64_t reportedDrops = s_state.m_dropped.load(boost::memory_order_relaxed);
+
+	try
+	{
+		for (;;)
+		{
+			Drain(reportedDrops);
+			boost::this_thread::sleep(interval);
+		}
+	}
+	catch (const boost::thread_interrupted&)
+	{
+		// Stop requested, what's left is written out.
+		Drain(reportedDrops);
+	}
+}
+
+} // namespace
+
+void Logger::Start(const LoggerPolicy& policy)
+{
+	s_state.m_policy = policy;
+	s_state.m_level.store(policy.m_level, boost::memory_order_relaxed);
+	s_state.m_thread = boost::thread(&WriteOut);
+}
+
+void Logger::Stop()
+{
+	if (!s_state.m_thread.joinable()) return;
+
+	s_state.m_thread.interrupt();
+	s_state.m_thread.join();
+}
+
+uint8_t Logger::GetLevel()
+{
+	return s_state.m_level.load(boost::memory_order_relaxed);
+}
+
+uint64_t Logger::GetDropCount()
+{
+	return s_state.m_dropped.load(boost::memory_order_relaxed);
+}
+
+LogRecord* Logger::Begin(LogSite& site)
+{
+	uint64_t now = ReadTime();
+
+	if (site.m_limit)
+	{
+		// Count restarts each second, racing threads may let a few more pass.
+		uint32_t second = static_cast<uint32_t>(now / 1000000);
+		uint32_t current = site.m_second.load(boost::memory_order_relaxed);
+		if (current != second && site.m_second.compare_exchange_strong(current, second, boost::memory_order_relaxed))
+			site.m_passed.store(0, boost::memory_order_relaxed);
+
+		if (site.m_passed.fetch_add(1, boost::memory_order_relaxed) >= site.m_limit)
+		{
+			site.m_suppressed.fetch_add(1, boost::memory_order_relaxed);
+			return nullptr;
+		}
+	}
+
+	Ring* ring = GetRing();
+	size_t tail = ring->m_tail.load(boost::memory_order_relaxed);
+	if (tail - ring->m_head.load(boost::memory_order_acquire) > ring->m_mask)
+	{
+		s_state.m_dropped.fetch_add(1, boost::memory_order_relaxed);
+		return nullptr;
+	}
+
+	LogRecord& record = ring->m_records[tail & ring->m_mask];
+	record.m_time = now;
+	record.m_site = &site;
+	record.m_suppressed = site.m_limit ? site.m_suppressed.exchange(0, boost::memory_order_relaxed) : 0;
+	record.m_argCount = 0;
+	record.m_textSize = 0;
+	return &record;
+}
+
+void Logger::Commit()
+{
+	Ring* ring = s_holder.m_ring;
+	ring->m_tail.store(ring->m_tail.load(boost::memory_order_relaxed) + 1, boost::memory_order_release);
+}
@@ -0,0 +1,305 @@
+#include "Metrics.h"
+
+namespace
+{
+
+// Threads take shards round robin as they count for the first time.
+boost::atomic<size_t> s_nextShard(0);
+thread_local size_t s_shard = s_nextShard.fetch_add(1, boost::memory_order_relaxed);
+
+// End of the previous stage of current turn, zero outside of turns.
+thread_local uint64_t s_mark = 0;
+
+const char* const STAGE_NAMES[] = { "wait", "read", "handle", "write" };
+
+struct Registry
+{
+	boost::mutex m_lock;
+	std::vector<MetricEntry> m_entries;
+
+	void Add(const std::string& name, const std::string& label, const std::string& help,
+		MetricEntry::Kind kind, const void* metric)
+	{
+		boost::mutex::scoped_lock lock(m_lock);
+		m_entries.push_back(MetricEntry{ name, label, help, kind, metric });
+	}
+};
+
+Registry& GetRegistry()
+{
+	static Registry registry;
+	return registry;
+}
+
+// Entries of the same name go together, as the text format requires.
+std::vector<MetricEntry> ListByName()
+{
+	std::vector<MetricEntry> entries = Metrics::List();
+	std::stable_sort(entries.begin(), entries.end(),
+		[](const MetricEntry& lhs, const MetricEntry& rhs) { return lhs.m_name < rhs.m_name; });
+	return entries;
+}
+
+void AppendSeries(std::string& out, const std::string& name, const std::string& label, const std::string& extra)
+{
+	out += name;
+	if (label.empty() && extra.empty()) return;
+
+	out += '{';
+	out += label;
+	if (!label.empty() && !extra.empty()) out += ',';
+	out += extra;
+	out += '}';
+}
+
+void AppendHistogramText(std::string& out, const MetricEntry& entry)
+{
+	const LatencyStats& histogram = entry.GetHistogram();
+	LatencyStats::Buckets_t buckets;
+	histogram.GetBuckets(buckets);
+
+	uint64_t count = 0;
+	for (uint64_t n : buckets) count += n;
+
+	// Buckets are merged into powers of two, those above the largest
+	// sample are left to +Inf.
+	uint64_t seen = 0;
+	for (size_t i = 0; i < LatencyStats::BUCKET_COUNT && seen < count; ++i)
+	{
+		seen += buckets[i];
+		if (i % LatencyStats::SUB_COUNT != LatencyStats::SUB_COUNT - 1) continue;
+
+		AppendSeries(out, entry.m_name + "_bucket", entry.m_label,
+			"le=\"" + std::to_string(LatencyStats::GetUpperBound(i)) + "\"");
+		out += ' ' + std::to_string(seen) + '\n';
+	}
+
+	AppendSeries(out, entry.m_name + "_bucket", entry.m_label, "le=\"+Inf\"");
+	out += ' ' + std::to_string(count) + '\n';
+	AppendSeries(out, entry.m_name + "_sum", entry.m_label, "");
+	out += ' ' + std::to_string(histogram.GetTotal()) + '\n';
+	AppendSeries(out, entry.m_name + "_count", entry.m_label, "");
+	out += ' ' + std::to_string(count) + '\n';
+}
+
+// Label text, e.g. a="1",b="2", turned into JSON object. Values never
+// have quotes or commas of their own.
+void AppendJsonLabels(std::string& out, const std::string& label)
+{
+	out += '{';
+	size_t pos = 0;
+	while (pos < label.size())
+	{
+		size_t equals = label.find('=', pos);
+		size_t end = label.find('"', equals + 2);
+		if (equals == std::string::npos || end == std::string::npos) break;
+
+		if (pos) out += ',';
+		out += '"' + label.substr(pos, equals - pos) + "\":" + label.substr(equals + 1, end - equals);
+		pos = end + 2;
+	}
+	out += '}';
+}
+
+Metrics::BuiltIn& CreateBuiltIn()
+{
+	static Metrics::BuiltIn builtIn;
+
+	Metrics::Register("accepts_total", "", "Peers accepted.", builtIn.m_accepts);
+	Metrics::Register("rejects_total", "", "Peers turned away by admission control.", builtIn.m_rejects);
+	Metrics::Register("disconnects_total", "", "Connections closed.", builtIn.m_disconnects);
+	Metrics::Register("bytes_in_total", "", "Bytes read from peers.", builtIn.m_bytesIn);
+	Metrics::Register("bytes_out_total", "", "Bytes written to peers.", builtIn.m_bytesOut);
+	Metrics::Register("messages_total", "", "Requests and messages handled.", builtIn.m_messages);
+	for (size_t code = 0; code < Metrics::ERROR_CODE_COUNT; ++code)
+		Metrics::Register("errors_total", "errno=\"" + std::to_string(code) + "\"", "IO errors by errno.", builtIn.m_errors[code]);
+	Metrics::Register("connections_active", "", "Connections in use.", builtIn.m_activeConnections);
+	Metrics::Register("connections_idle", "", "Connections pooled for reuse.", builtIn.m_idleConnections);
+	for (size_t stage = 0; stage < Metrics::stageCount; ++stage)
+	{
+		Metrics::Register("stage_latency_us", std::string("stage=\"") + STAGE_NAMES[stage] + "\"",
+			"Time of connection turn stages, from epoll wakeup through read and handler to write.", builtIn.m_stages[stage]);
+	}
+
+	return builtIn;
+}
+
+} // namespace
+
+Counter::Counter()
+{
+	for (Shard& shard : m_shards) shard.m_value.store(0, boost::memory_order_relaxed);
+}
+
+void Counter::Add(uint64_t value)
+{
+	m_shards[s_shard % SHARD_COUNT].m_value.fetch_add(value, boost::memory_order_relaxed);
+}
+
+uint64_t Counter::Get() const
+{
+	uint64_t value = 0;
+	for (const Shard& shard : m_shards) value += shard.m_value.load(boost::memory_order_relaxed);
+	return value;
+}
+
+Metrics::BuiltIn& Metrics::Get()
+{
+	static BuiltIn& builtIn = CreateBuiltIn();
+	return builtIn;
+}
+
+void Metrics::Register(const std::string& name, const std::string& label, const std::string& help, const Counter& metric)
+{
+	GetRegistry().Add(name, label, help, MetricEntry::counter, &metric);
+}
+
+void Metrics::Register(const std::string& name, const std::string& label, const std::string& help, const Gauge& metric)
+{
+	GetRegistry().Add(name, label, help, MetricEntry::gauge, &metric);
+}
+
+void Metrics::Register(const std::string& name, const std::string& label, const std::string& help, const LatencyStats& metric)
+{
+	GetRegistry().Add(name, label, help, MetricEntry::histogram, &metric);
+}
+
+void Metrics::Unregister(const void* metric)
+{
+	Registry& registry = GetRegistry();
+	boost::mutex::scoped_lock lock(registry.m_lock);
+	registry.m_entries.erase(std::remove_if(registry.m_entries.begin(), registry.m_entries.end(),
+		[metric](const MetricEntry& entry) { return entry.m_metric == metric; }), registry.m_entries.end());
+}
+
+std::vector<MetricEntry> Metrics::List()
+{
+	// Built in metrics are registered before anything is listed.
+	Get();
+
+	Registry& registry = GetRegistry();
+	boost::mutex::scoped_lock lock(registry.m_lock);
+	return registry.m_entries;
+}
+
+void Metrics::ForEach(const boost::function<void (const MetricEntry&)>& visitor)
+{
+	Get();
+
+	Registry& registry = GetRegistry();
+	boost::mutex::scoped_lock lock(registry.m_lock);
+	for (const MetricEntry& entry : registry.m_entries) visitor(entry);
+}
+
+void Metrics::ExportText(std::string& out)
+{
+	static const char* types[] = { "counter", "gauge", "histogram" };
+
+	std::string name;
+	for (const MetricEntry& entry : ListByName())
+	{
+		if (entry.IsSilent()) continue;
+
+		if (entry.m_name != name)
+		{
+			name = entry.m_name;
+			out += "# HELP " + name + ' ' + entry.m_help + '\n';
+			out += "# TYPE " + name + ' ' + types[entry.m_kind] + '\n';
+		}
+
+		switch (entry.m_kind)
+		{
+		case MetricEntry::counter:
+			AppendSeries(out, entry.m_name, entry.m_label, "");
+			out += ' ' + std::to_string(entry.GetCounter().Get()) + '\n';
+			break;
+		case MetricEntry::gauge:
+			AppendSeries(out, entry.m_name, entry.m_label, "");
+			out += ' ' + std::to_string(entry.GetGauge().Get()) + '\n';
+			break;
+		case MetricEntry::histogram:
+			AppendHistogramText(out, entry);
+			break;
+		}
+	}
+}
+
+void Metrics::ExportJson(std::string& out)
+{
+	static const char* types[] = { "counter", "gauge", "histogram" };
+
+	out += "{\"metrics\":[";
+	bool first = true;
+	for (const MetricEntry& entry : ListByName())
+	{
+		if (entry.IsSilent()) continue;
+
+		if (!first) out += ',';
+		first = false;
+
+		out += "{\"name\":\"" + entry.m_name + "\",\"type\":\"" + types[entry.m_kind] + "\",\"labels\":";
+		AppendJsonLabels(out, entry.m_label);
+
+		switch (entry.m_kind)
+		{
+		case MetricEntry::counter:
+			out += ",\"value\":" + std::to_string(entry.GetCounter().Get());
+			break;
+		case MetricEntry::gauge:
+			out += ",\"value\":" + std::to_string(entry.GetGauge().Get());
+			break;
+		case MetricEntry::histogram:
+		{
+			const LatencyStats& histogram = entry.GetHistogram();
+			out += ",\"count\":" + std::to_string(histogram.GetCount());
+			out += ",\"sum\":" + std::to_string(histogram.GetTotal());
+			out += ",\"mean\":" + std::to_string(histogram.GetMean());
+			out += ",\"p50\":" + std::to_string(histogram.GetPercentile(0.5));
+			out += ",\"p90\":" + std::to_string(histogram.GetPercentile(0.9));
+			out += ",\"p99\":" + std::to_string(histogram.GetPercentile(0.99));
+			out += ",\"p999\":" + std::to_string(histogram.GetPercentile(0.999));
+			out += ",\"max\":" + std::to_string(histogram.GetMax());
+			break;
+		}
+		}
+		out += '}';
+	}
+	out += "]}\n";
+}
+
+const char* Metrics::GetStageName(Stage stage)
+{
+	return STAGE_NAMES[stage];
+}
+
+void Metrics::CountError(int code)
+{
+	size_t index = std::min(static_cast<size_t>(std::max(code, 0)), ERROR_CODE_COUNT - 1);
+	Get().m_errors[index].Add();
+}
+
+uint64_t Metrics::ReadClock()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Metrics::StartTurn(uint64_t wake)
+{
+	s_mark = wake;
+}
+
+void Metrics::EndStage(Stage stage)
+{
+	// Stages outside of event loop turns, e.g. client's, aren't timed.
+	if (!s_mark) return;
+
+	uint64_t now = ReadClock();
+	Get().m_stages[stage].Record(now > s_mark ? now - s_mark : 0);
+	s_mark = now;
+}
+
+void Metrics::SkipStage()
+{
+	if (s_mark) s_mark = ReadClock();
+}
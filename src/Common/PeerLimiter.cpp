@@ -0,0 +1,104 @@
+#include "PeerLimiter.h"
+
+namespace
+{
+
+// Default number of peers tracked, a few tens of MB for the table.
+const size_t DEFAULT_CAPACITY = 1 << 20;
+
+inline uint64_t Mix(uint64_t value)
+{
+	// Finalizer of MurmurHash3, spreads nearby addresses over the table.
+	value ^= value >> 33;
+	value *= 0xff51afd7ed558ccdull;
+	value ^= value >> 33;
+	value *= 0xc4ceb9fe1a85ec53ull;
+	value ^= value >> 33;
+	return value;
+}
+
+} // namespace
+
+PeerLimiter::PeerLimiter(const PeerLimitPolicy& policy)
+: m_policy(policy)
+, m_setMask(0)
+, m_start(Clock_t::now())
+{
+	if (!m_policy.IsEnabled()) return;
+
+	// Number of sets is a power of two, so a set is picked by mask.
+	size_t capacity = m_policy.m_capacity ? m_policy.m_capacity : DEFAULT_CAPACITY;
+	size_t setCount = 1;
+	while (setCount * SET_SIZE < capacity) setCount <<= 1;
+
+	m_setMask = setCount - 1;
+	m_entries.resize(setCount * SET_SIZE, Entry{ 0, 0, 0, 0 });
+}
+
+PeerLimiter::Key_t PeerLimiter::GetKey(const sockaddr_in6& address)
+{
+	uint64_t prefix = 0;
+	uint64_t host = 0;
+	memcpy(&prefix, address.sin6_addr.s6_addr, sizeof(prefix));
+	if (IN6_IS_ADDR_V4MAPPED(&address.sin6_addr))
+		memcpy(&host, address.sin6_addr.s6_addr + sizeof(prefix), sizeof(host));
+
+	// Zero key marks free entries.
+	Key_t key = Mix(prefix ^ Mix(host));
+	return key ? key : 1;
+}
+
+PeerLimiter::Entry& PeerLimiter::Find(size_t set, Key_t key, uint32_t now)
+{
+	Entry* entries = &m_entries[set * SET_SIZE];
+	Entry* victim = entries;
+
+	for (size_t i = 0; i < SET_SIZE; ++i)
+	{
+		if (entries[i].m_key == key) return entries[i];
+
+		// Free entry is taken first, then the one seen longest ago.
+		if (!victim->m_key) continue;
+		if (!entries[i].m_key || now - entries[i].m_seen > now - victim->m_seen) victim = &entries[i];
+	}
+
+	// New peer starts with full buckets.
+	victim->m_key = key;
+	victim->m_requests = static_cast<float>(m_policy.m_requestRate);
+	victim->m_bytes = static_cast<float>(m_policy.m_byteRate);
+	victim->m_seen = now;
+	return *victim;
+}
+
+size_t PeerLimiter::Charge(Key_t key, size_t requests, size_t bytes)
+{
+	if (!IsEnabled()) return 0;
+
+	uint32_t now = static_cast<uint32_t>(
+		std::chrono::duration_cast<std::chrono::milliseconds>(Clock_t::now() - m_start).count());
+	size_t set = static_cast<size_t>(key) & m_setMask;
+
+	boost::mutex::scoped_lock lock(m_stripes[set % STRIPE_COUNT]);
+	Entry& entry = Find(set, key, now);
+
+	float elapsed = static_cast<float>(now - entry.m_seen) / 1000;
+	entry.m_seen = now;
+
+	// Buckets refill at the rate and hold up to a second worth of it.
+	// Charge is taken after the fact, so a bucket may go in debt.
+	float wait = 0;
+	if (m_policy.m_requestRate)
+	{
+		float rate = static_cast<float>(m_policy.m_requestRate);
+		entry.m_requests = std::min(entry.m_requests + elapsed * rate, rate) - requests;
+		wait = std::max(wait, -entry.m_requests / rate);
+	}
+	if (m_policy.m_byteRate)
+	{
+		float rate = static_cast<float>(m_policy.m_byteRate);
+		entry.m_bytes = std::min(entry.m_bytes + elapsed * rate, rate) - bytes;
+		wait = std::max(wait, -entry.m_bytes / rate);
+	}
+
+	return wait > 0 ? static_cast<size_t>(wait * 1000) + 1 : 0;
+}
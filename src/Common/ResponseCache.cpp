@@ -0,0 +1,177 @@
+#include "ResponseCache.h"
+
+ResponseCache::ResponseCache(const ResponseCachePolicy& policy)
+: m_shardCapacity(policy.m_capacity / std::max<size_t>(policy.m_shards, 1))
+, m_ttl(std::chrono::milliseconds(policy.m_ttl))
+{
+	size_t shardCount = std::max<size_t>(policy.m_shards, 1);
+	for (size_t i = 0; i < shardCount; ++i)
+		m_shards.push_back(boost::make_shared<Shard>());
+}
+
+std::string ResponseCache::Get(const std::string& request, const Handler_t& handler)
+{
+	Shard& shard = GetShard(request);
+	FlightPtr_t flight;
+	std::string response;
+
+	{
+		boost::unique_lock<boost::mutex> lock(shard.m_mutex);
+		if (Lookup(shard, request, Clock_t::now(), response)) return response;
+
+		auto it = shard.m_flights.find(request);
+		if (it != shard.m_flights.end())
+		{
+			// Somebody is computing the same response already, wait for it.
+			FlightPtr_t pending = it->second;
+			while (!pending->m_done) pending->m_cond.wait(lock);
+
+			if (pending->m_error) boost::rethrow_exception(pending->m_error);
+			return pending->m_response;
+		}
+
+		flight = boost::make_shared<Flight>();
+		shard.m_flights.emplace(request, flight);
+	}
+
+	// Handler runs without lock held.
+	try
+	{
+		response = handler(request);
+	}
+	catch (...)
+	{
+		flight->m_error = boost::current_exception();
+	}
+
+	{
+		boost::unique_lock<boost::mutex> lock(shard.m_mutex);
+		flight->m_done = true;
+		if (!flight->m_error)
+		{
+			flight->m_response = response;
+			Insert(shard, request, response, Clock_t::now());
+		}
+		shard.m_flights.erase(request);
+	}
+
+	flight->m_cond.notify_all();
+
+	if (flight->m_error) boost::rethrow_exception(flight->m_error);
+	return response;
+}
+
+ResponseCache::Shard& ResponseCache::GetShard(const std::string& request)
+{
+	return *m_shards[boost::hash<std::string>()(request) % m_shards.size()];
+}
+
+bool ResponseCache::Lookup(Shard& shard, const std::string& request, Clock_t::time_point now, std::string& response)
+{
+	auto it = shard.m_index.find(request);
+	if (it == shard.m_index.end()) return false;
+
+	Slot& slot = shard.m_slots[it->second];
+	if (slot.m_expires <= now)
+	{
+		Evict(shard, it->second);
+		return false;
+	}
+
+	// CLOCK only marks the entry, no reordering on hit.
+	slot.m_referenced = true;
+	response = slot.m_response;
+	return true;
+}
+
+void ResponseCache::Insert(Shard& shard, const std::string& request, const std::string& response, Clock_t::time_point now)
+{
+	size_t cost = request.size() + response.size() + ENTRY_OVERHEAD;
+	if (cost > m_shardCapacity) return;
+
+	// Entry could be inserted meanwhile by a call which has found no flight.
+	auto it = shard.m_index.find(request);
+	if (it != shard.m_index.end()) Evict(shard, it->second);
+
+	// Live entries are swept by the clock only once expired ones are gone.
+	EvictExpired(shard, now);
+	while (shard.m_cost + cost > m_shardCapacity)
+		EvictNext(shard, now);
+
+	size_t index = 0;
+	if (shard.m_freeSlots.empty())
+	{
+		index = shard.m_slots.size();
+		shard.m_slots.emplace_back();
+	}
+	else
+	{
+		index = shard.m_freeSlots.back();
+		shard.m_freeSlots.pop_back();
+	}
+
+	auto res = shard.m_index.emplace(request, index);
+
+	Slot& slot = shard.m_slots[index];
+	slot.m_key = &res.first->first;
+	slot.m_response = response;
+	slot.m_expires = now + m_ttl;
+	slot.m_cost = cost;
+	slot.m_referenced = false;
+
+	shard.m_expiries.emplace_back(index, slot.m_expires);
+	shard.m_cost += cost;
+}
+
+void ResponseCache::EvictExpired(Shard& shard, Clock_t::time_point now)
+{
+	while (!shard.m_expiries.empty() && shard.m_expiries.front().second <= now)
+	{
+		const Expiry_t& expiry = shard.m_expiries.front();
+
+		// Slot might have been evicted and taken by a later entry.
+		Slot& slot = shard.m_slots[expiry.first];
+		if (slot.m_key && slot.m_expires == expiry.second) Evict(shard, expiry.first);
+
+		shard.m_expiries.pop_front();
+	}
+}
+
+void ResponseCache::EvictNext(Shard& shard, Clock_t::time_point now)
+{
+	assert(!shard.m_index.empty());
+
+	// Sweep the clock hand giving referenced entries a second chance.
+	for (;;)
+	{
+		if (shard.m_hand >= shard.m_slots.size()) shard.m_hand = 0;
+		size_t index = shard.m_hand++;
+
+		Slot& slot = shard.m_slots[index];
+		if (!slot.m_key) continue;
+
+		if (slot.m_referenced && slot.m_expires > now)
+		{
+			slot.m_referenced = false;
+			continue;
+		}
+
+		Evict(shard, index);
+		return;
+	}
+}
+
+void ResponseCache::Evict(Shard& shard, size_t index)
+{
+	Slot& slot = shard.m_slots[index];
+	assert(slot.m_key);
+
+	shard.m_cost -= slot.m_cost;
+	// Key is owned by the node being erased, so erase by iterator.
+	shard.m_index.erase(shard.m_index.find(*slot.m_key));
+
+	slot.m_key = nullptr;
+	// Release memory right away, it's accounted as freed.
+	std::string().swap(slot.m_response);
+	shard.m_freeSlots.push_back(index);
+}
@@ -1,5 +1,13 @@
 #include "System/Endpoint.h"
 #include "System/Exception.h"
+#include "Arena.h"
+#include "System/PoolMemory.h"
+#include "System/MemoryGovernor.h"
+#include "System/IoBudget.h"
+#include "System/OutputBacklog.h"
+#include "System/SocketTimestamps.h"
+#include "System/Probes.h"
+#include "Logger.h"
 
 #if defined(_WIN64)
 
@@ -291,11 +299,13 @@ void CConnectionImpl::Reset()
 
 AcceptorImpl::AcceptorImpl(uint16_t port, AcceptCallback_t&& acceptCallback,
 	StartAsyncIoCallback_t&& startAsyncIoCallback,
-	StopAsyncIoCallback_t&& stopAsyncIoCallback)
-: Base_t(std::forward<StartAsyncIoCallback_t>(startAsyncIoCallback),
-	std::forward<StopAsyncIoCallback_t>(stopAsyncIoCallback))
-, m_acceptCallback(acceptCallback)
+	StopAsyncIoCallback_t&& stopAsyncIoCallback,
+	bool control)
+: m_acceptCallback(acceptCallback)
+, m_startAsyncIoCallback(startAsyncIoCallback)
+, m_stopAsyncIoCallback(stopAsyncIoCallback)
 , m_newConnection(nullptr)
+, m_control(control)
 {
      // Create acceptor endpoint.
     m_endpoint = socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP);
@@ -327,8 +337,9 @@ AcceptorImpl::AcceptorImpl(uint16_t port, AcceptCallback_t&& acceptCallback,
     if (bind(m_endpoint, m_addrInfo->ai_addr, static_cast<int>(m_addrInfo->ai_addrlen)) < 0)
         throw SystemException(errno);
 
-	// Start listening to peer connections.
-    if (listen(m_endpoint, 1) < 0)
+	// Start listening to peer connections. Peers wait in backlog
+	// while accepting is paused, so it's as long as system allows.
+    if (listen(m_endpoint, SOMAXCONN) < 0)
 		throw SystemException(errno);
 }
     
@@ -346,32 +357,74 @@ bool AcceptorImpl::Complete()
 	// by the whole server, not an acceptor only. Thereby only the acceptor
 	// is able to track accept operation completion.
 	m_acceptCallback(m_newConnection);
-	return true;
+	return false;
 }
 
 bool AcceptorImpl::Accept(IConnection* connection)
 {
-	socklen_t peerAddrLen = static_cast<socklen_t>(sizeof(m_peerAddr));
-	int res = accept(m_endpoint, reinterpret_cast<sockaddr*>(&m_peerAddr), &peerAddrLen);
-	if (res < 0)
+	int res = 0;
+	for (;;)
 	{
-		// Triggered with empty queue of listening sockets, or socket has just been closed.
-		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNABORTED)
-			return false;
-		else
+		socklen_t peerAddrLen = static_cast<socklen_t>(sizeof(m_peerAddr));
+		res = accept(m_endpoint, reinterpret_cast<sockaddr*>(&m_peerAddr), &peerAddrLen);
+		if (res < 0)
+		{
+			// Triggered with empty queue of listening sockets, or socket has just been closed.
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNABORTED)
+				return false;
+
+			Metrics::CountError(errno);
 			throw SystemException(errno);
-	}
-	else if (!res)
-	{
-		// Socket closed.
-		return false;
+		}
+		else if (!res)
+		{
+			// Socket closed.
+			return false;
+		}
+
+		if (connection && (m_control || MemoryGovernor::GetStage() < MemoryGovernor::shed)) break;
+
+		// Memory is short or there's no connection to serve the peer,
+		// so it's turned away at once rather than left in the backlog.
+		// Listener is edge triggered, so the rest waiting are taken too.
+		PROBE2(reject, res, &m_peerAddr);
+		close(res);
+		if (!m_control) Metrics::Get().m_rejects.Add();
 	}
 
+	if (!m_control) Metrics::Get().m_accepts.Add();
+
+	PROBE2(accept, res, &m_peerAddr);
+
 	// Now connection instance got associated with socket descriptor and switched to non-blocking mode.
 	m_newConnection = connection;
 	m_newConnection->Set(res);
 	return true;
 }
+
+bool AcceptorImpl::Reject(boost::string_view reply)
+{
+	socklen_t peerAddrLen = static_cast<socklen_t>(sizeof(m_peerAddr));
+	int res = accept4(m_endpoint, reinterpret_cast<sockaddr*>(&m_peerAddr), &peerAddrLen, SOCK_NONBLOCK);
+	if (res < 0)
+	{
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNABORTED)
+			return false;
+
+		Metrics::CountError(errno);
+		throw SystemException(errno);
+	}
+
+	PROBE2(reject, res, &m_peerAddr);
+
+	// Reply fits empty send buffer, nothing is waited for.
+	// Peer reset already mustn't raise SIGPIPE.
+	ssize_t written = send(res, reply.data(), reply.size(), MSG_NOSIGNAL);
+	(void)written;
+	close(res);
+	Metrics::Get().m_rejects.Add();
+	return true;
+}
 	
 std::string AcceptorImpl::GetPeerInfo()
 {
@@ -404,17 +457,32 @@ void AcceptorImpl::StopAsyncIo(IEndpoint* endpoint)
 	m_stopAsyncIoCallback(endpoint);
 }
 
-ConnectionImpl::ConnectionImpl(
-	OperationCallback_t&& dataExchangeCallback,
-	StartAsyncIoCallback_t&& startAsyncIoCallback,
-	StopAsyncIoCallback_t&& stopAsyncIoCallback) 
-: Base_t(std::forward<StartAsyncIoCallback_t>(startAsyncIoCallback),
-	std::forward<StopAsyncIoCallback_t>(stopAsyncIoCallback))
-, m_dataExchange(false)
-, m_dataExchangeCallback(std::forward<OperationCallback_t>(dataExchangeCallback))
+namespace
 {
-	std::fill(std::begin(m_readBuf), std::end(m_readBuf), 0);
-	std::fill(std::begin(m_writeBuf), std::end(m_writeBuf), 0);
+
+// Per-thread scratch of framing, used within a single dispatch only.
+thread_local std::string s_inputData;
+thread_local std::string s_outputData;
+
+// Malformed frames logged per second at most.
+const uint32_t MALFORMED_LOG_RATE = 10;
+
+} // namespace
+
+ConnectionImpl::ConnectionImpl(const FramingPolicy& framing, const ConnectionCallbacks* callbacks)
+: m_serviceClass(0)
+, m_sizeClass(DEFAULT_SIZE_CLASS)
+, m_averageRead(0)
+, m_bytesRead(0)
+, m_pending(0)
+, m_buffer(nullptr)
+, m_callbacks(callbacks)
+, m_framing(framing)
+{}
+
+ConnectionImpl::~ConnectionImpl()
+{
+	if (m_buffer) BufferPool::Release(m_buffer, m_sizeClass);
 }
 
 void ConnectionImpl::Set(int fd)
@@ -424,82 +492,311 @@ void ConnectionImpl::Set(int fd)
 
 	int nonBlockMode = 1;
 	if (ioctl(m_endpoint, FIONBIO, &nonBlockMode) < 0) throw SystemException(errno);
+	SocketTimestamps::Enable(m_endpoint);
+}
 
-	SetDataExchangeMode(true);
+bool ConnectionImpl::BorrowBuffer()
+{
+	if (!m_buffer)
+	{
+		m_buffer = BufferPool::Acquire(m_sizeClass);
+		return true;
+	}
+
+	// Unconsumed input has taken whole buffer, move it to a larger one.
+	if (m_pending == BufferPool::GetSize(m_sizeClass) && m_pending < BufferPool::MAX_SIZE)
+	{
+		// Connections wanting ever more memory are the first to wait.
+		if (MemoryGovernor::GetStage() >= MemoryGovernor::throttle) return false;
+
+		char* buffer = BufferPool::Acquire(m_sizeClass + 1);
+		memcpy(buffer, m_buffer, m_pending);
+		BufferPool::Release(m_buffer, m_sizeClass);
+		m_buffer = buffer;
+		++m_sizeClass;
+	}
+
+	return true;
 }
 
-size_t ConnectionImpl::Read()
+void ConnectionImpl::ReleaseBuffer()
 {
-	int bytesRead = read(m_endpoint, &m_readBuf[0], MAX_BUF_SIZE);
+	if (!m_buffer || m_pending) return;
+
+	BufferPool::Release(m_buffer, m_sizeClass);
+	m_buffer = nullptr;
+	m_bytesRead = 0;
+
+	// Next buffer has twice the room of an average read,
+	// unless memory is short.
+	m_sizeClass = BufferPool::GetClass(2 * m_averageRead);
+	if (MemoryGovernor::GetStage() >= MemoryGovernor::shrink && m_sizeClass > DEFAULT_SIZE_CLASS)
+		m_sizeClass = DEFAULT_SIZE_CLASS;
+}
+
+ssize_t ConnectionImpl::Read(IEndpoint* endpoint)
+{
+	// Backlog is written, lingering connection is done.
+	if (OutputBacklog::IsLingering(m_endpoint)) return 0;
+
+	// Turn is over, the rest is read on the next one.
+	if (!IoBudget::Allows()) return -1;
+
+	if (!BorrowBuffer())
+	{
+		// Input is left in socket until memory pressure relieves.
+		m_callbacks->m_deferInput(endpoint);
+		return -1;
+	}
+
+	// New data goes after the part left unconsumed.
+	size_t capacity = BufferPool::GetSize(m_sizeClass);
+	ssize_t bytesRead = SocketTimestamps::Read(m_endpoint, m_buffer + m_pending, capacity - m_pending);
+	PROBE3(read, m_endpoint, bytesRead, m_pending);
 	if (bytesRead < 0)
 	{
-		// Nothing to read yet.
-		if (errno == EAGAIN) return bytesRead;
-		else throw SystemException(errno);
+		// Nothing to read yet. Buffer is given back once the handler is done.
+		if (errno == EAGAIN) 
+		{
+			Metrics::SkipStage();
+			return -1;
+		}
+
+		Metrics::CountError(errno);
+		// Reset by peer is the same as closed by it.
+		if (errno == ECONNRESET) return 0;
+		throw SystemException(errno);
+	}
+
+	m_bytesRead = static_cast<uint16_t>(m_pending + bytesRead);
+	if (!bytesRead) return bytesRead;
+
+	IoBudget::Charge(bytesRead);
+	Metrics::EndStage(Metrics::readStage);
+	Metrics::Get().m_bytesIn.Add(bytesRead);
+
+	// Filled buffer tells nothing about message size except it's larger,
+	// so grow right away rather than averaging.
+	if (m_bytesRead == capacity)
+		m_averageRead = static_cast<uint16_t>(std::min(capacity, BufferPool::MAX_SIZE / 2));
+	else
+		m_averageRead = static_cast<uint16_t>(m_averageRead - m_averageRead / 8 + bytesRead / 8);
+
+	if (m_framing.IsNegotiating())
+	{
+		// Framing offer is answered right here, it's not a data for the server.
+		if (m_framing.Accept(m_buffer, m_bytesRead, s_outputData))
+		{
+			if (m_framing.GetServiceClass()) m_callbacks->m_setServiceClass(endpoint, m_framing.GetServiceClass());
+			WriteRaw(endpoint, s_outputData.data(), s_outputData.size());
+			m_bytesRead = 0;
+
+			// Look like nothing has been read yet.
+			return -1;
+		}
+	}
+	else if (m_framing.IsFramed())
+	{
+		// Whole frames are decoded and dropped from the buffer,
+		// incomplete one is kept for the next read to complete.
+		size_t consumed = 0;
+		s_inputData.clear();
+		if (!m_framing.Decode(m_buffer, m_bytesRead, consumed, s_inputData))
+		{
+			// Peer doesn't speak the protocol, it's disconnected.
+			LOG_LIMITED(Logger::warning, MALFORMED_LOG_RATE, "Malformed frame from connection {}.", m_endpoint);
+			Metrics::CountError(EPROTO);
+			return 0;
+		}
+		DropInput(consumed);
 	}
 
 	return bytesRead;
 }
 	
-size_t ConnectionImpl::Write(const std::string& data)
+size_t ConnectionImpl::Write(IEndpoint* endpoint, boost::string_view data)
 {
-	// Copy output data into the buffer without buffer reallocation.
-	size_t dataSize = data.length();
-	std::copy(std::begin(data), std::end(data), std::begin(m_writeBuf));
+	if (m_framing.IsFramed())
+	{
+		m_framing.Encode(data.data(), data.length(), s_outputData);
+		return WriteRaw(endpoint, s_outputData.data(), s_outputData.size());
+	}
+
+	// Data goes directly unless the socket is full.
+	return WriteRaw(endpoint, data.data(), data.length());
+}
 
-	int bytesWritten = write(m_endpoint, &m_writeBuf, dataSize);
-	if (bytesWritten < 0) throw SystemException(errno);
+size_t ConnectionImpl::WriteRaw(IEndpoint* endpoint, const char* data, size_t dataSize)
+{
+	// Output can't overtake backlog.
+	if (!OutputBacklog::IsEmpty(m_endpoint))
+	{
+		OutputBacklog::Keep(m_endpoint, data, dataSize);
+		return dataSize;
+	}
 
-	return bytesWritten;
+	Metrics::EndStage(Metrics::handleStage);
+	int bytesWritten = SocketTimestamps::Write(m_endpoint, data, dataSize);
+	if (bytesWritten < 0)
+	{
+		// Peer is gone, output is dropped. Whoever reads from it next finds that out.
+		if (errno == EPIPE || errno == ECONNRESET)
+		{
+			Metrics::CountError(errno);
+			return 0;
+		}
+
+		if (errno != EAGAIN)
+		{
+			Metrics::CountError(errno);
+			throw SystemException(errno);
+		}
+		bytesWritten = 0;
+	}
+	PROBE3(write, m_endpoint, bytesWritten, dataSize);
+
+	Metrics::EndStage(Metrics::writeStage);
+	Metrics::Get().m_bytesOut.Add(bytesWritten);
+	IoBudget::Charge(bytesWritten);
+	if (static_cast<size_t>(bytesWritten) == dataSize) return bytesWritten;
+
+	// Socket is full, the rest goes out as it takes more.
+	if (!OutputBacklog::Keep(m_endpoint, data + bytesWritten, dataSize - bytesWritten))
+		throw SystemException(EAGAIN);
+	m_callbacks->m_watchOutput(endpoint);
+	return dataSize;
 }
 
 std::string ConnectionImpl::GetInputData()
 {
-	assert(m_dataExchange);
+	boost::string_view input = GetInputView();
+	return std::string(input.data(), input.size());
+}
 
-	// Copy input data until the \0 symbol occurred.
-	auto endPos = std::find(std::begin(m_readBuf), std::end(m_readBuf), 0);
-	std::string data;
-	data.resize(std::distance(std::begin(m_readBuf), endPos));
-	std::copy(std::begin(m_readBuf), endPos, std::begin(data));
+boost::string_view ConnectionImpl::GetInputView()
+{
+	assert(!IsInitialState());
 
-	return data;
+	if (m_framing.IsFramed()) return s_inputData;
+	if (!m_buffer) return boost::string_view();
+	return boost::string_view(m_buffer, m_bytesRead);
+}
+
+void ConnectionImpl::Consume(size_t size)
+{
+	// Frames are dropped as soon as they're decoded,
+	// decoded input doesn't outlive the read.
+	if (m_framing.IsFramed())
+	{
+		s_inputData.erase(0, size);
+		return;
+	}
+
+	DropInput(size);
+}
+
+void ConnectionImpl::DropInput(size_t size)
+{
+	assert(size <= m_bytesRead);
+
+	// Move incomplete tail to the beginning so that next read appends to it.
+	m_pending = static_cast<uint16_t>(m_bytesRead - size);
+	if (m_pending && size) memmove(m_buffer, m_buffer + size, m_pending);
+	m_bytesRead = m_pending;
 }
 
 bool ConnectionImpl::Complete(IConnection* connection)
 {
-	assert(m_dataExchange);
+	assert(!IsInitialState());
+	Metrics::EndStage(Metrics::waitStage);
+	SocketTimestamps::Collect(m_endpoint);
 
-	size_t dataSize = m_dataExchangeCallback(connection);
-	if (!dataSize) return true;
+	// Input waits until backlogged output is written.
+	if (!OutputBacklog::IsEmpty(m_endpoint))
+	{
+		if (!OutputBacklog::Flush(m_endpoint)) return false;
+		m_callbacks->m_watchOutput(connection);
+	}
 
-	// After IO operation processing only part of data zeroed out.
-	// A size of this part is the same as length of data portin just processed.
-	boost::function<void(Buffer_t&, size_t)> ClearBuffer =
-	[](Buffer_t& buf, size_t dataSize)
 	{
-		auto endPos = std::begin(buf) + dataSize;
-		std::fill(std::begin(buf), endPos, 0);
-	};
+		// Temporaries of the handler come from per-thread arena which
+		// is rewound as soon as the response is written.
+		ArenaScope arena;
+		m_callbacks->m_dataExchange(connection);
+	}
 
-	ClearBuffer(m_readBuf, dataSize);
-	ClearBuffer(m_writeBuf, dataSize);
+	// Handler has read all it would this turn, buffer is given back
+	// unless there's unconsumed input to keep. It's gone already if
+	// the handler has reset the connection.
+	if (IsInitialState()) return false;
 
+	ReleaseBuffer();
+	return IoBudget::IsExhausted();
+}
+
+bool ConnectionImpl::Linger()
+{
+	if (OutputBacklog::IsEmpty(m_endpoint)) return false;
+
+	// Input of the peer is of no use any more, output still is.
+	shutdown(m_endpoint, SHUT_RD);
+	OutputBacklog::Linger(m_endpoint);
+	m_pending = 0;
+	m_bytesRead = 0;
+	ReleaseBuffer();
 	return true;
 }
 
 void ConnectionImpl::Reset()
 {
 	if (IsInitialState()) return;
+	// Output not written yet is lost along with the connection,
+	// as the peer is gone or hasn't read it in time.
+	OutputBacklog::Forget(m_endpoint);
+	SocketTimestamps::Forget(m_endpoint);
+	PROBE1(disconnect, m_endpoint);
 	close(m_endpoint);
+	Metrics::Get().m_disconnects.Add();
 	m_endpoint = 0;
-	SetDataExchangeMode(false);
+	m_bytesRead = 0;
+	m_pending = 0;
+	ReleaseBuffer();
+	m_framing.Reset();
+	SetServiceClass(0);
 }
 
 void ConnectionImpl::StopAsyncIo(IEndpoint* endpoint)
 {
 	if (IsInitialState()) return;
-	m_stopAsyncIoCallback(endpoint);
+	m_callbacks->m_stopAsyncIo(endpoint);
+}
+
+static_assert(BufferPool::MAX_SIZE <= UINT16_MAX, "Buffer offsets must fit 16 bits");
+static_assert(sizeof(Connection) <= CACHE_LINE_SIZE, "Connection state must fit a cache line");
+
+void* Connection::operator new(size_t size)
+{
+	void* p = operator new(size, std::nothrow);
+	if (!p) throw std::bad_alloc();
+	return p;
+}
+
+void* Connection::operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	void* p = PoolMemory::Allocate(size, CACHE_LINE_SIZE);
+	if (!p && posix_memalign(&p, CACHE_LINE_SIZE, size)) return nullptr;
+
+	MemoryGovernor::Charge(MemoryGovernor::connections, size);
+	return p;
+}
+
+void Connection::operator delete(void* p, size_t size) noexcept
+{
+	MemoryGovernor::Discharge(MemoryGovernor::connections, size);
+
+	// Connections are recycled by connection manager and deleted only
+	// at exit, so a piece of pool memory isn't worth reusing.
+	if (!PoolMemory::Owns(p)) free(p);
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,41 @@
+#include "System/IoBudget.h"
+
+namespace
+{
+
+// Set once at startup, before IO threads start.
+size_t s_limit = 0;
+
+thread_local size_t s_left = 0;
+thread_local bool s_exhausted = false;
+
+} // namespace
+
+void IoBudget::SetLimit(size_t limit)
+{
+	s_limit = limit;
+}
+
+void IoBudget::Renew()
+{
+	s_left = s_limit;
+	s_exhausted = false;
+}
+
+void IoBudget::Charge(size_t bytes)
+{
+	s_left = bytes < s_left ? s_left - bytes : 0;
+}
+
+bool IoBudget::Allows()
+{
+	if (!s_limit || s_left) return true;
+
+	s_exhausted = true;
+	return false;
+}
+
+bool IoBudget::IsExhausted()
+{
+	return s_exhausted;
+}
@@ -1,5 +1,11 @@
 #include "System/IoManager.h"
 #include "System/Exception.h"
+#include "System/IoBudget.h"
+#include "System/OutputBacklog.h"
+#include "System/TcpInfo.h"
+#include "System/Probes.h"
+#include "Logger.h"
+#include <execinfo.h>
 
 #if defined(_WIN64)
 
@@ -67,7 +73,106 @@ void CIoManager::Run()
 
 #elif defined(__linux__)
 
+namespace
+{
+
+// Exclusive wakeup matters for descriptors watched by several epolls only.
+// It's not allowed along with EPOLLRDHUP and rules out EPOLL_CTL_MOD.
+// Output is watched only while there's backlog, otherwise every write
+// acknowledged by the peer would wake a thread up for nothing.
+const uint32_t ENDPOINT_EVENTS = EPOLLET | EPOLLIN | EPOLLRDHUP | EPOLLWAKEUP;
+
+// Timer tick, milliseconds.
+const size_t TIMER_TICK = 100;
+
+// Events taken by a lane thread at once, lane endpoints are few.
+const size_t LANE_BATCH = 256;
+
+// Coarse clock of the current loop iteration, zero outside of loops.
+thread_local uint32_t s_tick = 0;
+
+// Endpoints of the thread with input left over their IO budget.
+// Each gets another turn after the rest of ready ones.
+thread_local std::deque<SlotMap<IEndpoint>::Handle_t> s_ready;
+
+// Frames of a stack sample, the innermost ones are of the signal handler.
+const size_t STACK_DEPTH = 32;
+const size_t HANDLER_FRAMES = 2;
+
+// Stack sampled by the signal handler on the thread watched, one at a time.
+boost::mutex s_sampleLock;
+void* s_frames[STACK_DEPTH];
+boost::atomic<int> s_frameCount(-1);
+
+void OnStackSample(int)
+{
+	// Unwinder has been loaded by the thread beforehand, nothing is allocated here.
+	s_frameCount.store(backtrace(s_frames, STACK_DEPTH), boost::memory_order_release);
+}
+
+// Signals up to SIGUSR2 are taken by termination logic, a realtime one is free.
+int GetSampleSignal()
+{
+	return SIGRTMIN;
+}
+
+// Stack of another thread as symbols, empty if it hasn't answered in time.
+std::vector<std::string> SampleStack(pthread_t thread)
+{
+	std::vector<std::string> stack;
+	boost::mutex::scoped_lock lock(s_sampleLock);
+
+	s_frameCount.store(-1, boost::memory_order_relaxed);
+	if (pthread_kill(thread, GetSampleSignal()) != 0) return stack;
+
+	int count = -1;
+	for (int i = 0; i < 100 && (count = s_frameCount.load(boost::memory_order_acquire)) < 0; ++i)
+		boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+	if (count <= static_cast<int>(HANDLER_FRAMES)) return stack;
+
+	if (char** symbols = backtrace_symbols(s_frames + HANDLER_FRAMES, count - HANDLER_FRAMES))
+	{
+		stack.assign(symbols, symbols + count - HANDLER_FRAMES);
+		free(symbols);
+	}
+	return stack;
+}
+
+uint64_t ReadMicroseconds(clockid_t clock)
+{
+	timespec now;
+	clock_gettime(clock, &now);
+	return static_cast<uint64_t>(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+}
+
+uint32_t ToTick(uint64_t us)
+{
+	// Zero tick stands for no deadline.
+	uint32_t tick = static_cast<uint32_t>(us / 1000 / TIMER_TICK);
+	return tick ? tick : 1;
+}
+
+uint32_t ReadTick()
+{
+	return ToTick(ReadMicroseconds(CLOCK_MONOTONIC_COARSE));
+}
+
+uint32_t ToDeadline(uint32_t tick, size_t timeout)
+{
+	uint32_t deadline = tick + static_cast<uint32_t>((timeout + TIMER_TICK - 1) / TIMER_TICK);
+	return deadline ? deadline : 1;
+}
+
+// Ticks wrap around, so they're compared by distance.
+inline bool IsBefore(uint32_t tick, uint32_t other)
+{
+	return static_cast<int32_t>(tick - other) < 0;
+}
+
+} // namespace
+
 IoManager::Exiter::Exiter()
+: m_slot(0)
 {
 	// Creating eventfd to signal epoll at exit to be woken up from waiting.
 	m_fd = eventfd(0, EFD_NONBLOCK);
@@ -90,18 +195,59 @@ void IoManager::Exiter::Signal(bool first)
 		throw SystemException(errno);
 }
 
-void IoManager::EventWrapper::DoOp(int opcode, uint32_t events, IEndpoint* endpoint)
+IoManager::Ticker::Ticker(IoManager& manager)
+: m_slot(0)
+, m_manager(manager)
+{
+	m_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	if (m_fd < 0) throw SystemException(errno);
+}
+
+bool IoManager::Ticker::Complete()
+{
+	// Wheel catches up with the clock itself, number of expirations doesn't matter.
+	// Another thread might have drained the descriptor already.
+	uint64_t expirations = 0;
+	if (read(m_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+		throw SystemException(errno);
+
+	m_manager.OnTick();
+	return false;
+}
+
+void IoManager::Ticker::Start()
+{
+	itimerspec spec = {};
+	spec.it_interval.tv_sec = TIMER_TICK / 1000;
+	spec.it_interval.tv_nsec = (TIMER_TICK % 1000) * 1000000;
+	spec.it_value = spec.it_interval;
+	if (timerfd_settime(m_fd, 0, &spec, nullptr) < 0) throw SystemException(errno);
+}
+
+void IoManager::Ticker::Stop()
+{
+	itimerspec spec = {};
+	if (timerfd_settime(m_fd, 0, &spec, nullptr) < 0) throw SystemException(errno);
+}
+
+void IoManager::EventWrapper::DoOp(int opcode, uint32_t events, int fd, uint64_t data)
 {
 	epoll_event ev;
 	ev.events = events;
-	ev.data.fd = endpoint->Get();
-	ev.data.ptr = endpoint;
-	if (epoll_ctl(m_fd, opcode, endpoint->Get(), &ev) < 0)
+	ev.data.u64 = data;
+	if (epoll_ctl(m_fd, opcode, fd, &ev) < 0)
 		throw SystemException(errno);
 }
 
-IoManager::IoManager(size_t threadCount)
-: m_threadCount(threadCount)
+IoManager::IoManager(size_t threadCount, const std::string& name)
+: m_name(name)
+, m_threadCount(threadCount)
+, m_lag(0)
+, m_queueDepth(0)
+, m_laneFd(-1)
+, m_laneRunning(false)
+, m_timers(ReadTick())
+, m_ticker(*this)
 {
 	// Creating epoll itself.
 	m_fd = epoll_create1(0);
@@ -110,19 +256,67 @@ IoManager::IoManager(size_t threadCount)
 	m_ewr.Set(m_fd);
 
 	// Bind exit reader with an epoll.
-	m_ewr.DoOp(EPOLL_CTL_ADD, EPOLLET | EPOLLIN | EPOLLEXCLUSIVE, &m_exiter);
+	SlotMap<IEndpoint>::Handle_t handle = m_endpoints.Insert(&m_exiter);
+	m_exiter.SetSlot(SlotMap<IEndpoint>::GetSlot(handle));
+	m_ewr.DoOp(EPOLL_CTL_ADD, EPOLLET | EPOLLIN | EPOLLEXCLUSIVE, m_exiter.Get(), handle);
+
+	// Bind ticker the same way.
+	handle = m_endpoints.Insert(&m_ticker);
+	m_ticker.SetSlot(SlotMap<IEndpoint>::GetSlot(handle));
+	m_ewr.DoOp(EPOLL_CTL_ADD, EPOLLET | EPOLLIN | EPOLLEXCLUSIVE, m_ticker.Get(), handle);
+
+	std::string label = "loop=\"" + m_name + "\"";
+	for (size_t i = 0; i < SERVICE_CLASS_COUNT; ++i)
+	{
+		Metrics::Register("event_latency_us", label + ",class=\"" + std::to_string(i) + "\"",
+			"Time since events have been taken till endpoint has been handled.", m_latency[i]);
+	}
+	Metrics::Register("loop_wait_us", label, "Time event loop thread has waited for events, per wakeup.", m_waitTime);
+	Metrics::Register("loop_processing_us", label, "Time event loop thread has spent handling events, per wakeup.", m_busyTime);
+	Metrics::Register("loop_events_per_wakeup", label, "Events taken by event loop thread at once.", m_batchSize);
+	Metrics::Register("event_handler_us", label, "Time of a single endpoint's turn.", m_handlerTime);
+	Metrics::Register("io_budget_exhausted_total", label, "Turns ended with input left over IO budget.", m_exhausted);
+	Metrics::Register("io_budget_revisits_total", label, "Turns given to endpoints with input left over.", m_revisits);
 }
 
 IoManager::~IoManager()
 {
 	Stop();
-	m_ewr.DoOp(EPOLL_CTL_DEL, EPOLLET | EPOLLIN | EPOLLEXCLUSIVE, &m_exiter);
+	for (const LatencyStats& latency : m_latency) Metrics::Unregister(&latency);
+	Metrics::Unregister(&m_waitTime);
+	Metrics::Unregister(&m_busyTime);
+	Metrics::Unregister(&m_batchSize);
+	Metrics::Unregister(&m_handlerTime);
+	Metrics::Unregister(&m_exhausted);
+	Metrics::Unregister(&m_revisits);
+	for (const LoopStats& loop : m_loops)
+	{
+		Metrics::Unregister(&loop.m_wakeups);
+		Metrics::Unregister(&loop.m_events);
+		Metrics::Unregister(&loop.m_busyTime);
+		Metrics::Unregister(&loop.m_waitTime);
+		Metrics::Unregister(&loop.m_stalls);
+	}
+	Unbind(&m_ticker);
+	Unbind(&m_exiter);
+	if (m_laneFd >= 0) close(m_laneFd);
 	close(m_fd);
 }
 
 void IoManager::Bind(IEndpoint* endpoint)
 {
-	m_ewr.DoOp(EPOLL_CTL_ADD, EPOLLET | EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLEXCLUSIVE | EPOLLWAKEUP, endpoint);
+	SlotMap<IEndpoint>::Handle_t handle = m_endpoints.Insert(endpoint);
+	endpoint->SetSlot(SlotMap<IEndpoint>::GetSlot(handle));
+
+	try
+	{
+		GetEvents(endpoint).DoOp(EPOLL_CTL_ADD, ENDPOINT_EVENTS, endpoint->Get(), handle);
+	}
+	catch (...)
+	{
+		m_endpoints.Remove(endpoint->GetSlot());
+		throw;
+	}
 }
 
 void IoManager::Unbind(IEndpoint* endpoint)
@@ -132,11 +326,293 @@ void IoManager::Unbind(IEndpoint* endpoint)
     // Since Linux 2.6.9, event can be specified as NULL when using
     // EPOLL_CTL_DEL.  Applications that need to be portable to kernels
     // before 2.6.9 should specify a non-null pointer in event.
-	m_ewr.DoOp(EPOLL_CTL_DEL, EPOLLET | EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLEXCLUSIVE | EPOLLWAKEUP, endpoint);
+	GetEvents(endpoint).DoOp(EPOLL_CTL_DEL, 0, endpoint->Get());
+	Forget(endpoint);
+}
+
+void IoManager::Forget(IEndpoint* endpoint)
+{
+	// Descriptor is registered in a single epoll and is never duplicated,
+	// so closing it drops the registration.
+	// Events of the endpoint already taken by other threads become stale.
+	// Timers are expired under the same lock, so none of them gets to
+	// the endpoint once it's unbound.
+	boost::mutex::scoped_lock lock(m_timerLock);
+	m_endpoints.Remove(endpoint->GetSlot());
+
+	if (TimerNode* timer = endpoint->GetTimer())
+	{
+		timer->m_deadline.store(0);
+		timer->m_filed.store(0);
+	}
+}
+
+void IoManager::ArmTimer(IEndpoint* endpoint, size_t timeout)
+{
+	SetDeadline(endpoint, ToDeadline(GetTick(), timeout));
+}
+
+void IoManager::CapTimer(IEndpoint* endpoint, size_t timeout)
+{
+	uint32_t deadline = ToDeadline(GetTick(), timeout);
+	uint32_t current = endpoint->GetTimer()->m_deadline.load();
+	if (current && IsBefore(current, deadline)) return;
+
+	SetDeadline(endpoint, deadline);
+}
+
+void IoManager::CancelTimer(IEndpoint* endpoint)
+{
+	// Filed timer is dropped as the wheel reaches it.
+	endpoint->GetTimer()->m_deadline.store(0);
+}
+
+uint32_t IoManager::GetTick()
+{
+	return s_tick ? s_tick : ReadTick();
+}
+
+void IoManager::SetDeadline(IEndpoint* endpoint, uint32_t deadline)
+{
+	TimerNode* timer = endpoint->GetTimer();
+	timer->m_deadline.store(deadline);
+
+	// Timer moved later is seen by the wheel as it comes up, no need to lock.
+	uint32_t filed = timer->m_filed.load();
+	if (filed && !IsBefore(deadline, filed)) return;
+
+	boost::mutex::scoped_lock lock(m_timerLock);
+	filed = timer->m_filed.load();
+	if (filed && !IsBefore(deadline, filed)) return;
+
+	if (m_timers.IsEmpty())
+	{
+		m_timers.Restart(GetTick());
+		m_ticker.Start();
+	}
+
+	// Timer filed earlier makes the previous filing stale.
+	timer->m_filed.store(deadline);
+	m_timers.File(m_endpoints.GetHandle(endpoint->GetSlot()), deadline);
+}
+
+void IoManager::OnTick()
+{
+	boost::mutex::scoped_lock lock(m_timerLock);
+
+	m_timers.Advance(GetTick(), [this](SlotMap<IEndpoint>::Handle_t handle, uint32_t due, uint32_t tick)
+	{
+		Expire(handle, due, tick);
+	});
+
+	if (m_timers.IsEmpty()) m_ticker.Stop();
+}
+
+void IoManager::Expire(SlotMap<IEndpoint>::Handle_t handle, uint32_t due, uint32_t tick)
+{
+	// Endpoint might have been unbound meanwhile.
+	IEndpoint* endpoint = m_endpoints.Find(handle);
+	if (!endpoint) return;
+
+	// Timer has been filed again to come up earlier.
+	TimerNode* timer = endpoint->GetTimer();
+	if (timer->m_filed.load() != due) return;
+	timer->m_filed.store(0);
+
+	uint32_t deadline = timer->m_deadline.load();
+	do
+	{
+		// Cancelled.
+		if (!deadline) return;
+
+		// Moved later, file it for the new deadline.
+		if (IsBefore(tick, deadline))
+		{
+			timer->m_filed.store(deadline);
+			m_timers.File(handle, deadline);
+			return;
+		}
+	}
+	while (!timer->m_deadline.compare_exchange_weak(deadline, 0));
+
+	size_t timeout = m_timerCallback ? m_timerCallback(endpoint) : 0;
+	if (!timeout) return;
+
+	// Armed again, e.g. for the next ping.
+	deadline = ToDeadline(tick, timeout);
+	timer->m_deadline.store(deadline);
+	timer->m_filed.store(deadline);
+	m_timers.File(handle, deadline);
+}
+
+void IoManager::Defer(IEndpoint* endpoint)
+{
+	boost::mutex::scoped_lock lock(m_deferredLock);
+	m_deferred.push_back(m_endpoints.GetHandle(endpoint->GetSlot()));
+}
+
+void IoManager::ResumeDeferred()
+{
+	std::vector<SlotMap<IEndpoint>::Handle_t> deferred;
+	{
+		boost::mutex::scoped_lock lock(m_deferredLock);
+		deferred.swap(m_deferred);
+	}
+
+	for (auto handle : deferred)
+	{
+		// Endpoint might have been unbound meanwhile.
+		IEndpoint* endpoint = m_endpoints.Find(handle);
+		if (!endpoint) continue;
+
+		// Modification makes epoll check readiness again as if the endpoint
+		// were just added. Descriptor closed in between is nothing to resume.
+		epoll_event ev;
+		ev.events = GetInterest(endpoint);
+		ev.data.u64 = handle;
+		epoll_ctl(IsInLane(endpoint) ? m_laneFd : m_fd, EPOLL_CTL_MOD, endpoint->Get(), &ev);
+	}
+}
+
+void IoManager::PauseInput(IEndpoint* endpoint)
+{
+	GetEvents(endpoint).DoOp(EPOLL_CTL_MOD, GetInterest(endpoint) & ~EPOLLIN, endpoint->Get(), m_endpoints.GetHandle(endpoint->GetSlot()));
+}
+
+void IoManager::Rearm(IEndpoint* endpoint)
+{
+	GetEvents(endpoint).DoOp(EPOLL_CTL_MOD, GetInterest(endpoint), endpoint->Get(), m_endpoints.GetHandle(endpoint->GetSlot()));
+}
+
+uint32_t IoManager::GetInterest(IEndpoint* endpoint)
+{
+	return OutputBacklog::IsEmpty(endpoint->Get()) ? ENDPOINT_EVENTS : ENDPOINT_EVENTS | EPOLLOUT;
+}
+
+void IoManager::EnableLane()
+{
+	if (m_laneFd >= 0) return;
+
+	m_laneFd = epoll_create1(0);
+	if (m_laneFd < 0) throw SystemException(errno);
+
+	m_laneEwr.Set(m_laneFd);
+	m_laneRunning.store(true, boost::memory_order_relaxed);
+}
+
+void IoManager::SetServiceClass(IEndpoint* endpoint, uint8_t serviceClass)
+{
+	// Timers rearm endpoints under the same lock, so they don't see
+	// endpoint of one epoll and class of another.
+	boost::mutex::scoped_lock lock(m_timerLock);
+
+	bool inLane = IsInLane(endpoint);
+	bool toLane = m_laneFd >= 0 && serviceClass == TOP_SERVICE_CLASS;
+	if (inLane != toLane) GetEvents(endpoint).DoOp(EPOLL_CTL_DEL, 0, endpoint->Get());
+
+	endpoint->SetServiceClass(serviceClass);
+
+	// Being added makes epoll report input which is already there.
+	if (inLane != toLane)
+		GetEvents(endpoint).DoOp(EPOLL_CTL_ADD, GetInterest(endpoint), endpoint->Get(), m_endpoints.GetHandle(endpoint->GetSlot()));
+}
+
+void IoManager::UpdateLoad(size_t readyCount, size_t busyTime)
+{
+	// Exponential moving averages, racing updates of threads just lose a sample.
+	size_t lag = m_lag.load(boost::memory_order_relaxed);
+	m_lag.store(lag - lag / LOAD_SMOOTHING + busyTime, boost::memory_order_relaxed);
+
+	size_t depth = m_queueDepth.load(boost::memory_order_relaxed);
+	m_queueDepth.store(depth - depth / LOAD_SMOOTHING + readyCount, boost::memory_order_relaxed);
+}
+
+IoManager::LoopStats& IoManager::AddLoop(const char* role)
+{
+	boost::mutex::scoped_lock lock(m_loopsLock);
+	std::string label = "loop=\"" + m_name + "\",thread=\"" + std::to_string(m_loops.size()) +
+		"\",role=\"" + role + "\"";
+
+	// Entries of deque stay in place as more threads add theirs.
+	m_loops.emplace_back();
+	LoopStats& loop = m_loops.back();
+	Metrics::Register("loop_wakeups_total", label, "Times event loop thread has woken up with work.", loop.m_wakeups);
+	Metrics::Register("loop_events_total", label, "Events taken by event loop thread.", loop.m_events);
+	Metrics::Register("loop_busy_us_total", label, "Time event loop thread has spent handling events.", loop.m_busyTime);
+	Metrics::Register("loop_wait_us_total", label, "Time event loop thread has spent waiting for events.", loop.m_waitTime);
+	Metrics::Register("loop_stalls_total", label, "Times event loop thread hasn't got back to waiting within threshold.", loop.m_stalls);
+
+	// Unwinder is loaded lazily, which mustn't happen in a signal handler.
+	void* frame;
+	backtrace(&frame, 1);
+	return loop;
+}
+
+void IoManager::StartWatchdog(size_t threshold)
+{
+	if (!threshold || m_watchdog.joinable()) return;
+
+	struct sigaction action = {};
+	action.sa_handler = &OnStackSample;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	if (sigaction(GetSampleSignal(), &action, nullptr) < 0) throw SystemException(errno);
+
+	m_watchdog = boost::thread(&IoManager::Watch, this, threshold);
+}
+
+void IoManager::StopWatchdog()
+{
+	if (!m_watchdog.joinable()) return;
+
+	m_watchdog.interrupt();
+	m_watchdog.join();
+}
+
+void IoManager::Watch(size_t threshold)
+{
+	// Stall is noticed within a quarter of threshold past it.
+	boost::posix_time::milliseconds period(std::max<size_t>(threshold / 4, 1));
+	uint64_t limit = static_cast<uint64_t>(threshold) * 1000;
+
+	try
+	{
+		for (;;)
+		{
+			boost::this_thread::sleep(period);
+
+			boost::mutex::scoped_lock lock(m_loopsLock);
+			uint64_t now = ReadMicroseconds(CLOCK_MONOTONIC);
+			for (size_t i = 0; i < m_loops.size(); ++i)
+			{
+				LoopStats& loop = m_loops[i];
+				uint64_t since = loop.m_busySince.load(boost::memory_order_relaxed);
+				if (!since || since == loop.m_reported || now < since + limit) continue;
+
+				loop.m_reported = since;
+				loop.m_stalls.Add();
+				int fd = loop.m_fd.load(boost::memory_order_relaxed);
+				LOG_WARNING("Event loop {} thread {} is stalled for {} ms, endpoint {} taking its turn.",
+					m_name, i, (now - since) / 1000, fd);
+
+				std::vector<std::string> stack = SampleStack(loop.m_thread);
+				if (stack.empty()) LOG_WARNING("Stack of event loop {} thread {} isn't sampled.", m_name, i);
+				for (const std::string& frame : stack) LOG_WARNING("    {}", frame);
+			}
+		}
+	}
+	catch (const boost::thread_interrupted&)
+	{
+		// Stop requested.
+	}
 }
 
 void IoManager::Stop()
 {
+	// Loop threads are about to exit, they mustn't be signalled then.
+	StopWatchdog();
+	StopLane();
+
 	size_t expected = 0;
 	if (m_threadCount.compare_exchange_strong(expected, 0, boost::memory_order_relaxed))
 		return;
@@ -152,27 +628,191 @@ void IoManager::Stop()
 
 void IoManager::Run()
 {
+	LoopStats& loop = AddLoop("event");
+	// Waiting starts as the previous wakeup ends, the clock isn't read again.
+	uint64_t waitStart = ReadMicroseconds(CLOCK_MONOTONIC);
+
     for (;;)
     {
 		boost::array<epoll_event, MAX_ENDPOINTS> events;
-        int readyCount = epoll_wait(m_fd, events.data(), MAX_ENDPOINTS, -1);
+		// Endpoints with input left don't wait for new events to come.
+        int readyCount = epoll_wait(m_fd, events.data(), MAX_ENDPOINTS, s_ready.empty() ? -1 : 0);
 		if (readyCount < 0)
 		{
 			if (errno == EINTR) continue;
 			else throw SystemException(errno);
 		}
 
-        for (int i = 0; i < readyCount; ++i)
-        {
-			// Asynchronous operation occurred on endpoint needed to complete.
-			IEndpoint* e = reinterpret_cast<IEndpoint*>(events[i].data.ptr);
-			if(!e->Complete())
-			{
-				m_threadCount.fetch_sub(1, boost::memory_order_relaxed);
-				return;
-			}
-        }
+		// Whatever this iteration does takes the same time.
+		uint64_t start = ReadMicroseconds(CLOCK_MONOTONIC);
+		s_tick = ToTick(start);
+		loop.m_busySince.store(start, boost::memory_order_relaxed);
+		TcpInfo::Renew();
+
+		size_t waitTime = start - waitStart;
+		m_waitTime.Record(waitTime);
+		loop.m_waitTime.Add(waitTime);
+		PROBE2(wakeup, readyCount, waitTime);
+
+		if (!Dispatch(events.data(), readyCount, start, loop)) return;
+		Revisit(loop);
+
+		waitStart = ReadMicroseconds(CLOCK_MONOTONIC);
+		UpdateLoad(readyCount, waitStart - start);
+		Account(loop, readyCount, start, waitStart);
     }
 }
 
+void IoManager::RunLane()
+{
+	boost::array<epoll_event, LANE_BATCH> events;
+	// Polls finding nothing aren't counted as wakeups.
+	LoopStats& loop = AddLoop("lane");
+
+	while (m_laneRunning.load(boost::memory_order_relaxed))
+	{
+		// Busy polling, thread is never put to sleep and woken up.
+		int readyCount = epoll_wait(m_laneFd, events.data(), LANE_BATCH, 0);
+		if (readyCount < 0)
+		{
+			if (errno != EINTR) throw SystemException(errno);
+			continue;
+		}
+		if (!readyCount && s_ready.empty()) continue;
+
+		uint64_t start = ReadMicroseconds(CLOCK_MONOTONIC);
+		s_tick = ToTick(start);
+		loop.m_busySince.store(start, boost::memory_order_relaxed);
+		TcpInfo::Renew();
+		Dispatch(events.data(), readyCount, start, loop);
+		Revisit(loop);
+
+		Account(loop, readyCount, start, ReadMicroseconds(CLOCK_MONOTONIC));
+	}
+}
+
+void IoManager::Account(LoopStats& loop, size_t readyCount, uint64_t start, uint64_t end)
+{
+	loop.m_busySince.store(0, boost::memory_order_relaxed);
+	loop.m_fd.store(-1, boost::memory_order_relaxed);
+
+	loop.m_wakeups.Add();
+	loop.m_events.Add(readyCount);
+	loop.m_busyTime.Add(end - start);
+	m_busyTime.Record(end - start);
+	m_batchSize.Record(readyCount);
+}
+
+bool IoManager::Dispatch(const epoll_event* events, size_t readyCount, uint64_t start, LoopStats& loop)
+{
+	// Events are put in order of class by counting sort, order of events
+	// of the same class is kept. It's skipped if all of them are of the
+	// default class. Endpoint looked up here is only a hint, it might be
+	// unbound meanwhile.
+	static thread_local std::vector<uint8_t> classes;
+	static thread_local std::vector<uint32_t> order;
+	classes.resize(readyCount);
+
+	std::array<size_t, SERVICE_CLASS_COUNT + 1> counts = {};
+	for (size_t i = 0; i < readyCount; ++i)
+	{
+		IEndpoint* e = m_endpoints.Find(events[i].data.u64);
+		classes[i] = e ? e->GetServiceClass() : 0;
+		++counts[TOP_SERVICE_CLASS - classes[i] + 1];
+	}
+
+	bool sorted = counts[SERVICE_CLASS_COUNT] != readyCount;
+	if (sorted)
+	{
+		for (size_t c = 1; c <= SERVICE_CLASS_COUNT; ++c) counts[c] += counts[c - 1];
+
+		order.resize(readyCount);
+		for (size_t i = 0; i < readyCount; ++i)
+			order[counts[TOP_SERVICE_CLASS - classes[i]]++] = static_cast<uint32_t>(i);
+	}
+
+	// Turn of an endpoint is taken till the previous one ended, which
+	// covers events skipped in between but saves reading the clock twice.
+	uint64_t previous = start;
+	for (size_t n = 0; n < readyCount; ++n)
+	{
+		size_t i = sorted ? order[n] : n;
+		SlotMap<IEndpoint>::Handle_t handle = events[i].data.u64;
+
+		// Exit signal is passed from thread to thread, it's never held by one.
+		if (SlotMap<IEndpoint>::GetSlot(handle) == m_exiter.GetSlot())
+		{
+			m_exiter.Complete();
+			m_threadCount.fetch_sub(1, boost::memory_order_relaxed);
+			loop.m_busySince.store(0, boost::memory_order_relaxed);
+			return false;
+		}
+
+		// Endpoint might have been unbound after the event was taken,
+		// or be handled by another thread which then takes this event too.
+		IEndpoint* e = m_endpoints.Acquire(handle);
+		if (!e) continue;
+
+		// Asynchronous operation occurred on endpoint needed to complete.
+		// Endpoint might be gone once handled, e.g. closed by itself.
+		int fd = e->Get();
+		loop.m_fd.store(fd, boost::memory_order_relaxed);
+		Metrics::StartTurn(start);
+		Handle(handle, e);
+
+		uint64_t now = ReadMicroseconds(CLOCK_MONOTONIC);
+		m_latency[classes[i]].Record(now - start);
+		m_handlerTime.Record(now - previous);
+		PROBE4(dispatch, fd, classes[i], now - start, now - previous);
+		previous = now;
+	}
+
+	return true;
+}
+
+bool IoManager::Handle(SlotMap<IEndpoint>::Handle_t handle, IEndpoint* endpoint)
+{
+	// Events coming during the turn are covered by input left over,
+	// they don't earn the endpoint another turn right away.
+	IoBudget::Renew();
+	bool left = endpoint->Complete();
+	while (m_endpoints.Release(handle))
+	{
+		if (left) continue;
+
+		IoBudget::Renew();
+		left = endpoint->Complete();
+	}
+
+	if (left)
+	{
+		s_ready.push_back(handle);
+		m_exhausted.Add();
+	}
+	return left;
+}
+
+void IoManager::Revisit(LoopStats& loop)
+{
+	// Endpoints queued during this round wait for the next one,
+	// so that new events are taken in between.
+	for (size_t n = s_ready.size(); n; --n)
+	{
+		SlotMap<IEndpoint>::Handle_t handle = s_ready.front();
+		s_ready.pop_front();
+
+		// Endpoint might have been unbound meanwhile, or be handled by
+		// another thread which has got an event for it.
+		IEndpoint* e = m_endpoints.Acquire(handle);
+		if (!e) continue;
+
+		m_revisits.Add();
+		loop.m_fd.store(e->Get(), boost::memory_order_relaxed);
+		uint64_t start = ReadMicroseconds(CLOCK_MONOTONIC);
+		Metrics::StartTurn(start);
+		Handle(handle, e);
+		m_handlerTime.Record(ReadMicroseconds(CLOCK_MONOTONIC) - start);
+	}
+}
+
 #endif // _WIN64
\ No newline at end of file
@@ -0,0 +1,157 @@
+#include "System/MemoryGovernor.h"
+
+namespace
+{
+
+// Budget usage, in percent, at which each stage starts.
+const size_t SHRINK_USAGE = 80;
+const size_t THROTTLE_USAGE = 90;
+const size_t SHED_USAGE = 100;
+
+// Share of time in percent, averaged over 10 seconds, when some or all
+// tasks were stalled on memory, at which each stage starts.
+const double SHRINK_SOME_PRESSURE = 10.0;
+const double THROTTLE_SOME_PRESSURE = 25.0;
+const double THROTTLE_FULL_PRESSURE = 5.0;
+const double SHED_FULL_PRESSURE = 20.0;
+
+struct Governor
+{
+	std::array<boost::atomic<size_t>, MemoryGovernor::categoryCount> m_usage;
+	boost::atomic<int> m_stage;
+	MemoryBudgetPolicy m_policy;
+	MemoryGovernor::StageCallback_t m_callback;
+	boost::thread m_thread;
+
+	Governor() : m_stage(MemoryGovernor::normal)
+	{
+		for (auto& usage : m_usage) usage.store(0, boost::memory_order_relaxed);
+	}
+};
+
+Governor s_governor;
+
+struct Pressure
+{
+	double m_some;
+	double m_full;
+};
+
+// Pressure stall information, all zeroes where kernel doesn't provide it.
+Pressure ReadPressure()
+{
+	Pressure pressure = {};
+
+#if defined(__linux__)
+	FILE* file = fopen("/proc/pressure/memory", "r");
+	if (!file) return pressure;
+
+	char kind[8];
+	double avg10 = 0;
+	while (fscanf(file, "%7s avg10=%lf %*[^\n]", kind, &avg10) == 2)
+	{
+		if (!strcmp(kind, "some")) pressure.m_some = avg10;
+		else if (!strcmp(kind, "full")) pressure.m_full = avg10;
+	}
+
+	fclose(file);
+#endif // __linux__
+
+	return pressure;
+}
+
+MemoryGovernor::Stage Evaluate()
+{
+	size_t usage = 0;
+	for (size_t i = 0; i < MemoryGovernor::categoryCount; ++i)
+		usage += s_governor.m_usage[i].load(boost::memory_order_relaxed);
+
+	size_t budget = s_governor.m_policy.m_budget;
+	size_t percent = budget ? usage * 100 / budget : 0;
+	Pressure pressure = s_governor.m_policy.m_pressure ? ReadPressure() : Pressure();
+
+	if (percent >= SHED_USAGE || pressure.m_full >= SHED_FULL_PRESSURE)
+		return MemoryGovernor::shed;
+	if (percent >= THROTTLE_USAGE || pressure.m_some >= THROTTLE_SOME_PRESSURE || pressure.m_full >= THROTTLE_FULL_PRESSURE)
+		return MemoryGovernor::throttle;
+	if (percent >= SHRINK_USAGE || pressure.m_some >= SHRINK_SOME_PRESSURE)
+		return MemoryGovernor::shrink;
+
+	return MemoryGovernor::normal;
+}
+
+void Sample()
+{
+	boost::posix_time::milliseconds interval(s_governor.m_policy.m_interval);
+	int current = MemoryGovernor::normal;
+
+	try
+	{
+		for (;;)
+		{
+			MemoryGovernor::Stage stage = Evaluate();
+			s_governor.m_stage.store(stage, boost::memory_order_relaxed);
+
+			if (stage != current)
+			{
+				current = stage;
+				if (s_governor.m_callback) s_governor.m_callback(stage);
+			}
+
+			boost::this_thread::sleep(interval);
+		}
+	}
+	catch (const boost::thread_interrupted&)
+	{
+		// Stop requested.
+	}
+}
+
+} // namespace
+
+void MemoryGovernor::Start(const MemoryBudgetPolicy& policy, StageCallback_t&& callback)
+{
+	if (!policy.IsEnabled()) return;
+
+	s_governor.m_policy = policy;
+	s_governor.m_callback = std::forward<StageCallback_t>(callback);
+	s_governor.m_thread = boost::thread(&Sample);
+}
+
+void MemoryGovernor::Stop()
+{
+	if (!s_governor.m_thread.joinable()) return;
+
+	s_governor.m_thread.interrupt();
+	s_governor.m_thread.join();
+	s_governor.m_callback.clear();
+	s_governor.m_policy = MemoryBudgetPolicy();
+	s_governor.m_stage.store(normal, boost::memory_order_relaxed);
+}
+
+void MemoryGovernor::Charge(Category category, size_t size)
+{
+	s_governor.m_usage[category].fetch_add(size, boost::memory_order_relaxed);
+}
+
+void MemoryGovernor::Discharge(Category category, size_t size)
+{
+	s_governor.m_usage[category].fetch_sub(size, boost::memory_order_relaxed);
+}
+
+size_t MemoryGovernor::GetUsage(Category category)
+{
+	return s_governor.m_usage[category].load(boost::memory_order_relaxed);
+}
+
+MemoryGovernor::Stage MemoryGovernor::GetStage()
+{
+	return static_cast<Stage>(s_governor.m_stage.load(boost::memory_order_relaxed));
+}
+
+void MemoryGovernor::OnAllocationFailure()
+{
+	// Nobody would bring the stage back to normal.
+	if (!s_governor.m_policy.IsEnabled()) return;
+	s_governor.m_stage.store(shed, boost::memory_order_relaxed);
+}
@@ -0,0 +1,127 @@
+#include "System/OutputBacklog.h"
+#include "System/Exception.h"
+#include "System/IoBudget.h"
+#include "System/MemoryGovernor.h"
+#include "Metrics.h"
+
+namespace
+{
+
+using Slot_t = boost::atomic<std::string*>;
+
+enum LingerState : uint8_t
+{
+	none,
+	lingering,
+	// Some of the backlog has been written since progress was asked last.
+	progressed
+};
+
+// Set once at startup, before IO threads start.
+boost::scoped_array<Slot_t> s_slots;
+boost::scoped_array<boost::atomic<uint8_t>> s_lingering;
+size_t s_slotCount = 0;
+
+} // namespace
+
+void OutputBacklog::Init()
+{
+	if (s_slotCount) return;
+
+	rlimit limit = {};
+	if (getrlimit(RLIMIT_NOFILE, &limit) < 0) throw SystemException(errno);
+
+	// Pointer per descriptor, backlogs themselves are rare.
+	size_t count = limit.rlim_cur == RLIM_INFINITY ? 0xffff : limit.rlim_cur;
+	s_slots.reset(new Slot_t[count]);
+	s_lingering.reset(new boost::atomic<uint8_t>[count]);
+	for (size_t i = 0; i < count; ++i)
+	{
+		s_slots[i].store(nullptr, boost::memory_order_relaxed);
+		s_lingering[i].store(none, boost::memory_order_relaxed);
+	}
+	s_slotCount = count;
+}
+
+bool OutputBacklog::IsEmpty(int fd)
+{
+	return static_cast<size_t>(fd) >= s_slotCount || !s_slots[fd].load(boost::memory_order_relaxed);
+}
+
+bool OutputBacklog::Keep(int fd, const char* data, size_t size)
+{
+	if (static_cast<size_t>(fd) >= s_slotCount) return false;
+
+	std::string* backlog = s_slots[fd].load(boost::memory_order_relaxed);
+	if (!backlog)
+	{
+		backlog = new std::string();
+		s_slots[fd].store(backlog, boost::memory_order_relaxed);
+	}
+
+	backlog->append(data, size);
+	MemoryGovernor::Charge(MemoryGovernor::buffers, size);
+	return true;
+}
+
+bool OutputBacklog::Flush(int fd)
+{
+	if (IsEmpty(fd)) return true;
+
+	std::string* backlog = s_slots[fd].load(boost::memory_order_relaxed);
+	int bytesWritten = send(fd, backlog->data(), backlog->size(), MSG_NOSIGNAL);
+	if (bytesWritten < 0)
+	{
+		if (errno == EAGAIN) return false;
+
+		// Peer is gone, whoever reads from it next finds that out.
+		Metrics::CountError(errno);
+		Drop(fd);
+		return true;
+	}
+
+	IoBudget::Charge(bytesWritten);
+	Metrics::Get().m_bytesOut.Add(bytesWritten);
+	MemoryGovernor::Discharge(MemoryGovernor::buffers, bytesWritten);
+	backlog->erase(0, bytesWritten);
+	if (bytesWritten && s_lingering[fd].load(boost::memory_order_relaxed) == lingering)
+		s_lingering[fd].store(progressed, boost::memory_order_relaxed);
+	if (!backlog->empty()) return false;
+
+	Drop(fd);
+	return true;
+}
+
+void OutputBacklog::Drop(int fd)
+{
+	if (IsEmpty(fd)) return;
+
+	std::string* backlog = s_slots[fd].exchange(nullptr, boost::memory_order_relaxed);
+	MemoryGovernor::Discharge(MemoryGovernor::buffers, backlog->size());
+	delete backlog;
+}
+
+void OutputBacklog::Linger(int fd)
+{
+	if (static_cast<size_t>(fd) < s_slotCount) s_lingering[fd].store(lingering, boost::memory_order_relaxed);
+}
+
+bool OutputBacklog::IsLingering(int fd)
+{
+	return static_cast<size_t>(fd) < s_slotCount && s_lingering[fd].load(boost::memory_order_relaxed) != none;
+}
+
+bool OutputBacklog::HasProgressed(int fd)
+{
+	if (static_cast<size_t>(fd) >= s_slotCount) return false;
+
+	// Mark of descriptor forgotten meanwhile stays clear.
+	uint8_t expected = progressed;
+	return s_lingering[fd].compare_exchange_strong(expected, lingering, boost::memory_order_relaxed);
+}
+
+void OutputBacklog::Forget(int fd)
+{
+	Drop(fd);
+	if (static_cast<size_t>(fd) < s_slotCount) s_lingering[fd].store(none, boost::memory_order_relaxed);
+}
@@ -0,0 +1,142 @@
+#include "System/PoolMemory.h"
+#include "System/Exception.h"
+
+namespace
+{
+
+struct Region
+{
+	char* m_begin;
+	size_t m_size;
+	boost::atomic<size_t> m_used;
+	PoolMemory::Backing m_backing;
+	bool m_locked;
+
+	Region() : m_begin(nullptr), m_size(0), m_used(0), m_backing(PoolMemory::none), m_locked(false) {}
+};
+
+Region s_region;
+
+#if defined(__linux__)
+
+const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+const size_t SMALL_PAGE_SIZE = 4096;
+
+// Map region aligned to huge page so that transparent huge pages can back all of it.
+char* MapAligned(size_t size)
+{
+	const int prot = PROT_READ | PROT_WRITE;
+	const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+	void* raw = mmap(nullptr, size + HUGE_PAGE_SIZE, prot, flags, -1, 0);
+	if (raw == MAP_FAILED) throw SystemException(errno);
+
+	uintptr_t begin = reinterpret_cast<uintptr_t>(raw);
+	uintptr_t aligned = (begin + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+
+	// Trim the parts outside of aligned region.
+	if (aligned > begin) munmap(raw, aligned - begin);
+	size_t tail = begin + size + HUGE_PAGE_SIZE - (aligned + size);
+	if (tail) munmap(reinterpret_cast<void*>(aligned + size), tail);
+
+	return reinterpret_cast<char*>(aligned);
+}
+
+void Reserve(const PoolMemoryPolicy& policy)
+{
+	size_t size = (policy.m_size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+	const int prot = PROT_READ | PROT_WRITE;
+	const int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE;
+
+	char* begin = nullptr;
+	PoolMemory::Backing backing = PoolMemory::smallPages;
+
+	if (policy.m_hugePages)
+	{
+		// Pages reserved by administrator, see /proc/sys/vm/nr_hugepages.
+		void* p = mmap(nullptr, size, prot, flags | MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED)
+		{
+			begin = static_cast<char*>(p);
+			backing = PoolMemory::hugePages;
+		}
+		else
+		{
+			begin = MapAligned(size);
+			if (!madvise(begin, size, MADV_HUGEPAGE)) backing = PoolMemory::transparentHugePages;
+
+			// Fault pages in only after the advice, otherwise they're small.
+			for (size_t offset = 0; offset < size; offset += SMALL_PAGE_SIZE)
+				begin[offset] = 0;
+		}
+	}
+	else
+	{
+		void* p = mmap(nullptr, size, prot, flags, -1, 0);
+		if (p == MAP_FAILED) throw SystemException(errno);
+		begin = static_cast<char*>(p);
+	}
+
+	// Not being allowed to lock, e.g. by RLIMIT_MEMLOCK, isn't fatal.
+	if (policy.m_lock) s_region.m_locked = !mlock(begin, size);
+
+	s_region.m_begin = begin;
+	s_region.m_size = size;
+	s_region.m_backing = backing;
+}
+
+#elif defined(_WIN64)
+
+void Reserve(const PoolMemoryPolicy&)
+{
+	// Pools use ordinary heap.
+}
+
+#endif // __linux__
+
+} // namespace
+
+void PoolMemory::Init(const PoolMemoryPolicy& policy)
+{
+	assert(!s_region.m_begin);
+	if (!policy.m_size) return;
+
+	Reserve(policy);
+}
+
+void* PoolMemory::Allocate(size_t size, size_t alignment)
+{
+	if (!s_region.m_begin) return nullptr;
+
+	size_t used = s_region.m_used.load(boost::memory_order_relaxed);
+	for (;;)
+	{
+		size_t offset = (used + alignment - 1) & ~(alignment - 1);
+		if (offset + size > s_region.m_size) return nullptr;
+
+		if (s_region.m_used.compare_exchange_weak(used, offset + size, boost::memory_order_relaxed))
+			return s_region.m_begin + offset;
+	}
+}
+
+bool PoolMemory::Owns(const void* p)
+{
+	const char* c = static_cast<const char*>(p);
+	return c >= s_region.m_begin && c < s_region.m_begin + s_region.m_size;
+}
+
+PoolMemory::Backing PoolMemory::GetBacking()
+{
+	return s_region.m_backing;
+}
+
+const char* PoolMemory::GetBackingName()
+{
+	static const char* names[] = { "heap", "small pages", "transparent huge pages", "huge pages" };
+	return names[s_region.m_backing];
+}
+
+bool PoolMemory::IsLocked()
+{
+	return s_region.m_locked;
+}
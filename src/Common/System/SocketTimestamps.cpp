@@ -0,0 +1,185 @@
+#include "System/SocketTimestamps.h"
+#include "System/Exception.h"
+#include "Metrics.h"
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <netinet/in.h>
+
+#if defined(__linux__)
+
+namespace
+{
+
+struct Delays
+{
+	LatencyStats m_queued;
+	LatencyStats m_transmit;
+};
+
+// Set once at startup, before IO threads start. Time the write awaiting
+// transmit timestamp has been made at, per descriptor, zero if there's none.
+boost::scoped_array<uint64_t> s_written;
+size_t s_slotCount = 0;
+Delays s_delays;
+
+// Software timestamps are of the real time clock.
+uint64_t ToMicroseconds(const timespec& time)
+{
+	return static_cast<uint64_t>(time.tv_sec) * 1000000 + time.tv_nsec / 1000;
+}
+
+uint64_t ReadMicroseconds()
+{
+	timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return ToMicroseconds(now);
+}
+
+const timespec* FindTimestamp(msghdr& msg)
+{
+	for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+	{
+		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_TIMESTAMPING) continue;
+
+		const scm_timestamping* stamps = reinterpret_cast<const scm_timestamping*>(CMSG_DATA(cmsg));
+		return stamps->ts[0].tv_sec || stamps->ts[0].tv_nsec ? &stamps->ts[0] : nullptr;
+	}
+	return nullptr;
+}
+
+bool IsTransmitted(msghdr& msg)
+{
+	for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+	{
+		if (!(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR) &&
+			!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)) continue;
+
+		const sock_extended_err* error = reinterpret_cast<const sock_extended_err*>(CMSG_DATA(cmsg));
+		return error->ee_errno == ENOMSG && error->ee_origin == SO_EE_ORIGIN_TIMESTAMPING &&
+			error->ee_info == SCM_TSTAMP_SND;
+	}
+	return false;
+}
+
+} // namespace
+
+void SocketTimestamps::Init(bool enabled)
+{
+	if (!enabled || s_slotCount) return;
+
+	rlimit limit = {};
+	if (getrlimit(RLIMIT_NOFILE, &limit) < 0) throw SystemException(errno);
+
+	size_t count = limit.rlim_cur == RLIM_INFINITY ? 0xffff : limit.rlim_cur;
+	s_written.reset(new uint64_t[count]());
+	s_slotCount = count;
+
+	Metrics::Register("socket_queued_us", "", "Time input has waited in socket since the kernel got it till it's read.", s_delays.m_queued);
+	Metrics::Register("socket_transmit_us", "", "Time since output has been written till the kernel passed it to the device.", s_delays.m_transmit);
+}
+
+void SocketTimestamps::Shutdown()
+{
+	if (!s_slotCount) return;
+
+	Metrics::Unregister(&s_delays.m_queued);
+	Metrics::Unregister(&s_delays.m_transmit);
+}
+
+bool SocketTimestamps::IsEnabled()
+{
+	return s_slotCount != 0;
+}
+
+void SocketTimestamps::Enable(int fd)
+{
+	if (static_cast<size_t>(fd) >= s_slotCount) return;
+
+	// Receive timestamps are taken for all input, transmit ones only for
+	// writes asking for them. Data isn't looped back with them. Connection
+	// works the same without them, it just isn't timed.
+	int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_TSONLY;
+	if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0) Metrics::CountError(errno);
+	s_written[fd] = 0;
+}
+
+ssize_t SocketTimestamps::Read(int fd, char* buffer, size_t size)
+{
+	if (static_cast<size_t>(fd) >= s_slotCount) return read(fd, buffer, size);
+
+	iovec data = { buffer, size };
+	char control[CMSG_SPACE(sizeof(scm_timestamping))];
+	msghdr msg = {};
+	msg.msg_iov = &data;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	ssize_t res = recvmsg(fd, &msg, 0);
+	if (res <= 0) return res;
+
+	// Timestamp is of the last segment read, input has been read as soon as it's here.
+	if (const timespec* arrived = FindTimestamp(msg))
+	{
+		uint64_t now = ReadMicroseconds();
+		uint64_t time = ToMicroseconds(*arrived);
+		s_delays.m_queued.Record(now > time ? now - time : 0);
+	}
+	return res;
+}
+
+ssize_t SocketTimestamps::Write(int fd, const char* data, size_t size)
+{
+	if (static_cast<size_t>(fd) >= s_slotCount || s_written[fd]) return send(fd, data, size, MSG_NOSIGNAL);
+
+	iovec iov = { const_cast<char*>(data), size };
+	char control[CMSG_SPACE(sizeof(uint32_t))] = {};
+	msghdr msg = {};
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SO_TIMESTAMPING;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(uint32_t));
+	*reinterpret_cast<uint32_t*>(CMSG_DATA(cmsg)) = SOF_TIMESTAMPING_TX_SOFTWARE;
+
+	uint64_t now = ReadMicroseconds();
+	ssize_t res = sendmsg(fd, &msg, MSG_NOSIGNAL);
+	if (res <= 0) return res;
+
+	// Device of loopback takes output right away, its timestamp is there already.
+	s_written[fd] = now;
+	Collect(fd);
+	return res;
+}
+
+void SocketTimestamps::Collect(int fd)
+{
+	if (static_cast<size_t>(fd) >= s_slotCount || !s_written[fd]) return;
+
+	for (;;)
+	{
+		char control[256];
+		msghdr msg = {};
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) return;
+
+		const timespec* transmitted = FindTimestamp(msg);
+		if (!transmitted || !IsTransmitted(msg) || !s_written[fd]) continue;
+
+		uint64_t time = ToMicroseconds(*transmitted);
+		s_delays.m_transmit.Record(time > s_written[fd] ? time - s_written[fd] : 0);
+		s_written[fd] = 0;
+	}
+}
+
+void SocketTimestamps::Forget(int fd)
+{
+	if (static_cast<size_t>(fd) < s_slotCount) s_written[fd] = 0;
+}
+
+#endif // __linux__
@@ -0,0 +1,227 @@
+#include "System/StatsSegment.h"
+#include "System/Exception.h"
+#include "Metrics.h"
+
+#if defined(__linux__)
+
+namespace
+{
+
+// Entries the segment has room for, the rest aren't published.
+const size_t STATS_CAPACITY = 1024;
+const size_t SEGMENT_SIZE = sizeof(StatsHeader) + STATS_CAPACITY * sizeof(StatsEntry);
+
+struct Publisher
+{
+	StatsPolicy m_policy;
+	std::string m_path;
+	int m_fd;
+	StatsHeader* m_header;
+	boost::thread m_thread;
+
+	Publisher() : m_fd(-1), m_header(nullptr) {}
+};
+
+Publisher s_publisher;
+
+uint64_t ReadClock(clockid_t clock)
+{
+	timespec now;
+	clock_gettime(clock, &now);
+	return static_cast<uint64_t>(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+}
+
+StatsEntry* GetEntries(const StatsHeader* header)
+{
+	return reinterpret_cast<StatsEntry*>(const_cast<StatsHeader*>(header) + 1);
+}
+
+void Collect(std::vector<StatsEntry>& entries)
+{
+	entries.clear();
+	Metrics::ForEach([&entries](const MetricEntry& metric)
+	{
+		if (metric.IsSilent()) return;
+
+		StatsEntry entry = {};
+		std::string name = metric.m_label.empty() ? metric.m_name : metric.m_name + '{' + metric.m_label + '}';
+		strncpy(entry.m_name, name.c_str(), sizeof(entry.m_name) - 1);
+
+		switch (metric.m_kind)
+		{
+		case MetricEntry::counter:
+			entry.m_kind = StatsEntry::counter;
+			entry.m_value = metric.GetCounter().Get();
+			break;
+		case MetricEntry::gauge:
+			entry.m_kind = StatsEntry::gauge;
+			entry.m_value = static_cast<uint64_t>(metric.GetGauge().Get());
+			break;
+		case MetricEntry::histogram:
+		{
+			const LatencyStats& histogram = metric.GetHistogram();
+			entry.m_kind = StatsEntry::histogram;
+			entry.m_value = histogram.GetCount();
+			entry.m_sum = histogram.GetTotal();
+			entry.m_median = histogram.GetPercentile(0.5);
+			entry.m_p99 = histogram.GetPercentile(0.99);
+			entry.m_max = histogram.GetMax();
+			break;
+		}
+		}
+
+		entries.push_back(entry);
+	});
+
+	// Metrics of the same name go together, whenever they've been registered.
+	std::stable_sort(entries.begin(), entries.end(),
+		[](const StatsEntry& lhs, const StatsEntry& rhs) { return strcmp(lhs.m_name, rhs.m_name) < 0; });
+	if (entries.size() > STATS_CAPACITY) entries.resize(STATS_CAPACITY);
+}
+
+// Entries are collected first, so the sequence stays odd just for a copy.
+void Publish(const std::vector<StatsEntry>& entries)
+{
+	StatsHeader* header = s_publisher.m_header;
+	uint64_t sequence = header->m_sequence.load(boost::memory_order_relaxed);
+	header->m_sequence.store(sequence + 1, boost::memory_order_relaxed);
+	boost::atomic_thread_fence(boost::memory_order_release);
+
+	header->m_published = ReadClock(CLOCK_MONOTONIC);
+	header->m_entryCount = static_cast<uint32_t>(entries.size());
+	if (!entries.empty()) memcpy(GetEntries(header), entries.data(), entries.size() * sizeof(StatsEntry));
+
+	header->m_sequence.store(sequence + 2, boost::memory_order_release);
+}
+
+void PublishPeriodically()
+{
+	boost::posix_time::milliseconds interval(s_publisher.m_policy.m_interval);
+	std::vector<StatsEntry> entries;
+
+	try
+	{
+		for (;;)
+		{
+			Collect(entries);
+			Publish(entries);
+			boost::this_thread::sleep(interval);
+		}
+	}
+	catch (const boost::thread_interrupted&)
+	{
+		// Stop requested.
+	}
+}
+
+} // namespace
+
+void StatsSegment::Start(const StatsPolicy& policy)
+{
+	if (!policy.m_interval) return;
+
+	s_publisher.m_policy = policy;
+	s_publisher.m_path = GetPath(program_invocation_short_name, getpid());
+
+	// Segment of a process gone with the same id is taken over.
+	s_publisher.m_fd = open(s_publisher.m_path.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+	if (s_publisher.m_fd < 0) throw SystemException(errno);
+	if (ftruncate(s_publisher.m_fd, SEGMENT_SIZE) < 0) throw SystemException(errno);
+
+	void* memory = mmap(nullptr, SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, s_publisher.m_fd, 0);
+	if (memory == MAP_FAILED) throw SystemException(errno);
+
+	// File is zeroed, header is valid once the magic is there.
+	StatsHeader* header = static_cast<StatsHeader*>(memory);
+	header->m_version = STATS_VERSION;
+	header->m_entrySize = sizeof(StatsEntry);
+	header->m_capacity = STATS_CAPACITY;
+	header->m_pid = getpid();
+	header->m_created = ReadClock(CLOCK_REALTIME);
+	header->m_sequence.store(0, boost::memory_order_relaxed);
+	boost::atomic_thread_fence(boost::memory_order_release);
+	header->m_magic = STATS_MAGIC;
+
+	s_publisher.m_header = header;
+	s_publisher.m_thread = boost::thread(&PublishPeriodically);
+}
+
+void StatsSegment::Stop()
+{
+	if (!s_publisher.m_header) return;
+
+	s_publisher.m_thread.interrupt();
+	s_publisher.m_thread.join();
+
+	munmap(s_publisher.m_header, SEGMENT_SIZE);
+	close(s_publisher.m_fd);
+	remove(s_publisher.m_path.c_str());
+	s_publisher.m_header = nullptr;
+}
+
+std::string StatsSegment::GetPath(const std::string& name, uint64_t pid)
+{
+	return "/dev/shm/" + name + '.' + std::to_string(pid) + ".stats";
+}
+
+StatsReader::StatsReader(const std::string& path)
+: m_fd(-1)
+, m_size(0)
+, m_header(nullptr)
+{
+	m_fd = open(path.c_str(), O_RDONLY);
+	if (m_fd < 0) throw SystemException(errno);
+
+	struct stat info = {};
+	if (fstat(m_fd, &info) < 0 || static_cast<size_t>(info.st_size) < sizeof(StatsHeader))
+	{
+		close(m_fd);
+		throw std::runtime_error("Stats segment " + path + " is incomplete.");
+	}
+
+	m_size = info.st_size;
+	void* memory = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+	if (memory == MAP_FAILED)
+	{
+		int error = errno;
+		close(m_fd);
+		throw SystemException(error);
+	}
+
+	m_header = static_cast<const StatsHeader*>(memory);
+	if (m_header->m_magic != STATS_MAGIC || m_header->m_version != STATS_VERSION ||
+		m_header->m_entrySize != sizeof(StatsEntry) ||
+		sizeof(StatsHeader) + m_header->m_capacity * sizeof(StatsEntry) > m_size)
+	{
+		munmap(const_cast<StatsHeader*>(m_header), m_size);
+		close(m_fd);
+		throw std::runtime_error("Stats segment " + path + " has unknown layout.");
+	}
+}
+
+StatsReader::~StatsReader()
+{
+	munmap(const_cast<StatsHeader*>(m_header), m_size);
+	close(m_fd);
+}
+
+void StatsReader::Read(StatsSnapshot& snapshot) const
+{
+	const StatsEntry* entries = GetEntries(m_header);
+
+	for (;;)
+	{
+		uint64_t before = m_header->m_sequence.load(boost::memory_order_acquire);
+		// Publisher is half way through, it's done in a few microseconds.
+		if (before & 1) continue;
+
+		size_t count = std::min<size_t>(m_header->m_entryCount, m_header->m_capacity);
+		snapshot.m_published = m_header->m_published;
+		snapshot.m_entries.assign(entries, entries + count);
+
+		boost::atomic_thread_fence(boost::memory_order_acquire);
+		if (m_header->m_sequence.load(boost::memory_order_relaxed) == before) break;
+	}
+}
+
+#endif // __linux__
@@ -0,0 +1,178 @@
+#include "System/TcpInfo.h"
+#include "System/Exception.h"
+#include "Metrics.h"
+#include <netinet/tcp.h>
+
+#if defined(__linux__)
+
+namespace
+{
+
+// Last sample of a connection. Fields are updated by the thread handling
+// it and read by whoever lists the worst ones, each of them on its own.
+struct Slot
+{
+	// Coarse clock the connection is due to be sampled at, in milliseconds.
+	// Zero while it hasn't been sampled since being bound.
+	boost::atomic<uint32_t> m_due;
+	boost::atomic<uint32_t> m_rtt;
+	boost::atomic<uint32_t> m_rttVar;
+	boost::atomic<uint32_t> m_cwnd;
+	boost::atomic<uint32_t> m_unacked;
+	boost::atomic<uint32_t> m_retransmits;
+
+	Slot() : m_due(0), m_rtt(0), m_rttVar(0), m_cwnd(0), m_unacked(0), m_retransmits(0) {}
+};
+
+struct Aggregate
+{
+	LatencyStats m_rtt;
+	LatencyStats m_rttVar;
+	LatencyStats m_cwnd;
+	LatencyStats m_unacked;
+	Counter m_retransmits;
+	Counter m_samples;
+};
+
+// Set once at startup, before IO threads start.
+TcpInfoPolicy s_policy;
+boost::scoped_array<Slot> s_slots;
+size_t s_slotCount = 0;
+Aggregate s_aggregate;
+
+thread_local size_t s_left = 0;
+
+uint32_t ReadMilliseconds()
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+	return static_cast<uint32_t>(static_cast<uint64_t>(now.tv_sec) * 1000 + now.tv_nsec / 1000000);
+}
+
+uint32_t GetKey(const TcpSample& sample, TcpInfo::Order order)
+{
+	switch (order)
+	{
+	case TcpInfo::byRetransmits: return sample.m_retransmits;
+	case TcpInfo::byUnacked: return sample.m_unacked;
+	default: return sample.m_rtt;
+	}
+}
+
+} // namespace
+
+void TcpInfo::Init(const TcpInfoPolicy& policy)
+{
+	if (!policy.m_interval || s_slotCount) return;
+
+	rlimit limit = {};
+	if (getrlimit(RLIMIT_NOFILE, &limit) < 0) throw SystemException(errno);
+
+	size_t count = limit.rlim_cur == RLIM_INFINITY ? 0xffff : limit.rlim_cur;
+	s_slots.reset(new Slot[count]);
+	s_slotCount = count;
+	s_policy = policy;
+
+	Metrics::Register("tcp_rtt_us", "", "Smoothed round trip time of connections sampled.", s_aggregate.m_rtt);
+	Metrics::Register("tcp_rtt_var_us", "", "Round trip time variance of connections sampled.", s_aggregate.m_rttVar);
+	Metrics::Register("tcp_cwnd_segments", "", "Congestion window of connections sampled.", s_aggregate.m_cwnd);
+	Metrics::Register("tcp_unacked_segments", "", "Segments in flight of connections sampled.", s_aggregate.m_unacked);
+	Metrics::Register("tcp_retransmits_total", "", "Segments retransmitted, as seen by samples.", s_aggregate.m_retransmits);
+	Metrics::Register("tcp_info_samples_total", "", "Connections sampled.", s_aggregate.m_samples);
+}
+
+void TcpInfo::Shutdown()
+{
+	if (!s_slotCount) return;
+
+	Metrics::Unregister(&s_aggregate.m_rtt);
+	Metrics::Unregister(&s_aggregate.m_rttVar);
+	Metrics::Unregister(&s_aggregate.m_cwnd);
+	Metrics::Unregister(&s_aggregate.m_unacked);
+	Metrics::Unregister(&s_aggregate.m_retransmits);
+	Metrics::Unregister(&s_aggregate.m_samples);
+}
+
+bool TcpInfo::IsEnabled()
+{
+	return s_slotCount != 0;
+}
+
+void TcpInfo::Renew()
+{
+	s_left = s_policy.m_budget;
+}
+
+void TcpInfo::Sample(int fd)
+{
+	if (!s_left || static_cast<size_t>(fd) >= s_slotCount) return;
+
+	// Clock wraps around, so it's compared by distance.
+	Slot& slot = s_slots[fd];
+	uint32_t now = ReadMilliseconds();
+	uint32_t due = slot.m_due.load(boost::memory_order_relaxed);
+	if (due && static_cast<int32_t>(now - due) < 0) return;
+
+	tcp_info info = {};
+	socklen_t size = sizeof(info);
+	if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &size) < 0) return;
+	--s_left;
+
+	uint32_t next = now + static_cast<uint32_t>(s_policy.m_interval);
+	slot.m_due.store(next ? next : 1, boost::memory_order_relaxed);
+
+	// Retransmits are counted by connection since it's been opened.
+	uint32_t retransmits = slot.m_retransmits.load(boost::memory_order_relaxed);
+	if (info.tcpi_total_retrans > retransmits) s_aggregate.m_retransmits.Add(info.tcpi_total_retrans - retransmits);
+
+	slot.m_rtt.store(info.tcpi_rtt, boost::memory_order_relaxed);
+	slot.m_rttVar.store(info.tcpi_rttvar, boost::memory_order_relaxed);
+	slot.m_cwnd.store(info.tcpi_snd_cwnd, boost::memory_order_relaxed);
+	slot.m_unacked.store(info.tcpi_unacked, boost::memory_order_relaxed);
+	slot.m_retransmits.store(info.tcpi_total_retrans, boost::memory_order_relaxed);
+
+	s_aggregate.m_rtt.Record(info.tcpi_rtt);
+	s_aggregate.m_rttVar.Record(info.tcpi_rttvar);
+	s_aggregate.m_cwnd.Record(info.tcpi_snd_cwnd);
+	s_aggregate.m_unacked.Record(info.tcpi_unacked);
+	s_aggregate.m_samples.Add();
+}
+
+void TcpInfo::Forget(int fd)
+{
+	if (static_cast<size_t>(fd) >= s_slotCount) return;
+
+	// Descriptor is reused by the next connection, which starts afresh.
+	Slot& slot = s_slots[fd];
+	slot.m_due.store(0, boost::memory_order_relaxed);
+	slot.m_retransmits.store(0, boost::memory_order_relaxed);
+}
+
+void TcpInfo::ListWorst(Order order, size_t count, std::vector<TcpSample>& worst)
+{
+	worst.clear();
+	for (size_t fd = 0; fd < s_slotCount; ++fd)
+	{
+		const Slot& slot = s_slots[fd];
+		if (!slot.m_due.load(boost::memory_order_relaxed)) continue;
+
+		TcpSample sample;
+		sample.m_fd = static_cast<int>(fd);
+		sample.m_rtt = slot.m_rtt.load(boost::memory_order_relaxed);
+		sample.m_rttVar = slot.m_rttVar.load(boost::memory_order_relaxed);
+		sample.m_cwnd = slot.m_cwnd.load(boost::memory_order_relaxed);
+		sample.m_unacked = slot.m_unacked.load(boost::memory_order_relaxed);
+		sample.m_retransmits = slot.m_retransmits.load(boost::memory_order_relaxed);
+		worst.push_back(sample);
+	}
+
+	auto isWorse = [order](const TcpSample& lhs, const TcpSample& rhs) { return GetKey(lhs, order) > GetKey(rhs, order); };
+	if (worst.size() > count)
+	{
+		std::partial_sort(worst.begin(), worst.begin() + count, worst.end(), isWorse);
+		worst.resize(count);
+	}
+	else std::sort(worst.begin(), worst.end(), isWorse);
+}
+
+#endif // __linux__
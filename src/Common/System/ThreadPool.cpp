@@ -1,5 +1,6 @@
 #include "System/ThreadPool.h"
 #include "System/Exception.h"
+#include "Logger.h"
 
 #if defined(_WIN64)
 
@@ -64,13 +65,64 @@ void CThreadPool::Stop()
 
 #elif defined(__linux__)
 
+namespace
+{
+
+// Threads take CPUs the process may run on from the last one down, so that
+// the first ones are left to the rest of the system. Calling thread keeps
+// off the CPUs taken, so do threads it starts later, event loops among them.
+// None are taken unless each thread gets one and at least one is left.
+std::vector<int> ReserveCpus(size_t count)
+{
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) throw SystemException(errno);
+
+	size_t allowedCount = CPU_COUNT(&allowed);
+	if (allowedCount <= count)
+	{
+		LOG_WARNING("{} CPUs allowed aren't enough to pin {} threads, they aren't pinned.", allowedCount, count);
+		return std::vector<int>();
+	}
+
+	std::vector<int> cpus;
+	for (int cpu = CPU_SETSIZE - 1; cpu >= 0 && cpus.size() < count; --cpu)
+	{
+		if (!CPU_ISSET(cpu, &allowed)) continue;
+		cpus.push_back(cpu);
+		CPU_CLR(cpu, &allowed);
+	}
+
+	if (sched_setaffinity(0, sizeof(allowed), &allowed) < 0) throw SystemException(errno);
+	return cpus;
+}
+
+void Pin(pthread_t th, int cpu)
+{
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	CPU_SET(cpu, &cpus);
+
+	int res = pthread_setaffinity_np(th, sizeof(cpus), &cpus);
+	if (res) throw SystemException(res);
+}
+
+} // namespace
+
 ThreadPool::ThreadPool(ThreadPool::ThreadCallback_t threadCallback)
 : m_threadCallback(threadCallback)
+, m_pinned(false)
 {
 	// Determine number of dedicated threads.
 	m_threadCount = 2 * get_nprocs() + 1;
 }
 
+ThreadPool::ThreadPool(ThreadPool::ThreadCallback_t threadCallback, size_t threadCount, bool pinned)
+: m_threadCallback(threadCallback)
+, m_threadCount(static_cast<uint32_t>(threadCount))
+, m_pinned(pinned)
+{}
+
 ThreadPool::~ThreadPool()
 {
     Stop();
@@ -90,6 +142,9 @@ size_t ThreadPool::GetThreadCount() const
 
 void ThreadPool::Start()
 {
+	std::vector<int> cpus;
+	if (m_pinned) cpus = ReserveCpus(m_threadCount);
+
 	for (unsigned i = 0; i < m_threadCount; ++i)
 	{
 		pthread_t th;
@@ -97,6 +152,7 @@ void ThreadPool::Start()
 		if(res) throw SystemException(res);
 
 		m_threads.push_back(th);
+		if (!cpus.empty()) Pin(th, cpus[i]);
 	}
 }
 
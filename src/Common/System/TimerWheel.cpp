@@ -0,0 +1,41 @@
+#include "System/TimerWheel.h"
+
+TimerWheel::TimerWheel(uint32_t now)
+: m_next(now + 1)
+, m_size(0)
+{}
+
+void TimerWheel::Restart(uint32_t now)
+{
+	if (m_size) return;
+	if (static_cast<int32_t>(now - m_next) >= 0) m_next = now + 1;
+}
+
+void TimerWheel::File(Handle_t handle, uint32_t due)
+{
+	Place(Entry{ handle, due });
+}
+
+void TimerWheel::Place(const Entry& entry)
+{
+	// Past ticks come up with the next one.
+	uint32_t distance = entry.m_due - m_next;
+	if (static_cast<int32_t>(distance) < 0) distance = 0;
+	if (distance > MAX_DISTANCE) distance = MAX_DISTANCE;
+
+	size_t level = 0;
+	while (level < LEVEL_COUNT - 1 && distance >= (1u << (LEVEL_BITS * (level + 1)))) ++level;
+
+	uint32_t due = m_next + distance;
+	m_levels[level][(due >> (LEVEL_BITS * level)) & (SLOT_COUNT - 1)].push_back(entry);
+	++m_size;
+}
+
+void TimerWheel::Cascade(size_t level, size_t index)
+{
+	Slot_t entries;
+	entries.swap(m_levels[level][index]);
+	m_size -= entries.size();
+
+	for (const Entry& entry : entries) Place(entry);
+}
@@ -0,0 +1,184 @@
+#include "CommonDefinitions.h"
+#include "System/StatsSegment.h"
+#include <dirent.h>
+#include <map>
+
+namespace opt = boost::program_options;
+
+static const char DEFAULT_NAME[] = "Server";
+static const size_t DEFAULT_INTERVAL = 1000;
+
+#if defined(__linux__)
+
+// Segment of a live process of given name, the one started last if there are several.
+static std::string FindSegment(const std::string& name)
+{
+    std::string found;
+    uint64_t created = 0;
+
+    DIR* dir = opendir("/dev/shm");
+    if (!dir) return found;
+
+    std::string prefix = name + '.';
+    while (dirent* entry = readdir(dir))
+    {
+        std::string file = entry->d_name;
+        if (file.compare(0, prefix.size(), prefix) || !boost::algorithm::ends_with(file, ".stats")) continue;
+
+        pid_t pid = static_cast<pid_t>(strtoul(file.c_str() + prefix.size(), nullptr, 10));
+        if (kill(pid, 0) < 0 && errno != EPERM) continue;
+
+        std::string path = "/dev/shm/" + file;
+        try
+        {
+            StatsReader reader(path);
+            if (found.empty() || reader.GetCreated() > created)
+            {
+                found = path;
+                created = reader.GetCreated();
+            }
+        }
+        catch (const std::exception&)
+        {
+            // Segment being created or of another version.
+        }
+    }
+
+    closedir(dir);
+    return found;
+}
+
+static void Show(const std::string& name, uint64_t pid, const StatsSnapshot& snapshot,
+    const std::map<std::string, uint64_t>& previous, uint64_t elapsed, const std::string& filter)
+{
+    std::cout << name << " " << pid << ": " << snapshot.m_entries.size() << " metrics";
+    if (elapsed) std::cout << ", rates over " << elapsed / 1000 << " ms";
+    std::cout << std::endl << std::endl;
+
+    // Per second change of a counter since the previous sample.
+    auto rate = [&](const StatsEntry& entry)
+    {
+        auto found = previous.find(entry.m_name);
+        if (!elapsed || found == previous.end()) return 0.0;
+        return static_cast<double>(entry.m_value - found->second) * 1000000 / elapsed;
+    };
+
+    // Threads first, top style: events handled per second and share of time busy.
+    for (const StatsEntry& entry : snapshot.m_entries)
+    {
+        if (strncmp(entry.m_name, "loop_events_total{", 18)) continue;
+
+        std::string labels = entry.m_name + 17;
+        std::string busyName = "loop_busy_us_total" + labels;
+        auto busy = std::find_if(snapshot.m_entries.begin(), snapshot.m_entries.end(),
+            [&busyName](const StatsEntry& e) { return busyName == e.m_name; });
+
+        std::cout << std::left << std::setw(56) << "thread " + labels << std::right
+            << std::setw(12) << std::fixed << std::setprecision(0) << rate(entry) << " events/s";
+        if (busy != snapshot.m_entries.end())
+            std::cout << std::setw(8) << std::setprecision(1) << rate(*busy) / 10000 << "% busy";
+        std::cout << std::endl;
+    }
+    std::cout << std::endl;
+
+    for (const StatsEntry& entry : snapshot.m_entries)
+    {
+        if (!filter.empty() && !strstr(entry.m_name, filter.c_str())) continue;
+
+        std::cout << std::left << std::setw(56) << entry.m_name << std::right;
+        switch (entry.m_kind)
+        {
+        case StatsEntry::counter:
+            std::cout << std::setw(16) << entry.m_value << std::setw(14) << std::setprecision(1) << rate(entry) << "/s";
+            break;
+        case StatsEntry::gauge:
+            std::cout << std::setw(16) << static_cast<int64_t>(entry.m_value);
+            break;
+        case StatsEntry::histogram:
+            std::cout << std::setw(16) << entry.m_value << std::setw(14) << std::setprecision(1) << rate(entry) << "/s"
+                << "  p50 " << entry.m_median << " p99 " << entry.m_p99 << " max " << entry.m_max;
+            break;
+        }
+        std::cout << std::endl;
+    }
+}
+
+#endif // __linux__
+
+int main(int argc, char* argv[])
+{
+    opt::options_description desc("Stats monitor options");
+    desc.add_options()
+    ("pid", opt::value<uint64_t>()->default_value(0), "process to watch (0 - the one of given name started last)")
+    ("name,n", opt::value<std::string>()->default_value(DEFAULT_NAME), "name of process to watch")
+    ("interval,i", opt::value<size_t>()->default_value(DEFAULT_INTERVAL), "refresh interval, ms")
+    ("count,c", opt::value<size_t>()->default_value(0), "refreshes before exiting (0 - until interrupted)")
+    ("filter,f", opt::value<std::string>()->default_value(""), "show only metrics with names containing this")
+    ("plain", opt::bool_switch(), "append samples instead of redrawing the screen")
+    ("help,h", "see this help text");
+
+    opt::variables_map varMap;
+    opt::store(opt::parse_command_line(argc, argv, desc), varMap);
+    opt::notify(varMap);
+
+    if(varMap.count("help"))
+    {
+        std::cout << desc << std::endl;
+        return 1;
+    }
+
+#if defined(__linux__)
+    std::string name = varMap["name"].as<std::string>();
+    uint64_t pid = varMap["pid"].as<uint64_t>();
+    std::string path = pid ? StatsSegment::GetPath(name, pid) : FindSegment(name);
+    if (path.empty())
+    {
+        std::cout << "No stats segment of running " << name << " found, is it started with --stats-interval?" << std::endl;
+        return 1;
+    }
+
+    try
+    {
+        StatsReader reader(path);
+        size_t count = varMap["count"].as<size_t>();
+        bool plain = varMap["plain"].as<bool>();
+        std::string filter = varMap["filter"].as<std::string>();
+        boost::posix_time::milliseconds interval(varMap["interval"].as<size_t>());
+
+        // Rates are taken between the last two samples published, not between refreshes.
+        std::map<std::string, uint64_t> previous;
+        std::map<std::string, uint64_t> latest;
+        uint64_t previousPublished = 0;
+        uint64_t latestPublished = 0;
+        for (size_t i = 0; !count || i < count; ++i)
+        {
+            StatsSnapshot snapshot;
+            reader.Read(snapshot);
+
+            if (snapshot.m_published != latestPublished)
+            {
+                previous.swap(latest);
+                previousPublished = latestPublished;
+                latest.clear();
+                for (const StatsEntry& entry : snapshot.m_entries) latest[entry.m_name] = entry.m_value;
+                latestPublished = snapshot.m_published;
+            }
+
+            if (!plain) std::cout << "\033[H\033[2J";
+            Show(name, reader.GetPid(), snapshot, previous, previousPublished ? latestPublished - previousPublished : 0, filter);
+            std::cout << std::endl;
+
+            if (!count || i + 1 < count) boost::this_thread::sleep(interval);
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << e.what() << std::endl;
+        return 1;
+    }
+#else
+    std::cout << "Stats segments are published on Linux only." << std::endl;
+#endif // __linux__
+
+    return 0;
+}
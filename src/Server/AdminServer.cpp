@@ -0,0 +1,287 @@
+#include "CommonDefinitions.h"
+#include "AdminServer.h"
+#include "System/Exception.h"
+#include "System/TcpInfo.h"
+
+#if defined(__linux__)
+
+// Admin peer has this long to send its request, ms.
+static const size_t ADMIN_REQUEST_TIMEOUT = 5000;
+// Admin peer has this long to read each part of the response, ms.
+static const size_t ADMIN_WRITE_TIMEOUT = 5000;
+// Connections listed at /tcp unless asked for another number.
+static const size_t DEFAULT_WORST_COUNT = 20;
+
+// Value of query parameter, empty if it isn't there.
+static boost::string_view GetParameter(boost::string_view target, boost::string_view name)
+{
+    size_t query = target.find('?');
+    if (query == boost::string_view::npos) return boost::string_view();
+
+    boost::string_view rest = target.substr(query + 1);
+    while (!rest.empty())
+    {
+        size_t end = std::min(rest.find('&'), rest.size());
+        boost::string_view pair = rest.substr(0, end);
+        if (pair.size() > name.size() && pair.starts_with(name) && pair[name.size()] == '=')
+            return pair.substr(name.size() + 1);
+        rest = rest.substr(std::min(end + 1, rest.size()));
+    }
+    return boost::string_view();
+}
+
+// Table of connections with the worst kernel view, e.g. /tcp?by=retransmits&count=50.
+// Peer is looked up as the table is made, descriptor might have been reused since sampling.
+static void AppendWorstConnections(boost::string_view target, std::string& body)
+{
+    boost::string_view by = GetParameter(target, "by");
+    TcpInfo::Order order = by == "retransmits" ? TcpInfo::byRetransmits : by == "unacked" ? TcpInfo::byUnacked : TcpInfo::byRtt;
+    boost::string_view count = GetParameter(target, "count");
+    size_t limit = count.empty() ? DEFAULT_WORST_COUNT : strtoul(std::string(count).c_str(), nullptr, 10);
+
+    std::vector<TcpSample> worst;
+    TcpInfo::ListWorst(order, limit, worst);
+
+    char line[256];
+    snprintf(line, sizeof(line), "%-6s %-48s %10s %10s %8s %8s %12s\n",
+        "fd", "peer", "rtt_us", "rttvar_us", "cwnd", "unacked", "retransmits");
+    body += line;
+
+    for (const TcpSample& sample : worst)
+    {
+        sockaddr_in6 address = {};
+        socklen_t size = sizeof(address);
+        char host[INET6_ADDRSTRLEN] = "-";
+        if (getpeername(sample.m_fd, reinterpret_cast<sockaddr*>(&address), &size) == 0)
+            inet_ntop(AF_INET6, &address.sin6_addr, host, sizeof(host));
+        std::string peer = std::string(host) + ':' + std::to_string(ntohs(address.sin6_port));
+
+        snprintf(line, sizeof(line), "%-6d %-48s %10u %10u %8u %8u %12u\n",
+            sample.m_fd, peer.c_str(), sample.m_rtt, sample.m_rttVar, sample.m_cwnd, sample.m_unacked, sample.m_retransmits);
+        body += line;
+    }
+}
+
+AdminConnection::AdminConnection(AdminServer& server)
+: m_server(server)
+, m_fd(-1)
+, m_slot(0)
+{}
+
+void AdminConnection::Set(int fd)
+{
+    m_fd = fd;
+
+    int nonBlockMode = 1;
+    if (ioctl(m_fd, FIONBIO, &nonBlockMode) < 0) throw SystemException(errno);
+}
+
+ssize_t AdminConnection::ReadAsync()
+{
+    // Request is read until the socket is empty or it's too big,
+    // returns zero if the peer is gone.
+    char buffer[MAX_REQUEST_SIZE];
+    size_t total = 0;
+    while (m_input.size() < MAX_REQUEST_SIZE)
+    {
+        ssize_t res = read(m_fd, buffer, MAX_REQUEST_SIZE - m_input.size());
+        if (res < 0 && errno == EAGAIN) break;
+        if (res <= 0) return 0;
+
+        m_input.append(buffer, res);
+        total += res;
+    }
+    return total ? static_cast<ssize_t>(total) : -1;
+}
+
+size_t AdminConnection::WriteAsync(boost::string_view data)
+{
+    // Send buffer is made to fit the response, yet the kernel caps it, so
+    // the rest is written blocking. Admin loop has nothing else to do than
+    // wait for the peer on loopback, which is given a while to read it.
+    // Peer gone meanwhile mustn't raise SIGPIPE.
+    int size = static_cast<int>(data.size());
+    setsockopt(m_fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+
+    int nonBlockMode = 0;
+    timeval timeout = { ADMIN_WRITE_TIMEOUT / 1000, (ADMIN_WRITE_TIMEOUT % 1000) * 1000 };
+    ioctl(m_fd, FIONBIO, &nonBlockMode);
+    setsockopt(m_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    size_t written = 0;
+    while (written < data.size())
+    {
+        ssize_t res = send(m_fd, data.data() + written, data.size() - written, MSG_NOSIGNAL);
+        if (res < 0 && errno == EINTR) continue;
+        if (res <= 0) break;
+        written += res;
+    }
+
+    if (written < data.size())
+        LOG_WARNING("Admin response cut short, {} of {} bytes written.", written, data.size());
+    return written;
+}
+
+void AdminConnection::Disconnect()
+{
+    m_server.Close(this);
+}
+
+bool AdminConnection::Complete()
+{
+    ssize_t res = ReadAsync();
+    if (!res)
+    {
+        Disconnect();
+        return false;
+    }
+
+    HttpRequest request;
+    size_t consumed = 0;
+    HttpParser::Result result = HttpParser::Parse(m_input.data(), m_input.size(), request, consumed);
+    if (result == HttpParser::incomplete && !IsInputFull()) return false;
+
+    std::string response;
+    m_server.Respond(result == HttpParser::complete ? &request : nullptr, response);
+    WriteAsync(response);
+
+    // Connection is deleted, nothing of it may be touched after.
+    Disconnect();
+    return false;
+}
+
+AdminServer::AdminServer(unsigned short port, SampleCallback_t&& sample)
+: m_sample(std::forward<SampleCallback_t>(sample))
+, m_ioMgr(1, "admin")
+, m_threadPool(boost::bind(&AdminServer::WorkCallback, this), 1, false)
+{
+    m_ioMgr.SetTimerCallback(boost::bind(&AdminServer::OnTimeout, this, _1));
+
+    m_acceptor.reset(new Acceptor(port,
+        boost::bind(&AdminServer::OnAcceptComplete, this, _1),
+        boost::bind(&AdminServer::StartAsyncIo, this, _1),
+        boost::bind(&AdminServer::StopAsyncIo, this, _1),
+        true));
+    m_ioMgr.Bind(m_acceptor.get());
+}
+
+AdminServer::~AdminServer()
+{
+    Stop();
+    // Acceptor unbinds itself from the loop, which has to outlive it.
+    m_acceptor.reset();
+}
+
+void AdminServer::Start()
+{
+    m_threadPool.Start();
+}
+
+void AdminServer::Stop()
+{
+    m_ioMgr.Stop();
+    m_threadPool.Stop();
+}
+
+void AdminServer::Respond(const HttpRequest* request, std::string& response)
+{
+    const char* status = "200 OK";
+    const char* type = "text/plain; version=0.0.4";
+    std::string body;
+
+    if (!request)
+    {
+        status = "400 Bad Request";
+        type = "text/plain";
+    }
+    else if (request->m_method != "GET")
+    {
+        status = "405 Method Not Allowed";
+        type = "text/plain";
+    }
+    else if (request->m_target == "/metrics")
+    {
+        m_sample();
+        Metrics::ExportText(body);
+    }
+    else if (request->m_target == "/metrics.json")
+    {
+        m_sample();
+        Metrics::ExportJson(body);
+        type = "application/json";
+    }
+    else if (request->m_target == "/tcp" || request->m_target.starts_with("/tcp?"))
+    {
+        type = "text/plain";
+        if (TcpInfo::IsEnabled()) AppendWorstConnections(request->m_target, body);
+        else body = "Connections aren't sampled, start the server with --tcp-info-interval.\n";
+    }
+    else
+    {
+        status = "404 Not Found";
+        type = "text/plain";
+        body = "Try /metrics, /metrics.json or /tcp\n";
+    }
+
+    char header[256];
+    int len = snprintf(header, sizeof(header),
+        "HTTP/1.1 %s\r\nServer: Tcp6Server\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+        status, type, body.size());
+    response.assign(header, len);
+    response += body;
+}
+
+void AdminServer::Close(AdminConnection* connection)
+{
+    m_ioMgr.Forget(connection);
+    m_connections.Remove(connection);
+    delete connection;
+}
+
+void AdminServer::OnAcceptComplete(IConnection*)
+{
+    // Listening socket is edge triggered, peers are taken until backlog is empty.
+    for (;;)
+    {
+        AdminConnection* connection = new AdminConnection(*this);
+        if (!m_acceptor->AcceptAsync(connection))
+        {
+            delete connection;
+            break;
+        }
+    }
+}
+
+void AdminServer::StartAsyncIo(IEndpoint* endpoint)
+{
+    m_connections.Add(static_cast<AdminConnection*>(endpoint));
+    m_ioMgr.Bind(endpoint);
+    m_ioMgr.ArmTimer(endpoint, ADMIN_REQUEST_TIMEOUT);
+}
+
+void AdminServer::StopAsyncIo(IEndpoint* endpoint)
+{
+    m_ioMgr.Unbind(endpoint);
+}
+
+size_t AdminServer::OnTimeout(IEndpoint* endpoint)
+{
+    // Connection can't be closed with timers locked, its next read sees the peer gone.
+    shutdown(endpoint->Get(), SHUT_RDWR);
+    return 0;
+}
+
+void AdminServer::WorkCallback()
+{
+    try
+    {
+        m_ioMgr.Run();
+    }
+    catch(...)
+    {
+        // Server goes on without admin listener.
+        LOG_ERROR("Admin listener failed: {}", boost::current_exception_diagnostic_information());
+    }
+}
+
+#endif // __linux__
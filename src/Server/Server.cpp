@@ -1,14 +1,18 @@
 #include "CommonDefinitions.h"
 #include "Server.h"
 
+// New connections logged per second at most, the rest are counted.
+static const uint32_t CONNECT_LOG_RATE = 100;
+// Peer of connection closed with output backlogged is given this long
+// to take some of it, ms, and as long again each time it does.
+static const size_t LINGER_TIMEOUT = 5000;
+
 void AsioServer::Connection::Start()
 {
     auto self = m_sock.local_endpoint();
     auto peer = m_sock.remote_endpoint();
-    std::cout << "Server " << self.address().to_string() << "(" 
-        << self.port() << ") accepted client " 
-        << peer.address().to_string() 
-        << "(" << peer.port() << ")." << std::endl;
+    LOG_LIMITED(Logger::info, CONNECT_LOG_RATE, "Server {}({}) accepted client {}({}).",
+        self.address().to_string(), self.port(), peer.address().to_string(), peer.port());
 
     if(!m_readCallback)
     {
@@ -36,14 +40,45 @@ void AsioServer::Connection::OnReadComplete(const boost::system::error_code& err
 {
     if(err)
     {
-        std::cerr << "Error reading data: " << err.message() << std::endl;
+        LOG_ERROR("Error reading data: {}", err.message());
         m_sock.close();
     }
+    else if (m_framing.IsNegotiating() && m_framing.Accept(m_data, bytesRead, m_outputData))
+    {
+        // Framing offer is answered right away, it's not a data to echo.
+        boost::asio::async_write(m_sock, boost::asio::buffer(m_outputData), m_writeCallback);
+    }
+    else if (m_framing.IsFramed())
+    {
+        // Stream may split and join frames, whole ones are decoded.
+        m_framedInput.append(m_data, bytesRead);
+        size_t consumed = 0;
+        m_inputData.clear();
+        if (!m_framing.Decode(m_framedInput.data(), m_framedInput.size(), consumed, m_inputData))
+        {
+            LOG_WARNING("Malformed frame received.");
+            m_sock.close();
+            return;
+        }
+        m_framedInput.erase(0, consumed);
+
+        if (m_inputData.empty())
+        {
+            // Frame is incomplete, wait for the rest of it.
+            m_sock.async_read_some(boost::asio::buffer(m_data, BUF_SIZE), m_readCallback);
+            return;
+        }
+
+        LOG_DEBUG("Data received: {}", m_inputData);
+
+        // Frame must go as a whole, otherwise peer can't decode it.
+        m_framing.Encode(m_inputData.data(), m_inputData.size(), m_outputData);
+        boost::asio::async_write(m_sock, boost::asio::buffer(m_outputData), m_writeCallback);
+    }
     else
     {
         // Got message from a client.
-        std::string dataReceived(m_data, bytesRead);
-        std::cout << "Data received: " << dataReceived << std::endl;
+        LOG_DEBUG("Data received: {}", boost::string_view(m_data, bytesRead));
 
         // Write this message back to the client.
         m_sock.async_write_some(boost::asio::buffer(m_data, BUF_SIZE), m_writeCallback);
@@ -54,20 +89,21 @@ void AsioServer::Connection::OnWriteComplete(const boost::system::error_code& er
 {
     if(err)
     {
-        std::cerr << "Error writing data: " << err.message() << std::endl;
+        LOG_ERROR("Error writing data: {}", err.message());
         m_sock.close();
     }
     else
     {
-        std::cout << "Echo message has been sent." << std::endl;
+        LOG_DEBUG("Echo message has been sent.");
 
         // After sending echo to the client we're waiting for more messages.
         m_sock.async_read_some(boost::asio::buffer(m_data, BUF_SIZE), m_readCallback);
     }
 }
 
-AsioServer::AsioServer(uint16_t port)
-: m_endpoint(boost::asio::ip::tcp::v6(), port)
+AsioServer::AsioServer(const ServerSettings& settings)
+: m_settings(settings)
+, m_endpoint(boost::asio::ip::tcp::v6(), settings.m_port)
 , m_acceptor(m_ioSvc, m_endpoint)
 {}
 
@@ -107,7 +143,7 @@ void AsioServer::ThreadCallback()
 
 void AsioServer::StartListening()
 {
-    Connection::Pointer_t connection = Connection::Create(m_ioSvc);
+    Connection::Pointer_t connection = Connection::Create(m_ioSvc, m_settings.m_framing);
     m_acceptor.async_accept(
         connection->GetSocket(),
         boost::bind(
@@ -152,8 +188,8 @@ IAcceptor* CWinSockServer::CreateAcceptor()
 
 void CWinSockServer::OnAcceptComplete(IConnection* newConnection)
 {
-    // Print new peer.
-    std::cout << m_acceptor->GetPeerInfo() << std::endl;
+    // Peer info is looked up only if it's logged.
+    LOG_LIMITED(Logger::info, CONNECT_LOG_RATE, "{}", m_acceptor->GetPeerInfo());
 
     // Start tracking next connection.
     DoAccept();
@@ -167,7 +203,8 @@ void CWinSockServer::OnReadComplete(IConnection* connection)
 {
     // Asynchronous data reading just completed - get the data.
     std::string data = connection->GetInputData();
-    std::cout << "Data coming from peer: " << data << std::endl;
+    LOG_DEBUG("Data coming from peer: {}", data);
+    Metrics::Get().m_messages.Add();
     // Write the back back to the peer.
     connection->WriteAsync(data);
 }
@@ -186,13 +223,26 @@ void CWinSockServer::OnDisconnectComplete(IConnection* connection)
 
 #elif defined(__linux__)
 
+ConnectionCallbacksPtr_t LinuxServer::CreateConnectionCallbacks(LinuxServer* server, const ServerSettings& settings)
+{
+    auto callbacks = boost::make_shared<ConnectionCallbacks>();
+    callbacks->m_dataExchange = settings.m_http
+        ? boost::bind(&LinuxServer::OnHttpExchangeComplete, server, _1)
+        : boost::bind(&LinuxServer::OnDataExchangeComplete, server, _1);
+    callbacks->m_stopAsyncIo = boost::bind(&LinuxServer::StopAsyncIo, server, _1);
+    callbacks->m_deferInput = boost::bind(&LinuxServer::DeferInput, server, _1);
+    callbacks->m_setServiceClass = boost::bind(&LinuxServer::SetServiceClass, server, _1, _2);
+    callbacks->m_watchOutput = boost::bind(&LinuxServer::WatchOutput, server, _1);
+    return callbacks;
+}
+
 IConnection* LinuxServer::CreateConnection()
 {
-    IConnection* connection = new (std::nothrow) Connection(
-        boost::bind(&LinuxServer::OnDataExchangeComplete, this, _1),
-        boost::bind(&LinuxServer::StartAsyncIo, this, _1),
-        boost::bind(&LinuxServer::StopAsyncIo, this, _1));
-    if (!connection) throw std::bad_alloc();
+    // No new connections while load is being shed, the peer is turned away.
+    if (MemoryGovernor::GetStage() >= MemoryGovernor::shed) return nullptr;
+
+    IConnection* connection = new (std::nothrow) Connection(m_settings.m_framing, LinuxServerCallbacks::member.get());
+    if (!connection) MemoryGovernor::OnAllocationFailure();
     return connection;
 }
 
@@ -206,57 +256,400 @@ IAcceptor* LinuxServer::CreateAcceptor()
     return acceptor;
 }
 
-void LinuxServer::OnAcceptComplete(IConnection* newConnection)
+void LinuxServer::OnAcceptComplete(IConnection*)
 {
-    // Start tracking next connection.
-    if (DoAccept())
+    // Listening socket is edge triggered, so peers are taken until
+    // backlog is empty or admission control pauses accepting.
+    // Each connection gets its first read event as it's bound.
+    while (DoAccept()) {}
+}
+
+AdmissionControl::Decision LinuxServer::Admit()
+{
+    LoadSignals load = { m_cnMgr.GetActiveCount(), m_ioMgr.GetLag(), m_ioMgr.GetQueueDepth() };
+    AdmissionControl::Decision decision = m_admission.Admit(load);
+
+    // Acceptor is rearmed as its timer expires.
+    if (decision == AdmissionControl::pause) m_ioMgr.ArmTimer(m_acceptor, m_admission.GetPause());
+    return decision;
+}
+
+std::string LinuxServer::GetBusyReply()
+{
+    if (!m_settings.m_http) return "BUSY\r\n";
+
+    static const char body[] = "Server is busy, retry later\n";
+    std::string reply;
+    HttpResponder::Append(reply, HttpResponder::serviceUnavailable, false, body, sizeof(body) - 1);
+    return reply;
+}
+
+size_t LinuxServer::OnDataExchangeComplete(IConnection* connection)
+{
+    // Events coming while input is paused are of no interest.
+    if (IsThrottled(connection)) return 0;
+
+    // Edge triggered notification, so read until there's nothing left.
+    // Read refuses once the turn is over, the rest is read on the next one.
+    // Input waits while output is backlogged, peer reading nothing gets no more.
+    size_t total = 0;
+    while (OutputBacklog::IsEmpty(connection->Get()))
     {
-        // Print new peer.
-        std::cout << m_acceptor->GetPeerInfo() << std::endl;
+        ssize_t res = connection->ReadAsync();
+        if (res < 0) break;
+
+        if (!res)
+        {
+            // Remote side disconnected - reset connection instance to be reused some later.
+            connection->Disconnect();
+            m_cnMgr.Release(connection);
+            return 0;
+        }
+        total += res;
+
+        // Asynchronous data reading just completed - look at the data in place.
+        boost::string_view data = connection->GetInputView();
+        // Frame hasn't come whole yet, it's kept for the next read.
+        if (data.empty()) continue;
+        LOG_DEBUG("Data coming from peer: {}", data);
+
+        Metrics::Get().m_messages.Add();
+
+        // Write the response back to the peer, all the input is answered.
+        ArenaString response;
+        Dispatch(data, response);
+        connection->WriteAsync(response);
+        connection->Consume(data.size());
+        if (ThrottlePeer(connection, 1, res)) return total;
+    }
+
+    TcpInfo::Sample(connection->Get());
+    RefreshTimer(connection);
+    return total;
+}
 
-        // Start read IO on new connection.
-        if (newConnection) newConnection->ReadAsync();
+void LinuxServer::Dispatch(boost::string_view request, ArenaString& response)
+{
+    if (!m_settings.m_cache.m_enabled)
+    {
+        HandleRequest(request, response);
+        return;
     }
+
+    // Cached responses outlive the dispatch, so they're kept on heap.
+    std::string cached = m_responseCache.Get(std::string(request.data(), request.size()),
+        [this](const std::string& key)
+        {
+            ArenaString computed;
+            HandleRequest(key, computed);
+            return std::string(computed.data(), computed.size());
+        });
+    response.assign(cached.data(), cached.size());
 }
 
-size_t LinuxServer::OnDataExchangeComplete(IConnection* connection)
+void LinuxServer::HandleRequest(boost::string_view request, ArenaString& response)
 {
-    // Asynchronous data writing just completed - start reading new portion.
-    int res = connection->ReadAsync();
-    if (res < 0)
+    // Echo is all the server does.
+    response.assign(request.data(), request.size());
+}
+
+size_t LinuxServer::OnHttpExchangeComplete(IConnection* connection)
+{
+    if (IsThrottled(connection)) return 0;
+
+    // Responses to all pipelined requests go out with a single write.
+    static thread_local std::string responses;
+    responses.clear();
+
+    bool keepAlive = true;
+    bool throttled = false;
+    while (keepAlive && !throttled)
     {
-        // Nothing to read - return imediately.
-        return 0;
+        if (connection->IsInputFull())
+        {
+            // Request doesn't fit the receive buffer.
+            HttpResponder::Append(responses, HttpResponder::payloadTooLarge, false, nullptr, 0);
+            keepAlive = false;
+            break;
+        }
+
+        // Edge triggered notification, so read until there's nothing left.
+        ssize_t res = connection->ReadAsync();
+        if (res < 0) break;
+
+        if (!res)
+        {
+            // Peer has closed its side, yet it may be reading still. Requests
+            // parsed are answered, incomplete one left is dropped with the connection.
+            keepAlive = false;
+            break;
+        }
+
+        // Requests are parsed in place, incomplete tail is kept for the next read.
+        boost::string_view input = connection->GetInputView();
+        size_t offset = 0;
+        size_t requests = 0;
+
+        while (keepAlive)
+        {
+            HttpRequest request;
+            size_t consumed = 0;
+            HttpParser::Result result = HttpParser::Parse(input.data() + offset, input.size() - offset, request, consumed);
+
+            if (result == HttpParser::incomplete) break;
+
+            if (result == HttpParser::malformed)
+            {
+                HttpResponder::Append(responses, HttpResponder::badRequest, false, nullptr, 0);
+                keepAlive = false;
+                break;
+            }
+
+            offset += consumed;
+            keepAlive = request.m_keepAlive;
+            ++requests;
+            Metrics::Get().m_messages.Add();
+
+            // Request body echoed back, bodiless requests get a short confirmation.
+            static const char defaultBody[] = "OK\n";
+            bool hasBody = !request.m_body.empty();
+            HttpResponder::Append(responses, HttpResponder::ok, keepAlive,
+                hasBody ? request.m_body.data() : defaultBody,
+                hasBody ? request.m_body.size() : sizeof(defaultBody) - 1,
+                request.m_method == "HEAD");
+        }
+
+        connection->Consume(offset);
+
+        // The rest stays in socket while the peer is over its limits.
+        if (keepAlive) throttled = ThrottlePeer(connection, requests, res);
     }
 
-    if (!res)
+    if (!responses.empty()) connection->WriteAsync(responses);
+
+    if (!keepAlive) Close(connection);
+    else
     {
-        // Remote side disconnected - reset connection instance to be reused some later.
-        connection->Disconnect();
-        m_cnMgr.Release(connection);
-        return 0;
+        TcpInfo::Sample(connection->Get());
+        if (!throttled) RefreshTimer(connection);
     }
 
-    // Asynchronous data reading just completed - get the data.
-    std::string data = connection->GetInputData();
-    std::cout << "Data coming from peer: " << data << std::endl;
+    // Input buffer is managed by Consume, nothing to clear.
+    return 0;
+}
 
-    // Write the back back to the peer.
-    connection->WriteAsync(data);
-    // Get ready to read next data portion.
-    connection->ReadAsync();
+void LinuxServer::Close(IConnection* connection)
+{
+    // Responses backlogged are written before the connection is released,
+    // unless the peer doesn't take them in time.
+    if (connection->Linger())
+    {
+        m_ioMgr.ArmTimer(connection, LINGER_TIMEOUT);
+        return;
+    }
 
-    return res;
+    connection->Disconnect();
+    m_cnMgr.Release(connection);
 }
 
 void LinuxServer::StartAsyncIo(IEndpoint* endpoint)
 {
+    // Address is turned into text by the log writer.
+    LOG_LIMITED(Logger::info, CONNECT_LOG_RATE, "Peer {} connected.", m_acceptor->GetPeerAddress());
+
+    // Peer is known before the first event of connection may come.
+    // New connection of a peer over its limits starts throttled,
+    // so opening more of them doesn't get it any more input read.
+    size_t wait = 0;
+    if (m_peerLimiter.IsEnabled() && static_cast<size_t>(endpoint->Get()) < m_peerCount)
+    {
+        PeerState& peer = m_peers[endpoint->Get()];
+        peer.m_key = PeerLimiter::GetKey(m_acceptor->GetPeerAddress());
+        wait = m_peerLimiter.Charge(peer.m_key, 0, 0);
+        boost::atomic_ref<uint32_t>(peer.m_throttled).store(wait ? 1 : 0);
+    }
+
     m_ioMgr.Bind(endpoint);
+
+    if (wait)
+    {
+        m_ioMgr.PauseInput(endpoint);
+        m_ioMgr.ArmTimer(endpoint, wait);
+    }
+    else if (m_settings.m_idleTimeout) m_ioMgr.ArmTimer(endpoint, m_settings.m_idleTimeout);
 }
 
 void LinuxServer::StopAsyncIo(IEndpoint* endpoint)
 {
-    m_ioMgr.Unbind(endpoint);
+    // Endpoint is closed right after, which drops it from epoll.
+    m_ioMgr.Forget(endpoint);
+    TcpInfo::Forget(endpoint->Get());
+}
+
+void LinuxServer::DeferInput(IEndpoint* endpoint)
+{
+    m_ioMgr.Defer(endpoint);
+}
+
+void LinuxServer::WatchOutput(IEndpoint* endpoint)
+{
+    // Input of throttled peer stays paused.
+    if (IsThrottled(endpoint)) m_ioMgr.PauseInput(endpoint);
+    else m_ioMgr.Rearm(endpoint);
+}
+
+void LinuxServer::SetServiceClass(IEndpoint* endpoint, uint8_t serviceClass)
+{
+    m_ioMgr.SetServiceClass(endpoint, serviceClass);
+}
+
+void LinuxServer::OnMemoryStage(MemoryGovernor::Stage stage)
+{
+    if (stage >= MemoryGovernor::shrink) BufferPool::Trim();
+    if (stage < MemoryGovernor::throttle) m_ioMgr.ResumeDeferred();
+}
+
+void LinuxServer::RefreshTimer(IConnection* connection)
+{
+    // Request deadline isn't moved by its parts coming in.
+    if (m_settings.m_requestTimeout && connection->HasPendingInput())
+        m_ioMgr.CapTimer(connection, m_settings.m_requestTimeout);
+    else if (m_settings.m_idleTimeout)
+        m_ioMgr.ArmTimer(connection, m_settings.m_idleTimeout);
+    else
+        m_ioMgr.CancelTimer(connection);
+}
+
+size_t LinuxServer::OnTimeout(IEndpoint* endpoint)
+{
+    // Pause of accepting is over.
+    if (endpoint == m_acceptor)
+    {
+        m_ioMgr.Rearm(endpoint);
+        return 0;
+    }
+
+    // Throttled peer is back within limits, its input is reported again
+    // if there's any. It's watched for idling from now on.
+    if (m_peerLimiter.IsEnabled() && static_cast<size_t>(endpoint->Get()) < m_peerCount &&
+        boost::atomic_ref<uint32_t>(m_peers[endpoint->Get()].m_throttled).exchange(0))
+    {
+        m_ioMgr.Rearm(endpoint);
+        return m_settings.m_idleTimeout;
+    }
+
+    // Lingering connection is kept as long as its peer reads.
+    if (OutputBacklog::HasProgressed(endpoint->Get())) return LINGER_TIMEOUT;
+
+    // Connection can't be reset here, it might be in use by another thread.
+    // Shut down socket reads as closed by peer, so the connection is
+    // released by the thread handling it next.
+    shutdown(endpoint->Get(), SHUT_RDWR);
+    return 0;
+}
+
+bool LinuxServer::ThrottlePeer(IConnection* connection, size_t requests, size_t bytes)
+{
+    if (!m_peerLimiter.IsEnabled() || static_cast<size_t>(connection->Get()) >= m_peerCount) return false;
+
+    PeerState& peer = m_peers[connection->Get()];
+    size_t wait = m_peerLimiter.Charge(peer.m_key, requests, bytes);
+    if (!wait) return false;
+
+    // Timer is armed before input is paused, so pending idle timeout
+    // doesn't take the connection for a throttled one.
+    m_ioMgr.ArmTimer(connection, wait);
+    boost::atomic_ref<uint32_t>(peer.m_throttled).store(1);
+    m_ioMgr.PauseInput(connection);
+    return true;
+}
+
+bool LinuxServer::IsThrottled(IEndpoint* endpoint)
+{
+    if (!m_peerLimiter.IsEnabled() || static_cast<size_t>(endpoint->Get()) >= m_peerCount) return false;
+    return boost::atomic_ref<uint32_t>(m_peers[endpoint->Get()].m_throttled).load() != 0;
+}
+
+void LinuxServer::AllocatePeers()
+{
+    // Descriptors are below the limit of open files.
+    rlimit limit = {};
+    if (getrlimit(RLIMIT_NOFILE, &limit) < 0) throw SystemException(errno);
+
+    m_peerCount = limit.rlim_cur == RLIM_INFINITY ? SlotMap<IEndpoint>::MAX_SIZE : limit.rlim_cur;
+    m_peers.reset(new PeerState[m_peerCount]);
+}
+
+void LinuxServer::LaneWorkCallback()
+{
+    try
+    {
+        m_ioMgr.RunLane();
+    }
+    catch(...)
+    {
+        m_exceptioning.Append(boost::current_exception());
+    }
+}
+
+void LinuxServer::RegisterConnectionTable()
+{
+    for (size_t i = 0; i < SERVICE_CLASS_COUNT; ++i)
+    {
+        Metrics::Register("connections_bound", "class=\"" + std::to_string(i) + "\"",
+            "Connections watched by event loops, by service class.", m_boundConnections[i]);
+    }
+    Metrics::Register("connections_backlogged", "", "Connections with output waiting for the socket.", m_backloggedConnections);
+    Metrics::Register("connections_throttled", "", "Connections paused by peer rate limits.", m_throttledConnections);
+}
+
+void LinuxServer::UnregisterConnectionTable()
+{
+    for (const Gauge& gauge : m_boundConnections) Metrics::Unregister(&gauge);
+    Metrics::Unregister(&m_backloggedConnections);
+    Metrics::Unregister(&m_throttledConnections);
+}
+
+void LinuxServer::SampleConnections()
+{
+    // Connections are pooled and never freed while the server runs, so
+    // walking them along with IO threads is safe, the summary is approximate.
+    std::array<int64_t, SERVICE_CLASS_COUNT> bound = {};
+    int64_t backlogged = 0;
+    int64_t throttled = 0;
+
+    m_ioMgr.ForEach([&](IEndpoint* endpoint)
+    {
+        if (!dynamic_cast<IConnection*>(endpoint)) return;
+
+        ++bound[endpoint->GetServiceClass()];
+        if (!OutputBacklog::IsEmpty(endpoint->Get())) ++backlogged;
+        if (IsThrottled(endpoint)) ++throttled;
+    });
+
+    for (size_t i = 0; i < SERVICE_CLASS_COUNT; ++i) m_boundConnections[i].Set(bound[i]);
+    m_backloggedConnections.Set(backlogged);
+    m_throttledConnections.Set(throttled);
+}
+
+void LinuxServer::PrintLoopStats()
+{
+    for (uint8_t i = 0; i < SERVICE_CLASS_COUNT; ++i)
+    {
+        const LatencyStats& latency = m_ioMgr.GetLatency(i);
+        if (!latency.GetCount()) continue;
+
+        std::cout << "Service class " << static_cast<unsigned>(i) << ": "
+            << latency.GetCount() << " events, latency mean " << latency.GetMean()
+            << " us, p99 " << latency.GetPercentile(0.99)
+            << " us, max " << latency.GetMax() << " us." << std::endl;
+    }
+
+    if (m_ioMgr.GetExhaustedCount())
+    {
+        std::cout << "IO budget exhausted " << m_ioMgr.GetExhaustedCount()
+            << " times, connections revisited " << m_ioMgr.GetRevisitCount() << " times." << std::endl;
+    }
 }
 
 #endif // _WIN64
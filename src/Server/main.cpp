@@ -4,12 +4,88 @@
 namespace opt = boost::program_options;
 
 static const short DEFAULT_PORT = 15000;
+static const size_t DEFAULT_COMPRESSION_THRESHOLD = 256;
+static const size_t DEFAULT_CACHE_SIZE = 64;
+static const size_t DEFAULT_CACHE_TTL = 1000;
+static const size_t DEFAULT_PREALLOCATED = 1;
+static const size_t DEFAULT_MEMORY_BUDGET = 0;
+static const size_t DEFAULT_IDLE_TIMEOUT = 0;
+static const size_t DEFAULT_REQUEST_TIMEOUT = 0;
+static const size_t DEFAULT_MAX_CONNECTIONS = 0;
+static const size_t DEFAULT_ACCEPT_RATE = 0;
+static const size_t DEFAULT_MAX_LAG = 0;
+static const size_t DEFAULT_MAX_QUEUE = 0;
+static const size_t DEFAULT_PEER_REQUEST_RATE = 0;
+static const size_t DEFAULT_PEER_BYTE_RATE = 0;
+static const size_t DEFAULT_PEER_TABLE = 0;
+static const size_t DEFAULT_LANE_THREADS = 0;
+static const size_t DEFAULT_IO_BUDGET = 0;
+static const size_t DEFAULT_LOG_BUFFER = 1024;
+static const unsigned short DEFAULT_ADMIN_PORT = 0;
+static const size_t DEFAULT_STATS_INTERVAL = 0;
+static const size_t DEFAULT_STALL_THRESHOLD = 0;
+static const size_t DEFAULT_TCP_INFO_INTERVAL = 0;
+static const size_t DEFAULT_TCP_INFO_BUDGET = 16;
 
 int main(int argc, char* argv[])
 {
     opt::options_description desc("TCPv6 server options");
     desc.add_options()
     ("port,p", opt::value<short>()->default_value(DEFAULT_PORT))
+    ("compression,c", opt::bool_switch(), "agree to compress payload if client offers it")
+    ("compression-threshold", opt::value<size_t>()->default_value(DEFAULT_COMPRESSION_THRESHOLD),
+        "messages shorter than this go uncompressed")
+    ("checksum", opt::bool_switch(), "agree to verify CRC32C of each frame if client offers it")
+    ("http", opt::bool_switch(), "respond to HTTP/1.1 requests instead of echoing (native Linux server)")
+    ("cache", opt::bool_switch(), "cache responses keyed by request (native Linux server)")
+    ("cache-size", opt::value<size_t>()->default_value(DEFAULT_CACHE_SIZE), "response cache memory bound, MB")
+    ("cache-ttl", opt::value<size_t>()->default_value(DEFAULT_CACHE_TTL), "cached response lifetime, ms")
+    ("pool-memory", opt::value<size_t>()->default_value(0),
+        "memory reserved and prefaulted at startup for connection and buffer pools, MB")
+    ("hugepages", opt::bool_switch(), "back pool memory with 2 MB pages if available")
+    ("mlock", opt::bool_switch(), "lock pool memory in RAM")
+    ("preallocate", opt::value<size_t>()->default_value(DEFAULT_PREALLOCATED), "connections created at startup")
+    ("memory-budget", opt::value<size_t>()->default_value(DEFAULT_MEMORY_BUDGET),
+        "memory for connections and buffers, MB, load is shed as it's approached (0 - unlimited)")
+    ("memory-pressure", opt::bool_switch(), "shed load on memory pressure stall information of the kernel too")
+    ("idle-timeout", opt::value<size_t>()->default_value(DEFAULT_IDLE_TIMEOUT),
+        "close connections silent for this long, s (0 - never, native Linux server)")
+    ("request-timeout", opt::value<size_t>()->default_value(DEFAULT_REQUEST_TIMEOUT),
+        "close connections not completing a request in this time, s (0 - no limit, native Linux server)")
+    ("max-connections", opt::value<size_t>()->default_value(DEFAULT_MAX_CONNECTIONS),
+        "peers beyond this many connections get busy reply (0 - unlimited, native Linux server)")
+    ("accept-rate", opt::value<size_t>()->default_value(DEFAULT_ACCEPT_RATE),
+        "peers accepted per second, the rest wait in backlog (0 - unlimited, native Linux server)")
+    ("max-lag", opt::value<size_t>()->default_value(DEFAULT_MAX_LAG),
+        "peers get busy reply while event loops are busy longer per wakeup, ms (0 - not watched, native Linux server)")
+    ("max-queue", opt::value<size_t>()->default_value(DEFAULT_MAX_QUEUE),
+        "peers get busy reply while more events are ready per wakeup (0 - not watched, native Linux server)")
+    ("peer-request-rate", opt::value<size_t>()->default_value(DEFAULT_PEER_REQUEST_RATE),
+        "requests per second from a single address, input is paused beyond (0 - unlimited, native Linux server)")
+    ("peer-byte-rate", opt::value<size_t>()->default_value(DEFAULT_PEER_BYTE_RATE),
+        "KB per second from a single address, input is paused beyond (0 - unlimited, native Linux server)")
+    ("peer-table", opt::value<size_t>()->default_value(DEFAULT_PEER_TABLE),
+        "addresses tracked by peer rate limits (0 - about a million)")
+    ("lane-threads", opt::value<size_t>()->default_value(DEFAULT_LANE_THREADS),
+        "pinned threads busy polling connections of the top service class (0 - none, native Linux server)")
+    ("io-budget", opt::value<size_t>()->default_value(DEFAULT_IO_BUDGET),
+        "KB a connection reads and writes per turn, then others ready go first (0 - unlimited, native Linux server)")
+    ("log-level", opt::value<std::string>()->default_value("info"),
+        "least severe records logged: debug, info, warning or error (debug shows every message)")
+    ("log-buffer", opt::value<size_t>()->default_value(DEFAULT_LOG_BUFFER),
+        "log records a thread may have waiting for the writer, the rest are dropped")
+    ("admin-port", opt::value<unsigned short>()->default_value(DEFAULT_ADMIN_PORT),
+        "loopback port serving metrics at /metrics and /metrics.json (0 - none, native Linux server)")
+    ("stats-interval", opt::value<size_t>()->default_value(DEFAULT_STATS_INTERVAL),
+        "publish metrics to /dev/shm for Monitor this often, ms (0 - never, Linux)")
+    ("stall-threshold", opt::value<size_t>()->default_value(DEFAULT_STALL_THRESHOLD),
+        "log event loop threads busy longer than this along with their stack, ms (0 - never, native Linux server)")
+    ("tcp-info-interval", opt::value<size_t>()->default_value(DEFAULT_TCP_INFO_INTERVAL),
+        "sample TCP_INFO of each active connection this often, ms (0 - never, native Linux server)")
+    ("tcp-info-budget", opt::value<size_t>()->default_value(DEFAULT_TCP_INFO_BUDGET),
+        "connections an event loop thread samples per wakeup at most")
+    ("timestamps", opt::bool_switch(),
+        "time input waiting in sockets and output waiting for the device by kernel timestamps (native Linux server)")
     ("help,h", "see this help text");
 
     opt::variables_map varMap;
@@ -22,9 +98,73 @@ int main(int argc, char* argv[])
         return 1;
     }
 
-    short port = (varMap.count("port")) ? varMap["port"].as<short>() : DEFAULT_PORT;
-    
-    RUN_APP(CurrentServer, port);
+    ServerSettings settings;
+    settings.m_port = (varMap.count("port")) ? varMap["port"].as<short>() : DEFAULT_PORT;
+    settings.m_framing = FramingPolicy(
+        varMap["compression"].as<bool>(),
+        varMap["compression-threshold"].as<size_t>(),
+        varMap["checksum"].as<bool>());
+    settings.m_http = varMap["http"].as<bool>();
+    settings.m_cache = ResponseCachePolicy(
+        varMap["cache"].as<bool>(),
+        varMap["cache-size"].as<size_t>() * 1024 * 1024,
+        varMap["cache-ttl"].as<size_t>());
+
+    settings.m_memory = PoolMemoryPolicy(
+        varMap["pool-memory"].as<size_t>() * 1024 * 1024,
+        varMap["hugepages"].as<bool>(),
+        varMap["mlock"].as<bool>(),
+        varMap["preallocate"].as<size_t>());
+    settings.m_budget = MemoryBudgetPolicy(varMap["memory-budget"].as<size_t>() * 1024 * 1024,
+        varMap["memory-pressure"].as<bool>());
+    settings.m_idleTimeout = varMap["idle-timeout"].as<size_t>() * 1000;
+    settings.m_requestTimeout = varMap["request-timeout"].as<size_t>() * 1000;
+    settings.m_admission = AdmissionPolicy(
+        varMap["max-connections"].as<size_t>(),
+        varMap["accept-rate"].as<size_t>(),
+        varMap["max-lag"].as<size_t>() * 1000,
+        varMap["max-queue"].as<size_t>());
+    settings.m_peerLimit = PeerLimitPolicy(
+        varMap["peer-request-rate"].as<size_t>(),
+        varMap["peer-byte-rate"].as<size_t>() * 1024,
+        varMap["peer-table"].as<size_t>());
+    settings.m_laneThreads = varMap["lane-threads"].as<size_t>();
+    settings.m_ioBudget = varMap["io-budget"].as<size_t>() * 1024;
+    settings.m_adminPort = varMap["admin-port"].as<unsigned short>();
+    settings.m_stats = StatsPolicy(varMap["stats-interval"].as<size_t>());
+    settings.m_stallThreshold = varMap["stall-threshold"].as<size_t>();
+    settings.m_tcpInfo = TcpInfoPolicy(
+        varMap["tcp-info-interval"].as<size_t>(),
+        varMap["tcp-info-budget"].as<size_t>());
+    settings.m_timestamps = varMap["timestamps"].as<bool>();
+
+    static const char* levels[] = { "debug", "info", "warning", "error" };
+    std::string level = varMap["log-level"].as<std::string>();
+    auto found = std::find(std::begin(levels), std::end(levels), level);
+    if (found == std::end(levels))
+    {
+        std::cout << "Unknown log level " << level << "." << std::endl;
+        return 1;
+    }
+    settings.m_log = LoggerPolicy(static_cast<uint8_t>(found - std::begin(levels)), varMap["log-buffer"].as<size_t>());
+
+    // Pools have to be backed before the server creates any connection.
+    PoolMemory::Init(settings.m_memory);
+    if (settings.m_memory.m_size)
+    {
+        std::cout << "Pool memory backed by " << PoolMemory::GetBackingName()
+            << (PoolMemory::IsLocked() ? ", locked." : ".") << std::endl;
+    }
+
+    Logger::Start(settings.m_log);
+#if defined(__linux__)
+    StatsSegment::Start(settings.m_stats);
+#endif
+    RUN_APP(CurrentServer, settings);
+#if defined(__linux__)
+    StatsSegment::Stop();
+#endif
+    Logger::Stop();
 
     return 0;
 }
\ No newline at end of file